@@ -19,171 +19,46 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include <stddef.h>
 #include "bluetooth.h"
 
-/* these values for hop() can be precalculated (at leastin part) */
-u8 a1, b, c1, e;
-u16 d1;
-/* frequency register bank */
-u8 bank[NUM_BREDR_CHANNELS];
-u8 afh_bank[NUM_BREDR_CHANNELS];
+u64 ac_targets[BT_AC_MAX_TARGETS];
+u8 ac_target_count;
 
-/* count the number of 1 bits in a uint64_t */
-static uint8_t count_bits(uint64_t n)
-{
-	uint8_t i = 0;
-	for (i = 0; n != 0; i++)
-		n &= n - 1;
-	return i;
-}
+/* hop kernel state for the current target */
+bt_hop_t hop_state;
+
+/* access code search state, carried from one DMA buffer to the next */
+static bt_ac_correlator_t ac_corr;
 
 /* do all of the one time precalculation */
 void precalc(void)
 {
-	u8 i, j, chan;
-	u32 address;
-	address = target.address & 0xffffffff;
-	syncword = 0;
-
-	/* populate frequency register bank*/
-	for (i = 0; i < NUM_BREDR_CHANNELS; i++)
-		bank[i] = ((i * 2) % NUM_BREDR_CHANNELS);
-		/* actual frequency is 2402 + bank[i] MHz */
-
-
-	/* precalculate some of next_hop()'s variables */
-	a1 = (address >> 23) & 0x1f;
-	b = (address >> 19) & 0x0f;
-	c1 = ((address >> 4) & 0x10) +
-		((address >> 3) & 0x08) +
-		((address >> 2) & 0x04) +
-		((address >> 1) & 0x02) +
-		(address & 0x01);
-	d1 = (address >> 10) & 0x1ff;
-	e = ((address >> 7) & 0x40) +
-		((address >> 6) & 0x20) +
-		((address >> 5) & 0x10) +
-		((address >> 4) & 0x08) +
-		((address >> 3) & 0x04) +
-		((address >> 2) & 0x02) +
-		((address >> 1) & 0x01);
-
-	if(afh_enabled) {
-		used_channels = 0;
-		for(i = 0; i < 10; i++)
-			used_channels += count_bits((uint64_t) afh_map[i]);
-		j = 0;
-		for (i = 0; i < NUM_BREDR_CHANNELS; i++) {
-			chan = (i * 2) % NUM_BREDR_CHANNELS;
-			if(afh_map[chan/8] & (0x1 << (chan % 8)))
-				bank[j++] = chan;
-		}
-	}
+	reset_access_code();
+	bt_hop_init(&hop_state, target.address & 0xffffffff,
+	            afh_enabled ? afh_map : NULL);
+	if (afh_enabled)
+		used_channels = hop_state.used_channels;
 }
 
-/* 5 bit permutation */
-static u8 perm5(u8 z, u8 p_high, u16 p_low)
+u16 next_hop(u32 clock)
 {
-	/* z is constrained to 5 bits, p_high to 5 bits, p_low to 9 bits */
-	z &= 0x1f;
-	p_high &= 0x1f;
-	p_low &= 0x1ff;
-
-	int i;
-	u8 tmp, output, z_bit[5], p[14];
-	static const u8 index1[] = {0, 2, 1, 3, 0, 1, 0, 3, 1, 0, 2, 1, 0, 1};
-	static const u8 index2[] = {1, 3, 2, 4, 4, 3, 2, 4, 4, 3, 4, 3, 3, 2};
-
-	/* bits of p_low and p_high are control signals */
-	for (i = 0; i < 9; i++)
-		p[i] = (p_low >> i) & 0x01;
-	for (i = 0; i < 5; i++)
-		p[i+9] = (p_high >> i) & 0x01;
-
-	/* bit swapping will be easier with an array of bits */
-	for (i = 0; i < 5; i++)
-		z_bit[i] = (z >> i) & 0x01;
-
-	/* butterfly operations */
-	for (i = 13; i >= 0; i--) {
-		/* swap bits according to index arrays if control signal tells us to */
-		if (p[i]) {
-			tmp = z_bit[index1[i]];
-			z_bit[index1[i]] = z_bit[index2[i]];
-			z_bit[index2[i]] = tmp;
-		}
-	}
-
-	/* reconstruct output from rearranged bits */
-	output = 0;
-	for (i = 0; i < 5; i++)
-		output += z_bit[i] << i;
-
-	return output;
+	return bt_hop_next(&hop_state, clock);
 }
 
-u16 next_hop(u32 clock)
+/* call whenever the symbol stream is interrupted, e.g. by a retune */
+void reset_access_code(void)
 {
-	u8 a, c, x, y1, perm, next_channel;
-	u16 d, y2;
-	u32 base_f, f, f_dash;
-
-	clock &= 0xffffffff;
-	/* Variable names used in Vol 2, Part B, Section 2.6 of the spec */
-	x = (clock >> 2) & 0x1f;
-	y1 = (clock >> 1) & 0x01;
-	y2 = y1 << 5;
-	a = (a1 ^ (clock >> 21)) & 0x1f;
-	/* b is already defined */
-	c = (c1 ^ (clock >> 16)) & 0x1f;
-	d = (d1 ^ (clock >> 7)) & 0x1ff;
-	/* e is already defined */
-	base_f = (clock >> 3) & 0x1fffff0;
-	f = base_f % 79;
-
-	perm = perm5(
-		((x + a) % 32) ^ b,
-		(y1 * 0x1f) ^ c,
-		d);
-	/* hop selection */
-	next_channel = bank[(perm + e + f + y2) % NUM_BREDR_CHANNELS];
-	if(afh_enabled) {
-		f_dash = base_f % used_channels;
-		next_channel = afh_bank[(perm + e + f_dash + y2) % used_channels];
-	}
-	return (2402 + next_channel);
-
+	bt_ac_init(&ac_corr);
 }
 
-int find_access_code(u8 *idle_rxbuf)
+/* Returns the symbol offset in idle_rxbuf just past the target access code,
+ * or any of ac_targets if set, or -1. Accepts up to max_errs bit errors. */
+int find_access_code(u8 *idle_rxbuf, int max_errs)
 {
-	/* Looks for an AC in the stream */
-	u8 bit_errors, curr_buf;
-	int i = 0, count = 0;
-
-	if (syncword == 0) {
-		for (; i<8; i++) {
-			syncword <<= 8;
-			syncword = (syncword & 0xffffffffffffff00) | idle_rxbuf[i];
-		}
-		count = 64;
-	}
-	curr_buf = idle_rxbuf[i];
-
-	// Search until we're 64 symbols from the end of the buffer
-	for(; count < ((8 * DMA_SIZE) - 64); count++)
-	{
-		bit_errors = count_bits(syncword ^ target.syncword);
-
-		if (bit_errors < MAX_SYNCWORD_ERRS)
-			return count;
-
-		if (count%8 == 0)
-			curr_buf = idle_rxbuf[++i];
-
-		syncword <<= 1;
-		syncword = (syncword & 0xfffffffffffffffe) | ((curr_buf & 0x80) >> 7);
-		curr_buf <<= 1;
-	}
-	return -1;
+	if (ac_target_count)
+		return bt_ac_search_set(&ac_corr, ac_targets, ac_target_count,
+		                        idle_rxbuf, DMA_SIZE, max_errs + 1, NULL);
+	return bt_ac_search(&ac_corr, target.syncword, idle_rxbuf, DMA_SIZE,
+	                    max_errs + 1);
 }
@@ -24,15 +24,20 @@
 #define __BLUETOOTH_H
 
 #include "ubertooth.h"
+#include "ubertooth_bluetooth.h"
 
 #define MAX_SYNCWORD_ERRS 5
 
 bdaddr target;
-u64 syncword;
 u8 afh_enabled;
 u8 afh_map[10];
 u8 used_channels;
 
+/* access codes installed with UBERTOOTH_SET_AC_TARGETS, searched for in
+ * place of target.syncword when there are any */
+extern u64 ac_targets[BT_AC_MAX_TARGETS];
+extern u8 ac_target_count;
+
 /* Barker distance/correct gains us very little when sniffing a known AC
 static const u8 ao_barker_distance[] = {
 	3,2,3,3,2,1,3,2,2,1,3,2,1,0,2,1,3,3,2,3,3,2,3,3,3,2,3,3,2,1,3,2, //0x00-0x1f
@@ -57,6 +62,7 @@ static const u8 ao_barker_correct[] = {
 
 void precalc();
 u16 next_hop(u32 clkn);
-int find_access_code(u8 *idle_rxbuf);
+void reset_access_code(void);
+int find_access_code(u8 *idle_rxbuf, int max_errs);
 
 #endif /* __BLUETOOTH_H */
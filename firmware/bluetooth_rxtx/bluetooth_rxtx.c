@@ -29,6 +29,7 @@
 #include "ubertooth_cs.h"
 #include "ubertooth_dma.h"
 #include "ubertooth_clock.h"
+#include "ubertooth_trace.h"
 #include "bluetooth.h"
 #include "bluetooth_le.h"
 #include "cc2400_rangetest.h"
@@ -50,6 +51,21 @@ volatile uint16_t hop_timeout = 158;
 volatile uint16_t requested_channel = 0;
 volatile uint16_t le_adv_channel = 2402;
 
+/* overlapped retune, see hop_start() */
+enum retune_states {
+	RETUNE_IDLE   = 0,
+	RETUNE_UNLOCK = 1,  // waiting for the synthesizer to turn off
+	RETUNE_LOCK   = 2,  // waiting for lock on the new channel
+};
+volatile uint8_t  retune_state = RETUNE_IDLE;
+int8_t            retune_cs = 0;
+uint32_t          retune_start = 0;
+uint32_t          retune_start_cycles = 0;
+uint8_t           hop_prepared = 0;
+uint32_t          hop_prepared_clkn = 0;
+uint16_t          hop_prepared_channel = 0;
+int8_t            hop_prepared_cs = 0;
+
 /* bulk USB stuff */
 volatile uint8_t  idle_buf_clkn_high = 0;
 volatile uint32_t idle_buf_clk100ns = 0;
@@ -68,8 +84,72 @@ volatile uint8_t modulation = MOD_BT_BASIC_RATE;
 /* specan stuff */
 volatile uint16_t low_freq = 2400;
 volatile uint16_t high_freq = 2483;
+
+/* fast sweep VCO calibration cache and timing */
+#define SPECAN_FAST_MAX_BINS 128
+#define SPECAN_CAL_INVALID   0xffff
+#define SPECAN_SETTLE_MAX    300  // 30 us, slower than the old fixed delay
+#define SPECAN_LOCK_TIMEOUT  1000 // 100 us
+typedef struct {
+	u16 vco_array;
+	u16 vco_current;
+} specan_cal_t;
+specan_cal_t specan_cal[SPECAN_FAST_MAX_BINS];
+volatile u32 specan_sweeps = 0;
+volatile u32 specan_sweep_time = 0;
+volatile u16 specan_settle_time = 0;
+
+/* samples waiting to be sent as SPECAN or SPECAN_COMPACT */
+volatile u8 specan_format = SPECAN_FORMAT_TRIPLES;
+u8 specan_buf[DMA_SIZE];
+u8 specan_count = 0;
 volatile int8_t rssi_threshold = -30;  // -54dBm - 30 = -84dBm
 
+/* only send BR_PACKETs containing the target access code */
+volatile u8 ac_filter = 0;
+volatile u8 ac_filter_errs = 0;
+
+/* only follow LE connections with one of these access addresses */
+u32 le_aa_targets[BT_AC_MAX_TARGETS];
+volatile u8 le_aa_target_count = 0;
+volatile u8 le_aa_filter_errs = 0;
+
+/* buffers passed and dropped by the filters above, reported to the host in
+ * a FILTER_SUMMARY every FILTER_SUMMARY_INTERVAL CLKN periods */
+#define FILTER_SUMMARY_INTERVAL 32768
+u32 filter_passed = 0;
+u32 filter_dropped = 0;
+u32 filter_summary_last = 0;
+
+/* precede packets with TIME_SYNC when time_sync_due is raised */
+volatile u8 time_sync = 0;
+
+/* send LE packets as records in LE_PACKED packets */
+volatile u8 le_packed = 0;
+
+/* count repeated advertising PDUs instead of sending them, summarising the
+ * counts every ADV_SUMMARY_INTERVAL CLKN periods */
+#define ADV_SUMMARY_INTERVAL 3200
+volatile u8 adv_dedup = 0;
+le_adv_cache_t adv_cache;
+u32 adv_summary_last = 0;
+
+/* send RSSI_TELEMETRY reports every rssi_telemetry_interval CLKN periods,
+ * 0 for never */
+volatile u32 rssi_telemetry_interval = 0;
+u32 rssi_telemetry_last = 0;
+
+/* work out the AFH map on the device, see UBERTOOTH_AFH_LEARN */
+volatile u8 afh_learn = 0;
+bt_afh_learn_t afh_learn_state;
+
+/* keep CLKN locked to the piconet being followed, reporting the loop state
+ * every CLOCK_TRACK_INTERVAL CLKN periods, see UBERTOOTH_CLOCK_TRACK */
+#define CLOCK_TRACK_INTERVAL 3200
+volatile u8 clock_track = 0;
+bt_clock_track_t clock_track_state;
+u32 clock_track_last = 0;
+
 /* Generic TX stuff */
 generic_tx_packet tx_pkt;
 
@@ -90,21 +170,33 @@ le_state_t le = {
 	.last_packet = 0,
 };
 
-typedef struct _le_promisc_active_aa_t {
-	u32 aa;
-	int count;
-} le_promisc_active_aa_t;
-
 typedef struct _le_promisc_state_t {
-	// LFU cache of recently seen AA's
-	le_promisc_active_aa_t active_aa[32];
+	// recently seen AA's
+	le_aa_cache_t aa_cache;
+	int aa_cache_changed;
+	u32 aa_cache_reported;
 
-	// recovering hop interval
-	u32 smallest_hop_interval;
-	int consec_intervals;
+	// recovering hop interval and increment
+	le_hop_solver_t hop;
 } le_promisc_state_t;
 le_promisc_state_t le_promisc;
-#define AA_LIST_SIZE (int)(sizeof(le_promisc.active_aa) / sizeof(le_promisc_active_aa_t))
+
+/* Connections followed at once, see UBERTOOTH_LE_FOLLOW_MULTI. The one the
+ * radio is on has its state in le, the others wait in le_conn[] with their
+ * anchors counted by TIMER0_IRQHandler. Slot 0 holds the listener on the
+ * advertising channel. */
+volatile u8 le_follow_max = 1;
+le_state_t le_conn[LE_FOLLOW_MAX + 1];
+volatile u8 le_conn_cur = 0;            // slot whose state is in le
+volatile u8 le_conn_next = 0;           // slot the scheduler wants in le
+volatile u8 le_conn_tuned = 0;          // already on the channel of le's next anchor
+volatile u32 le_conn_anchor = 0;        // clkn of le's last anchor
+
+/* in CLKN periods */
+#define LE_FOLLOW_LEAD  2               // tune in this long before an anchor
+#define LE_FOLLOW_DWELL 4               // and stay this long after it
+#define LE_FOLLOW_GAP   8               // shortest gap spent advertising
+#define LE_CONN_TIMEOUT 50000000        // CLK100NS ticks without a packet
 
 /* LE jamming */
 #define JAM_COUNT_DEFAULT 40
@@ -121,10 +213,381 @@ packet_cb_t packet_cb = NULL;
 
 /* Unpacked symbol buffers (two rxbufs) */
 char unpacked[DMA_SIZE*8*2];
+/* the same symbols, packed as received */
+u8 packed[DMA_SIZE*2];
+
+/* Claim the oldest received DMA buffer as idle_rxbuf and load its metadata
+ * for enqueue(). Flags DMA_OVERFLOW if the ring was overrun. */
+static void rx_claim(void)
+{
+	uint32_t lost = dma_rx_claim();
+
+	if (lost) {
+		status |= DMA_OVERFLOW;
+		perf.dma_overflows += lost;
+	}
+
+	idle_buf_clk100ns  = idle_rxmeta->clk100ns;
+	idle_buf_clkn_high = idle_rxmeta->clkn_high;
+	idle_buf_channel   = idle_rxmeta->channel;
+	if (idle_rxmeta->discard)
+		status |= DISCARD;
+}
+
+/* Queue a TIME_SYNC tying CLK100NS to the monotonic device tick. If the
+ * pool is empty time_sync_due stays set and the next packet tries again. */
+static void time_sync_enqueue(void)
+{
+	usb_pkt_rx* f;
+	uint64_t mono, tick;
+	uint32_t clk, tc;
+	int i;
+
+	f = usb_alloc();
+	if (f == NULL)
+		return;
+
+	time_sync_due = 0;
+	do {
+		mono = clkn_mono;
+		clk = clkn;
+		tc = T0TC;
+	} while (mono != clkn_mono || clk != clkn);
+	tick = mono * 3125 + tc;
+
+	f->pkt_type = TIME_SYNC;
+	f->status = 0;
+	f->channel = (uint8_t)((channel - 2402) & 0xff);
+	f->clkn_high = (clk >> 20) & 0xff;
+	f->clk100ns = 3125 * (clk & 0xfffff) + tc;
+	f->rssi_min = 0;
+	f->rssi_max = 0;
+	f->rssi_avg = 0;
+	f->rssi_count = 0;
+
+	memset(f->data, 0, DMA_SIZE);
+	for (i = 0; i < 8; i++)
+		f->data[i] = (tick >> (8*i)) & 0xff;
+	for (i = 0; i < 4; i++)
+		f->data[8+i] = (clk >> (8*i)) & 0xff;
+
+	usb_enqueue(f);
+}
+
+/* Queue the per-channel RSSI report when it is due, in as many
+ * RSSI_TELEMETRY packets as it takes. Channels that do not fit in the pool
+ * are left for the next report. */
+static void rssi_telemetry_poll(void)
+{
+	usb_pkt_rx* f;
+	int more;
+
+	if (rssi_telemetry_interval == 0
+	    || (u32)clkn_mono - rssi_telemetry_last < rssi_telemetry_interval)
+		return;
+	rssi_telemetry_last = (u32)clkn_mono;
+
+	if (time_sync && time_sync_due)
+		time_sync_enqueue();
+
+	do {
+		f = usb_alloc();
+		if (f == NULL)
+			return;
+
+		f->pkt_type = RSSI_TELEMETRY;
+		f->status = 0;
+		f->channel = (uint8_t)((channel - 2402) & 0xff);
+		f->clkn_high = (clkn >> 20) & 0xff;
+		f->clk100ns = CLK100NS;
+		f->rssi_min = 0;
+		f->rssi_max = 0;
+		f->rssi_avg = 0;
+		f->rssi_count = 0;
+
+		memset(f->data, 0, DMA_SIZE);
+		f->data[0] = rssi_telemetry_pack(&f->data[2], RSSI_TELEMETRY_MAX, &more);
+		f->data[1] = more ? 0 : RSSI_TELEMETRY_LAST;
+
+		usb_enqueue(f);
+	} while (more);
+}
+
+/* Append the LE packet in buf to the open LE_PACKED packet. Returns 1 on
+ * success, -1 if the queue is full and 0 if the packet is too long for a
+ * record and has to go out as an LE_PACKET. */
+static int le_pack(uint8_t* buf)
+{
+	usb_pkt_rx* f;
+	uint8_t* r;
+	uint32_t dt = 0;
+	int len, off;
+
+	len = (buf[5] & 0x3f) + 4 + 2 + 3;
+	if (LE_RECORD_HEADER + len > DMA_SIZE)
+		return 0;
+
+	f = usb_pack_begin(LE_RECORD_HEADER + len, &off);
+	if (f != NULL && off > 0) {
+		dt = bt_clk100ns_diff(idle_buf_clk100ns, f->clk100ns);
+		if (dt > LE_RECORD_MAX_DT || f->le_conn != le_conn_cur) {
+			/* too far from the first record or from another
+			 * connection, start afresh */
+			usb_pack_end(0);
+			usb_pack_flush();
+			f = usb_pack_begin(LE_RECORD_HEADER + len, &off);
+		}
+	}
+
+	if (f == NULL) {
+		status |= FIFO_OVERFLOW;
+		return -1;
+	}
+
+	if (off == 0) {
+		f->pkt_type = LE_PACKED;
+		f->le_conn = le_conn_cur;
+		f->status = 0;
+		f->channel = (uint8_t)((idle_buf_channel - 2402) & 0xff);
+		f->clkn_high = idle_buf_clkn_high;
+		f->clk100ns = idle_buf_clk100ns;
+		f->rssi_min = 0;
+		f->rssi_max = 0;
+		f->rssi_avg = 0;
+		f->rssi_count = 0;
+		dt = 0;
+	}
+
+	r = &f->data[off];
+	r[0] = len;
+	r[1] = (uint8_t)((idle_buf_channel - 2402) & 0xff);
+	r[2] = rssi_max;
+	r[3] = rssi_min;
+	r[4] = dt & 0xff;
+	r[5] = (dt >> 8) & 0xff;
+	r[6] = (dt >> 16) & 0xff;
+	memcpy(r + LE_RECORD_HEADER, buf, len);
+
+	f->status |= status;
+	status = 0;
+
+	usb_pack_end(LE_RECORD_HEADER + len);
+	return 1;
+}
+
+static int enqueue(uint8_t type, uint8_t* buf);
+
+static void filter_reset(void)
+{
+	filter_passed = 0;
+	filter_dropped = 0;
+	filter_summary_last = (u32)clkn_mono;
+}
+
+/* Count a buffer seen by a filter, sending a summary when one is due */
+static void filter_count(int passed)
+{
+	u8 buf[DMA_SIZE];
+	int i;
+
+	if (passed)
+		filter_passed++;
+	else
+		filter_dropped++;
 
+	if ((u32)clkn_mono - filter_summary_last < FILTER_SUMMARY_INTERVAL)
+		return;
+	filter_summary_last = (u32)clkn_mono;
+
+	memset(buf, 0, DMA_SIZE);
+	for (i = 0; i < 4; i++) {
+		buf[i] = (filter_passed >> (8*i)) & 0xff;
+		buf[4+i] = (filter_dropped >> (8*i)) & 0xff;
+	}
+	enqueue(FILTER_SUMMARY, buf);
+}
+
+static void adv_dedup_reset(void)
+{
+	le_adv_cache_init(&adv_cache);
+	adv_summary_last = (u32)clkn_mono;
+}
+
+/* Send ADV_SUMMARY packets for every entry with repeats, or only for e */
+static void adv_summary_send(le_adv_entry_t* e)
+{
+	u8 buf[DMA_SIZE];
+	int i, n = 0;
+
+	memset(buf, 0, DMA_SIZE);
+	if (e != NULL) {
+		le_adv_summary_pack(e, &buf[1]);
+		buf[0] = 1;
+		enqueue(ADV_SUMMARY, buf);
+		return;
+	}
+
+	for (i = 0; i < LE_ADV_CACHE_SIZE; i++) {
+		e = &adv_cache.entry[i];
+		if (e->count == 0)
+			continue;
+		le_adv_summary_pack(e, &buf[1 + n * LE_ADV_SUMMARY_LEN]);
+		e->count = 0;
+		if (++n == ADV_SUMMARY_MAX) {
+			buf[0] = n;
+			enqueue(ADV_SUMMARY, buf);
+			memset(buf, 0, DMA_SIZE);
+			n = 0;
+		}
+	}
+	if (n > 0) {
+		buf[0] = n;
+		enqueue(ADV_SUMMARY, buf);
+	}
+}
+
+/* Returns 1 if the advertising packet p should be sent to the host */
+static int adv_dedup_check(u8* p, int8_t rssi)
+{
+	le_adv_entry_t evicted;
+	int r;
+
+	if (!le_adv_dedupable(p + 4))
+		return 1;
+
+	r = le_adv_cache_see(&adv_cache, p + 4, rssi, idle_buf_clk100ns, &evicted);
+	if (r == LE_ADV_NEW_EVICTED)
+		adv_summary_send(&evicted);
+	return r != LE_ADV_REPEAT;
+}
+
+/* Send the learnt map. The changes are only forgotten once they are
+ * queued, so a full pool just delays them. */
+static void afh_map_send(void)
+{
+	u8 buf[DMA_SIZE];
+	int i;
+
+	memset(buf, 0, DMA_SIZE);
+	memcpy(buf, afh_learn_state.map, 10);
+	memcpy(&buf[10], afh_learn_state.changed, 10);
+	buf[20] = afh_learn_state.used;
+	for (i = 0; i < 4; i++)
+		buf[21 + i] = (afh_learn_state.hits >> (8*i)) & 0xff;
+
+	if (enqueue(AFH_MAP, buf))
+		memset(afh_learn_state.changed, 0, 10);
+}
+
+/* Account for the idle buffer while learning the AFH map, ac being where
+ * the target access code was found in it or -1. The buffer itself stays on
+ * the device, and a hit moves on to the next channel straight away. */
+static void afh_learn_buffer(int ac)
+{
+	u8 ch = idle_buf_channel - 2402;
+
+	if (ac >= 0) {
+		if (bt_afh_learn_hit(&afh_learn_state, ch,
+		                     afh_learn & AFH_LEARN_DISCOVER)) {
+			memcpy(afh_map, afh_learn_state.map, 10);
+			used_channels = afh_learn_state.used;
+		}
+		do_hop = 1;
+	}
+	status &= ~(CS_TRIGGER | RSSI_TRIGGER | DISCARD);
+
+	/* also retries changes that did not fit in the pool */
+	for (ch = 0; ch < 10; ch++) {
+		if (afh_learn_state.changed[ch]) {
+			afh_map_send();
+			break;
+		}
+	}
+}
+
+static void clock_track_send(void)
+{
+	usb_pkt_rx* f;
+	u32 v[4];
+	int i, j;
+
+	f = usb_alloc();
+	if (f == NULL)
+		return;
+	clock_track_last = (u32)clkn_mono;
+
+	f->pkt_type = CLOCK_TRACK;
+	f->status = 0;
+	f->channel = (uint8_t)((channel - 2402) & 0xff);
+	f->clkn_high = (clkn >> 20) & 0xff;
+	f->clk100ns = CLK100NS;
+	f->rssi_min = 0;
+	f->rssi_max = 0;
+	f->rssi_avg = 0;
+	f->rssi_count = 0;
+
+	memset(f->data, 0, DMA_SIZE);
+	f->data[0] = clock_track_state.locked ? CLOCK_TRACK_LOCKED : 0;
+	v[0] = (u32)clock_track_state.last_err;
+	v[1] = (u32)clock_track_state.rate;
+	v[2] = clock_track_state.updates;
+	v[3] = clock_track_state.relocks;
+	for (i = 0; i < 4; i++)
+		for (j = 0; j < 4; j++)
+			f->data[1 + 4*i + j] = (v[i] >> (8*j)) & 0xff;
+
+	usb_enqueue(f);
+}
+
+/* Feed the access code found at symbol ac of the idle buffer to the clock
+ * loop. The buffer ends at idle_buf_clk100ns and took 10 ticks a symbol, so
+ * the code started 10 * (ac - 64) - 4000 ticks from then. It should start
+ * CLK_TUNE_TIME into a slot. */
+static void clock_track_hit(int ac)
+{
+	int32_t err, trim;
+	u32 relocks = clock_track_state.relocks;
+
+	err = (idle_buf_clk100ns + 6250 + 10 * (ac - 64) - 4000) % 6250;
+	err -= CLK_TUNE_TIME;
+	if (err >= 3125)
+		err -= 6250;
+	else if (err < -3125)
+		err += 6250;
+
+	trim = bt_clock_track_update(&clock_track_state, err, clkn);
+	clk_drift_rate = clock_track_state.rate;
+
+	if (trim != 0) {
+		TRACE(TRACE_CLOCK_TRIM, (u16)trim);
+		clk100ns_offset = trim > 0 ? trim : 6250 + trim;
+	}
+	if (clock_track_state.relocks != relocks)
+		clock_track_send();
+}
+
+/* Queue buf for the host. The idle DMA buffer is handed over as it is where
+ * dma_rx_take() allows, anything else is copied into a packet from the
+ * pool. */
 static int enqueue(uint8_t type, uint8_t* buf)
 {
-	usb_pkt_rx* f = usb_enqueue();
+	usb_pkt_rx* f;
+	int r;
+
+	if (time_sync && time_sync_due)
+		time_sync_enqueue();
+
+	if (type == LE_PACKET && le_packed) {
+		r = le_pack(buf);
+		if (r != 0)
+			return r > 0;
+	}
+
+	f = NULL;
+	if (buf == idle_rxbuf)
+		f = dma_rx_take();
+	if (f == NULL)
+		f = usb_alloc();
 
 	/* fail if queue is full */
 	if (f == NULL) {
@@ -133,7 +596,8 @@ static int enqueue(uint8_t type, uint8_t* buf)
 	}
 
 	f->pkt_type = type;
-	if(type == SPECAN) {
+	f->le_conn = type == LE_PACKET ? le_conn_cur : 0;
+	if(type == SPECAN || type == SPECAN_COMPACT) {
 		f->clkn_high = (clkn >> 20) & 0xff;
 		f->clk100ns = CLK100NS;
 	} else {
@@ -146,17 +610,24 @@ static int enqueue(uint8_t type, uint8_t* buf)
 		f->rssi_count = rssi_count;
 	}
 
-	memcpy(f->data, buf, DMA_SIZE);
+	if (buf != f->data)
+		memcpy(f->data, buf, DMA_SIZE);
 
 	f->status = status;
 	status = 0;
 
+	usb_enqueue(f);
 	return 1;
 }
 
 int enqueue_with_ts(uint8_t type, uint8_t* buf, uint32_t ts)
 {
-	usb_pkt_rx* f = usb_enqueue();
+	usb_pkt_rx* f;
+
+	if (time_sync && time_sync_due)
+		time_sync_enqueue();
+
+	f = usb_alloc();
 
 	/* fail if queue is full */
 	if (f == NULL) {
@@ -178,6 +649,7 @@ int enqueue_with_ts(uint8_t type, uint8_t* buf, uint32_t ts)
 	f->status = status;
 	status = 0;
 
+	usb_enqueue(f);
 	return 1;
 }
 
@@ -187,7 +659,11 @@ static int vendor_request_handler(uint8_t request, uint16_t* request_params, uin
 	size_t length; // string length
 	usb_pkt_rx* p = NULL;
 	uint16_t reg_val;
-	uint8_t i;
+	uint16_t depth;
+	volatile u32* counters;
+	u32 lost;
+	int n;
+	uint8_t i, j;
 
 	switch (request) {
 
@@ -393,6 +869,170 @@ static int vendor_request_handler(uint8_t request, uint16_t* request_params, uin
 		*data_len = 0;
 		break;
 
+	case UBERTOOTH_SPECAN_FAST:
+		if (request_params[0] < 2049 || request_params[0] > 3072 ||
+				request_params[1] < 2049 || request_params[1] > 3072 ||
+				request_params[1] < request_params[0] ||
+				request_params[1] - request_params[0] >= SPECAN_FAST_MAX_BINS)
+			return 0;
+		low_freq = request_params[0];
+		high_freq = request_params[1];
+		requested_mode = MODE_SPECAN_FAST;
+		*data_len = 0;
+		break;
+
+	case UBERTOOTH_SET_SPECAN_FORMAT:
+		if (request_params[0] > SPECAN_FORMAT_COMPACT)
+			return 0;
+		specan_format = request_params[0];
+		break;
+
+	case UBERTOOTH_SET_AC_FILTER:
+		if (request_params[1] >= MAX_SYNCWORD_ERRS)
+			return 0;
+		ac_filter_errs = request_params[1];
+		ac_filter = request_params[0] ? 1 : 0;
+		reset_access_code();
+		break;
+
+	case UBERTOOTH_SET_AC_TARGETS:
+		if (request_params[0] >= MAX_SYNCWORD_ERRS)
+			return 0;
+		if (request_params[1] == AC_TARGETS_BR) {
+			if (*data_len % 8 || *data_len / 8 > BT_AC_MAX_TARGETS)
+				return 0;
+			ac_target_count = 0;
+			for (i = 0; i < *data_len / 8; i++) {
+				ac_targets[i] = 0;
+				for (j = 0; j < 8; j++)
+					ac_targets[i] |= (u64)data[8*i + j] << (8*j);
+			}
+			ac_target_count = *data_len / 8;
+			ac_filter_errs = request_params[0];
+			ac_filter = ac_target_count ? 1 : 0;
+			reset_access_code();
+		} else if (request_params[1] == AC_TARGETS_LE) {
+			if (*data_len % 4 || *data_len / 4 > BT_AC_MAX_TARGETS)
+				return 0;
+			le_aa_target_count = 0;
+			for (i = 0; i < *data_len / 4; i++)
+				le_aa_targets[i] = data[4*i] | data[4*i + 1] << 8
+				                 | data[4*i + 2] << 16 | data[4*i + 3] << 24;
+			le_aa_target_count = *data_len / 4;
+			le_aa_filter_errs = request_params[0];
+		} else {
+			return 0;
+		}
+		filter_reset();
+		break;
+
+	case UBERTOOTH_TIME_SYNC:
+		time_sync = request_params[0] ? 1 : 0;
+		time_sync_due = 1;
+		break;
+
+	case UBERTOOTH_LE_PACKED:
+		le_packed = request_params[0] ? 1 : 0;
+		break;
+
+	case UBERTOOTH_ADV_DEDUP:
+		adv_dedup = request_params[0] ? 1 : 0;
+		adv_dedup_reset();
+		break;
+
+	case UBERTOOTH_RSSI_TELEMETRY:
+		/* milliseconds to CLKN periods of 312.5 us */
+		rssi_telemetry_interval = (request_params[0] * 16 + 4) / 5;
+		rssi_telemetry_last = (u32)clkn_mono;
+		break;
+
+	case UBERTOOTH_GET_SPECAN_RATE:
+		for(i = 0; i < 4; i++) {
+			data[i] = (specan_sweeps >> (8*i)) & 0xff;
+			data[4+i] = (specan_sweep_time >> (8*i)) & 0xff;
+		}
+		data[8] = specan_settle_time & 0xff;
+		data[9] = (specan_settle_time >> 8) & 0xff;
+		data[10] = (high_freq - low_freq + 1) & 0xff;
+		data[11] = ((high_freq - low_freq + 1) >> 8) & 0xff;
+		*data_len = 12;
+		break;
+
+	case UBERTOOTH_TRACE:
+		trace_set(request_params[0] & (TRACE_ENABLE | TRACE_STREAM));
+		break;
+
+	case UBERTOOTH_AFH_LEARN:
+		if (!afh_learn) {
+			bt_afh_learn_init(&afh_learn_state, request_params[0]);
+			for (i = 0; i < 10; i++)
+				afh_map[i] = 0;
+			used_channels = 0;
+			/* start the dwell timer */
+			do_hop = 1;
+		}
+		afh_learn_state.max_age = request_params[0];
+		afh_learn = request_params[1] & (AFH_LEARN_ENABLE | AFH_LEARN_DISCOVER);
+		if (afh_learn)
+			hop_mode = HOP_AFH;
+		break;
+
+	case UBERTOOTH_CLOCK_TRACK:
+		if (request_params[1] >= MAX_SYNCWORD_ERRS)
+			return 0;
+		if (request_params[0] && !clock_track) {
+			bt_clock_track_init(&clock_track_state, clk_drift_rate);
+			clock_track_last = (u32)clkn_mono;
+		}
+		/* zero leaves the tolerance set for the filter alone */
+		if (request_params[1])
+			ac_filter_errs = request_params[1];
+		clock_track = request_params[0] ? 1 : 0;
+		break;
+
+	case UBERTOOTH_LE_FOLLOW_MULTI:
+		if (request_params[0] > LE_FOLLOW_MAX || mode == MODE_BT_FOLLOW_LE)
+			return 0;
+		le_follow_max = request_params[0] ? request_params[0] : 1;
+		break;
+
+	case UBERTOOTH_GET_TRACE:
+		n = trace_read(&data[4], TRACE_READ_MAX, &lost);
+		for (i = 0; i < 4; i++)
+			data[i] = (lost >> (8*i)) & 0xff;
+		*data_len = 4 + n * TRACE_EVENT_LEN;
+		break;
+
+	case UBERTOOTH_GET_PERF_COUNTERS:
+		counters = (u32*)&perf;
+		for (i = 0; i < sizeof(perf_counters) / 4; i++) {
+			data[4*i] = counters[i] & 0xff;
+			data[4*i+1] = (counters[i] >> 8) & 0xff;
+			data[4*i+2] = (counters[i] >> 16) & 0xff;
+			data[4*i+3] = (counters[i] >> 24) & 0xff;
+		}
+		*data_len = sizeof(perf_counters);
+		if (request_params[0])
+			memset((void*)&perf, 0, sizeof(perf_counters));
+		break;
+
+	case UBERTOOTH_GET_QUEUE_STATS:
+		depth = queue_depth();
+		data[0] = USB_POOL_SIZE & 0xff;
+		data[1] = (USB_POOL_SIZE >> 8) & 0xff;
+		data[2] = depth & 0xff;
+		data[3] = (depth >> 8) & 0xff;
+		data[4] = queue_high_water & 0xff;
+		data[5] = (queue_high_water >> 8) & 0xff;
+		for(i = 0; i < 4; i++)
+			data[6+i] = (queue_overflows >> (8*i)) & 0xff;
+		*data_len = 10;
+		if (request_params[0]) {
+			queue_high_water = depth;
+			queue_overflows = 0;
+		}
+		break;
+
 	case UBERTOOTH_RX_GENERIC:
 		requested_mode = MODE_RX_GENERIC;
 		*data_len = 0;
@@ -463,6 +1103,7 @@ static int vendor_request_handler(uint8_t request, uint16_t* request_params, uin
 		DIO_SSEL_SET;
 		clk100ns_offset = (data[4] << 8) | (data[5] << 0);
 		requested_mode = MODE_BT_FOLLOW;
+		clock_track_state.locked = 0;
 		break;
 
 	case UBERTOOTH_AFH:
@@ -483,6 +1124,7 @@ static int vendor_request_handler(uint8_t request, uint16_t* request_params, uin
 	case UBERTOOTH_SET_CLOCK:
 		clock = data[0] | data[1] << 8 | data[2] << 16 | data[3] << 24;
 		clkn = clock;
+		time_sync_due = 1;
 		cs_threshold_calc_and_set(channel);
 		break;
 
@@ -517,22 +1159,9 @@ static int vendor_request_handler(uint8_t request, uint16_t* request_params, uin
 	case UBERTOOTH_FIX_CLOCK_DRIFT:
 		clk_drift_ppm += (int16_t)(data[0] << 8) | (data[1] << 0);
 
-		// Too slow
-		if (clk_drift_ppm < 0) {
-			clk_drift_correction = 320 / (uint16_t)(-clk_drift_ppm);
-			clkn_next_drift_fix = clkn_last_drift_fix + clk_drift_correction;
-		}
-		// Too fast
-		else if (clk_drift_ppm > 0) {
-			clk_drift_correction = 320 / clk_drift_ppm;
-			clkn_next_drift_fix = clkn_last_drift_fix + clk_drift_correction;
-		}
-		// Don't trim
-		else {
-			clk_drift_correction = 0;
-			clkn_next_drift_fix = 0;
-		}
-
+		/* 1 ppm of 3125 ticks is 2^16 * 3125 / 10^6 = 204.8 */
+		clk_drift_rate = (int32_t)clk_drift_ppm * 2048 / 10;
+		clock_track_state.rate = clk_drift_rate;
 		break;
 
 	case UBERTOOTH_BTLE_SNIFFING:
@@ -584,6 +1213,7 @@ static int vendor_request_handler(uint8_t request, uint16_t* request_params, uin
 		if (p != NULL) {
 			memcpy(data, (void *)p, sizeof(usb_pkt_rx));
 			*data_len = sizeof(usb_pkt_rx);
+			usb_free(p);
 		} else {
 			data[0] = 0;
 			*data_len = 1;
@@ -675,14 +1305,103 @@ static int vendor_request_handler(uint8_t request, uint16_t* request_params, uin
 	return 1;
 }
 
+static int le_follow_multi(void)
+{
+	return mode == MODE_BT_FOLLOW_LE && le_follow_max > 1;
+}
+
+/* CLKN periods until the next anchor of a connection */
+static u32 le_anchor_ticks(le_state_t* c)
+{
+	u32 le_clk = (clkn - c->conn_epoch) & 0x03;
+
+	if (c->interval_timer == 0)
+		return 0;
+	return (4 - le_clk) + 4 * (c->interval_timer - 1);
+}
+
+/* Count the anchors of the connections waiting in le_conn[], moving each
+ * one on to its next channel as le itself would have hopped */
+static void le_follow_tick(void)
+{
+	le_state_t* c;
+	u8 i;
+
+	for (i = 1; i <= le_follow_max; i++) {
+		c = &le_conn[i];
+		if (i == le_conn_cur || c->link_state != LINK_CONNECTED
+		    || ((clkn - c->conn_epoch) & 0x03) != 0)
+			continue;
+		if (--c->interval_timer != 0)
+			continue;
+
+		++c->conn_count;
+		c->interval_timer = c->conn_interval;
+		c->channel_idx = le_next_channel_index(c->channel_idx,
+		                                       c->channel_increment);
+
+		/* the first packet under the new parameters goes unseen,
+		 * so take it to be at the start of the transmit window */
+		if (c->update_pending && c->conn_count == c->update_instant) {
+			c->conn_interval = c->interval_update;
+			c->interval_timer = c->win_offset_update + c->interval_update;
+			c->win_size = c->win_size_update;
+			c->win_offset = c->win_offset_update;
+			c->update_pending = 0;
+		}
+	}
+}
+
+/* Pick the slot to be on: the connection with the soonest anchor if it is
+ * close, the listener otherwise. The radio stays on a connection until its
+ * anchor has gone by, and through an update instant until the first packet
+ * under the new parameters. */
+static void le_follow_schedule(void)
+{
+	le_state_t* c;
+	u32 t, best_t = 0xffffffff;
+	u8 i, best = 0;
+
+	if (le_conn_next != le_conn_cur || le.link_state == LINK_CONN_PENDING)
+		return;
+	if (le_conn_cur != 0 && le.link_state == LINK_CONNECTED
+	    && (le_conn_tuned || clkn - le_conn_anchor < LE_FOLLOW_DWELL
+	        || (le.update_pending && le.conn_count == le.update_instant)))
+		return;
+
+	for (i = 1; i <= le_follow_max; i++) {
+		c = (i == le_conn_cur) ? &le : &le_conn[i];
+		if (c->link_state != LINK_CONNECTED)
+			continue;
+		t = le_anchor_ticks(c);
+		if (t < best_t) {
+			best_t = t;
+			best = i;
+		}
+	}
+
+	if (best_t > (le_conn_cur == 0 ? LE_FOLLOW_LEAD : LE_FOLLOW_GAP))
+		best = 0;
+
+	if (best != le_conn_cur) {
+		le_conn_next = best;
+		do_hop = 1;
+	}
+}
+
 /* Update CLKN. */
 void TIMER0_IRQHandler()
 {
 	if (T0IR & TIR_MR0_Interrupt) {
 
+		if (clkn_offset)
+			time_sync_due = 1;
 		clkn += clkn_offset + 1;
 		clkn_offset = 0;
 
+		if ((++clkn_mono & 0xfff) == 0)
+			time_sync_due = 1;
+
 		uint32_t le_clk = (clkn - le.conn_epoch) & 0x03;
 
 		/* Trigger hop based on mode */
@@ -703,13 +1422,22 @@ void TIMER0_IRQHandler()
 			if (le.link_state == LINK_CONNECTED && le_clk == 0) {
 				--le.interval_timer;
 				if (le.interval_timer == 0) {
-					do_hop = 1;
+					if (le_conn_tuned)
+						le_conn_tuned = 0;
+					else
+						do_hop = 1;
+					le_conn_anchor = clkn;
 					++le.conn_count;
 					le.interval_timer = le.conn_interval;
 				} else {
 					TXLED_CLR; // hack!
 				}
 			}
+
+			if (le_follow_multi()) {
+				le_follow_tick();
+				le_follow_schedule();
+			}
 		}
 		else if (hop_mode == HOP_AFH) {
 			if( (last_hop + hop_timeout) == clkn ) {
@@ -718,20 +1446,19 @@ void TIMER0_IRQHandler()
 		}
 
 		// Fix linear clock drift deviation
-		if(clkn_next_drift_fix != 0 && clk100ns_offset == 0) {
-			if(clkn >= clkn_next_drift_fix) {
+		clk_drift_acc += clk_drift_rate;
+		if(clk100ns_offset == 0) {
 
-				// Too fast
-				if(clk_drift_ppm >= 0) {
-					clk100ns_offset = 1;
-				}
+			// Too fast
+			if(clk_drift_acc >= BT_CLOCK_RATE_ONE) {
+				clk100ns_offset = 1;
+				clk_drift_acc -= BT_CLOCK_RATE_ONE;
+			}
 
-				// Too slow
-				else {
-					clk100ns_offset = 6249;
-				}
-				clkn_last_drift_fix = clkn;
-				clkn_next_drift_fix = clkn_last_drift_fix + clk_drift_correction;
+			// Too slow
+			else if(clk_drift_acc <= -BT_CLOCK_RATE_ONE) {
+				clk100ns_offset = 6249;
+				clk_drift_acc += BT_CLOCK_RATE_ONE;
 			}
 		}
 
@@ -797,25 +1524,35 @@ void DMA_IRQHandler()
 				if (hop_mode == HOP_BLUETOOTH)
 					DIO_SSEL_SET;
 
-				idle_buf_clk100ns  = CLK100NS;
-				idle_buf_clkn_high = (clkn >> 20) & 0xff;
-				idle_buf_channel   = channel;
-
-				/* Keep buffer swapping in sync with DMA. */
-				volatile uint8_t* tmp = active_rxbuf;
-				active_rxbuf = idle_rxbuf;
-				idle_rxbuf = tmp;
+				/* Tag the buffer DMA just finished with the time and
+				 * channel it was received on. */
+				volatile dma_buf_meta* meta = &rxbuf_meta[rx_tc & DMA_RING_MASK];
+				meta->clk100ns  = CLK100NS;
+				meta->clkn_high = (clkn >> 20) & 0xff;
+				meta->channel   = channel;
+				meta->discard   = dma_discard || retune_state != RETUNE_IDLE;
+				dma_discard = 0;
 
 				++rx_tc;
+				++perf.dma_transfers;
 			}
 			if (DMACIntErrStat & (1 << 0)) {
 				DMACIntErrClr = (1 << 0);
 				++rx_err;
+				++perf.dma_errors;
 			}
 		}
 	}
 }
 
+/* Start the DWT cycle counter used for the retune counters */
+static void perf_init(void)
+{
+	DEMCR |= DEMCR_TRCENA;
+	DWT_CYCCNT = 0;
+	DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+}
+
 static void cc2400_idle()
 {
 	cc2400_strobe(SRFOFF);
@@ -834,6 +1571,7 @@ static void cc2400_idle()
 	dio_ssp_stop();
 	cs_reset();
 	rssi_reset();
+	rssi_iir_reset();
 
 	/* hopping stuff */
 	hop_mode = HOP_NONE;
@@ -843,7 +1581,8 @@ static void cc2400_idle()
 	hop_timeout = 158;
 	requested_channel = 0;
 	le_adv_channel = 2402;
-
+	retune_state = RETUNE_IDLE;
+	hop_prepared = 0;
 
 	/* bulk USB stuff */
 	idle_buf_clkn_high = 0;
@@ -864,6 +1603,18 @@ static void cc2400_idle()
 	low_freq = 2400;
 	high_freq = 2483;
 	rssi_threshold = -30;
+	specan_format = SPECAN_FORMAT_TRIPLES;
+
+	ac_filter = 0;
+	ac_target_count = 0;
+	le_aa_target_count = 0;
+	time_sync = 0;
+	le_packed = 0;
+	adv_dedup = 0;
+	rssi_telemetry_interval = 0;
+	afh_learn = 0;
+	clock_track = 0;
+	le_follow_max = 1;
 
 	target.address = 0;
 	target.syncword = 0;
@@ -1056,13 +1807,13 @@ void le_transmit(u32 aa, u8 len, u8 *data)
 	}
 
 	// whiten the data and copy it into the txbuf
-	int idx = whitening_index[btle_channel_index(channel-2402)];
+	int idx = le_whitening_index[le_channel_index(channel-2402)];
 	for (i = 0; i < len; ++i) {
 		byte = data[i];
 		txbuf[i+4] = 0;
 		for (j = 0; j < 8; ++j) {
-			bit = (byte & 1) ^ whitening[idx];
-			idx = (idx + 1) % sizeof(whitening);
+			bit = (byte & 1) ^ le_whitening[idx];
+			idx = (idx + 1) % sizeof(le_whitening);
 			byte >>= 1;
 			txbuf[i+4] |= bit << (7 - j);
 		}
@@ -1161,76 +1912,170 @@ void le_jam(void) {
 #endif
 }
 
-/* TODO - return whether hop happened, or should caller have to keep
- * track of this? */
-void hop(void)
+/* Channel to hop to from the current one. Only advances mode state (the
+ * LE channel index) when called for an actual hop. */
+static uint16_t hop_next_channel(void)
 {
-	do_hop = 0;
-	last_hop = clkn;
+	uint16_t next = channel;
+	int skip_used;
 
-	// No hopping, if channel is set correctly, do nothing
-	if (hop_mode == HOP_NONE) {
-		if (cc2400_get(FSDIV) == (channel - 1))
-			return;
-	}
 	/* Slow sweep (100 hops/sec)
 	 * only hop to currently used channels if AFH is enabled
 	 */
-	else if (hop_mode == HOP_SWEEP) {
+	if (hop_mode == HOP_SWEEP) {
 		do {
-			channel += 32;
-			if (channel > 2480)
-				channel -= 79;
-		} while ( used_channels != 0 && afh_enabled && !( afh_map[(channel-2402)/8] & 0x1<<((channel-2402)%8) ) );
+			next += 32;
+			if (next > 2480)
+				next -= 79;
+		} while ( used_channels != 0 && afh_enabled && !( afh_map[(next-2402)/8] & 0x1<<((next-2402)%8) ) );
 	}
 
 	/* AFH detection
-	 * only hop to currently unused channesl
+	 * only hop to currently unused channesl, unless learning the map
+	 * on the device without AFH_LEARN_DISCOVER
 	 */
 	else if (hop_mode == HOP_AFH) {
+		skip_used = !afh_learn || (afh_learn & AFH_LEARN_DISCOVER);
 		do {
-			channel += 32;
-			if (channel > 2480)
-				channel -= 79;
-		} while( used_channels != 79 && (afh_map[(channel-2402)/8] & 0x1<<((channel-2402)%8)) );
+			next += 32;
+			if (next > 2480)
+				next -= 79;
+		} while( skip_used && used_channels != 79 && (afh_map[(next-2402)/8] & 0x1<<((next-2402)%8)) );
 	}
 
 	else if (hop_mode == HOP_BLUETOOTH) {
-		channel = next_hop(clkn);
+		next = next_hop(clkn);
+	}
+
+	else if (hop_mode == HOP_BTLE) {
+		/* the listener when following several connections */
+		if (le.link_state == LINK_LISTENING)
+			next = le_adv_channel != 0 ? le_adv_channel : 2402;
+		else
+			next = btle_next_hop(&le);
 	}
 
-	else if (hop_mode == HOP_BTLE) {
-		channel = btle_next_hop(&le);
-	}
+	else if (hop_mode == HOP_DIRECT) {
+		next = hop_direct_channel;
+	}
+
+	return next;
+}
+
+/* When following a piconet the next hop is known as soon as the last one
+ * is done, so its channel and CS threshold are worked out while waiting
+ * rather than in the dead time of the retune. */
+static void hop_prepare(void)
+{
+	if (hop_mode != HOP_BLUETOOTH) {
+		hop_prepared = 0;
+		return;
+	}
+
+	/* hops are triggered on even clkn */
+	hop_prepared_clkn = (clkn & ~1) + 2;
+	hop_prepared_channel = next_hop(hop_prepared_clkn);
+	hop_prepared_cs = cs_threshold_calc(hop_prepared_channel);
+	hop_prepared = 1;
+}
+
+/* Advance a retune started by hop_start(). Returns non-zero while it is
+ * still in progress. */
+int hop_poll(void)
+{
+	uint32_t latency, cycles;
+
+	switch (retune_state) {
+	case RETUNE_UNLOCK:
+		if (cc2400_status() & FS_LOCK)
+			return 1;
+
+		/* Retune */
+		if(mode == MODE_TX_SYMBOLS)
+			cc2400_set(FSDIV, channel);
+		else
+			cc2400_set(FSDIV, channel - 1);
+
+		/* Update CS register if hopping.  */
+		if (hop_mode > 0) {
+			cs_threshold_apply(retune_cs);
+		}
+
+		cc2400_strobe(SFSON);
+		retune_state = RETUNE_LOCK;
+		return 1;
+
+	case RETUNE_LOCK:
+		if (!(cc2400_status() & FS_LOCK))
+			return 1;
+
+		dma_discard = 1;
+
+		if(mode == MODE_TX_SYMBOLS)
+			cc2400_strobe(STX);
+		else
+			cc2400_strobe(SRX);
+
+		latency = bt_clk100ns_diff(CLK100NS, retune_start);
+		perf.retune_latency = latency;
+		if (latency > perf.retune_latency_max)
+			perf.retune_latency_max = latency;
+
+		TRACE(TRACE_HOP_LOCK, channel);
+		cycles = DWT_CYCCNT - retune_start_cycles;
+		perf.retune_cycles += cycles;
+		if (cycles > perf.retune_cycles_max)
+			perf.retune_cycles_max = cycles;
+
+		retune_state = RETUNE_IDLE;
+		hop_prepare();
+		return 0;
 
-	else if (hop_mode == HOP_DIRECT) {
-		channel = hop_direct_channel;
+	default:
+		return 0;
 	}
-	/* IDLE mode, but leave amp on, so don't call cc2400_idle(). */
-	cc2400_strobe(SRFOFF);
-	while ((cc2400_status() & FS_LOCK)); // need to wait for unlock?
+}
 
-	/* Retune */
-	if(mode == MODE_TX_SYMBOLS)
-		cc2400_set(FSDIV, channel);
-	else
-		cc2400_set(FSDIV, channel - 1);
+/*
+ * Start a hop without waiting for the synthesizer: it is turned off here,
+ * then retuned and relocked by later calls to hop_poll(), so the caller can
+ * keep draining DMA in the meantime.
+ */
+void hop_start(void)
+{
+	do_hop = 0;
+	last_hop = clkn;
 
-	/* Update CS register if hopping.  */
-	if (hop_mode > 0) {
-		cs_threshold_calc_and_set(channel);
+	if (hop_prepared && hop_mode == HOP_BLUETOOTH
+	    && last_hop == hop_prepared_clkn) {
+		channel = hop_prepared_channel;
+		retune_cs = hop_prepared_cs;
+	} else {
+		// No hopping, if channel is set correctly, do nothing
+		if (hop_mode == HOP_NONE && cc2400_get(FSDIV) == (channel - 1))
+			return;
+
+		channel = hop_next_channel();
+		retune_cs = cs_threshold_calc(channel);
 	}
+	hop_prepared = 0;
 
-	/* Wait for lock */
-	cc2400_strobe(SFSON);
-	while (!(cc2400_status() & FS_LOCK));
+	retune_start = CLK100NS;
+	retune_start_cycles = DWT_CYCCNT;
+	++perf.hops;
+	TRACE(TRACE_HOP_START, channel);
 
-	dma_discard = 1;
+	/* IDLE mode, but leave amp on, so don't call cc2400_idle(). */
+	cc2400_strobe(SRFOFF);
+	retune_state = RETUNE_UNLOCK;
+	hop_poll();
+}
 
-	if(mode == MODE_TX_SYMBOLS)
-		cc2400_strobe(STX);
-	else
-		cc2400_strobe(SRX);
+/* Hop and wait for the synthesizer to lock */
+void hop(void)
+{
+	hop_start();
+	while (hop_poll());
 }
 
 /* Bluetooth packet monitoring */
@@ -1238,6 +2083,7 @@ void bt_stream_rx()
 {
 	int8_t rssi;
 	int8_t rssi_at_trigger;
+	int ac;
 
 	RXLED_CLR;
 
@@ -1267,7 +2113,7 @@ void bt_stream_rx()
 		 * happened before the loop started. */
 		rssi_reset();
 		rssi_at_trigger = INT8_MIN;
-		while (!rx_tc) {
+		while (!dma_rx_pending()) {
 			rssi = (int8_t)(cc2400_get(RSSI) >> 8);
 			if (cs_trigger && (rssi_at_trigger == INT8_MIN)) {
 				rssi = MAX(rssi,(cs_threshold_cur+54));
@@ -1275,12 +2121,12 @@ void bt_stream_rx()
 			}
 			rssi_add(rssi);
 
-			handle_usb(clkn);
-
-			/* If timer says time to hop, do it. */
+			/* If timer says time to hop, do it. The synthesizer
+			 * locks while this loop keeps running. */
 			if (do_hop) {
-				hop();
+				hop_start();
 			} else {
+				hop_poll();
 				TXLED_CLR;
 			}
 			/* TODO - set per-channel carrier sense threshold.
@@ -1293,14 +2139,10 @@ void bt_stream_rx()
 			status |= DMA_ERROR;
 		}
 
-		/* Missed a DMA trasfer? */
-		if (rx_tc > 1)
-			status |= DMA_OVERFLOW;
-
-		if (dma_discard) {
-			status |= DISCARD;
-			dma_discard = 0;
-		}
+		/* Missed a DMA trasfer or retuned during this one? */
+		rx_claim();
+		if (status & (DMA_OVERFLOW | DISCARD))
+			reset_access_code();
 
 		rssi_iir_update(channel);
 
@@ -1309,6 +2151,8 @@ void bt_stream_rx()
 		 * threshold. Currently, this is redundant, but allows for
 		 * per-channel or other rssi triggers in the future. */
 		if (cs_trigger || cs_no_squelch) {
+			if (cs_trigger)
+				rssi_cs_count(channel);
 			status |= CS_TRIGGER;
 			cs_trigger = 0;
 		}
@@ -1317,10 +2161,37 @@ void bt_stream_rx()
 			status |= RSSI_TRIGGER;
 		}
 
-		enqueue(BR_PACKET, (uint8_t*)idle_rxbuf);
+		/* one search serves the filter, AFH learning and clock
+		 * tracking */
+		ac = -1;
+		if (!(status & DISCARD) && (ac_filter || afh_learn || clock_track)
+		    && (target.syncword != 0 || ac_target_count != 0))
+			ac = find_access_code((u8*)idle_rxbuf, ac_filter_errs);
+		if (ac >= 0 && clock_track && hop_mode == HOP_BLUETOOTH)
+			clock_track_hit(ac);
+
+		/* With the filter on, buffers without a target access code
+		 * stay on the device. Their error bits are held for the next
+		 * packet that is sent. */
+		if (afh_learn) {
+			afh_learn_buffer(ac);
+		} else if (!ac_filter || (target.syncword == 0 && ac_target_count == 0)) {
+			enqueue(BR_PACKET, (uint8_t*)idle_rxbuf);
+		} else if (ac >= 0) {
+			enqueue(BR_PACKET, (uint8_t*)idle_rxbuf);
+			filter_count(1);
+		} else {
+			status &= ~(CS_TRIGGER | RSSI_TRIGGER | DISCARD);
+			filter_count(0);
+		}
+
+		if (clock_track
+		    && (u32)clkn_mono - clock_track_last >= CLOCK_TRACK_INTERVAL)
+			clock_track_send();
 
-		handle_usb(clkn);
-		rx_tc = 0;
+		dma_rx_release();
+		hop_poll();
+		rssi_telemetry_poll();
 		rx_err = 0;
 	}
 
@@ -1426,8 +2297,6 @@ void br_transmit()
 
 		while ((cc2400_get(FSMSTATE) & 0x1f) != STATE_STROBE_FS_ON);
 		cc2400_strobe(STX);
-
-		handle_usb(clkn);
 	}
 
 #ifdef UBERTOOTH_ONE
@@ -1479,10 +2348,88 @@ void reset_le() {
 	do_hop = 0;
 }
 
+static void le_follow_reset(void)
+{
+	memset(le_conn, 0, sizeof(le_conn));
+	le_conn_cur = 0;
+	le_conn_next = 0;
+	le_conn_tuned = 0;
+}
+
+/* Take a free slot for a connection about to be followed, parking the
+ * listener in slot 0. Returns 0 if they are all taken. */
+static int le_follow_add(void)
+{
+	u8 i;
+
+	for (i = 1; i <= le_follow_max; i++)
+		if (le_conn[i].link_state == LINK_INACTIVE)
+			break;
+	if (i > le_follow_max)
+		return 0;
+
+	ICER0 = ICER0_ICE_TIMER0;
+	le_conn[0] = le;
+	le_conn_cur = i;
+	le_conn_next = i;
+	le_conn_tuned = 0;
+	ISER0 = ISER0_ISE_TIMER0;
+
+	TRACE(TRACE_LE_FOLLOW_SWITCH, i);
+	return 1;
+}
+
+/* Move the radio to the slot picked by le_follow_schedule(). The hop that
+ * follows goes to the advertising channel for the listener, or to the
+ * channel of the coming anchor for a connection. */
+static void le_follow_switch(void)
+{
+	u8 next = le_conn_next;
+
+	ICER0 = ICER0_ICE_TIMER0;
+	le_conn[le_conn_cur] = le;
+	le = le_conn[next];
+	le_conn_cur = next;
+	le_conn_tuned = next != 0;
+	ISER0 = ISER0_ISE_TIMER0;
+
+	do_hop = 1;
+	TRACE(TRACE_LE_FOLLOW_SWITCH, next);
+}
+
+/* Forget the connection in le and go back to the listener */
+static void le_follow_drop(void)
+{
+	ICER0 = ICER0_ICE_TIMER0;
+	le_conn[le_conn_cur].link_state = LINK_INACTIVE;
+	le = le_conn[0];
+	le_conn_cur = 0;
+	le_conn_next = 0;
+	le_conn_tuned = 0;
+	ISER0 = ISER0_ISE_TIMER0;
+
+	do_hop = 0;
+}
+
+/* Forget waiting connections that have gone quiet */
+static void le_follow_expire(u32 now)
+{
+	u8 i;
+
+	for (i = 1; i <= le_follow_max; i++) {
+		if (i == le_conn_cur || i == le_conn_next
+		    || le_conn[i].link_state == LINK_INACTIVE)
+			continue;
+		if (bt_clk100ns_diff(now, le_conn[i].last_packet) > LE_CONN_TIMEOUT)
+			le_conn[i].link_state = LINK_INACTIVE;
+	}
+}
+
 // reset LE Promisc state
 void reset_le_promisc(void) {
 	memset(&le_promisc, 0, sizeof(le_promisc));
-	le_promisc.smallest_hop_interval = 0xffffffff;
+	le_aa_cache_init(&le_promisc.aa_cache);
+	le_hop_solver_init(&le_promisc.hop);
 }
 
 /* generic le mode */
@@ -1497,9 +2444,6 @@ void bt_generic_le(u8 active_mode)
 
 	reset_le();
 
-	// enable USB interrupts
-	ISER0 = ISER0_ISE_USB;
-
 	RXLED_CLR;
 
 	queue_init();
@@ -1541,7 +2485,7 @@ void bt_generic_le(u8 active_mode)
 		/* Wait for DMA. Meanwhile keep track of RSSI. */
 		rssi_reset();
 		rssi_at_trigger = INT8_MIN;
-		while ((rx_tc == 0) && (rx_err == 0))
+		while (!dma_rx_pending() && (rx_err == 0))
 		{
 			rssi = (int8_t)(cc2400_get(RSSI) >> 8);
 			if (cs_trigger && (rssi_at_trigger == INT8_MIN)) {
@@ -1556,12 +2500,13 @@ void bt_generic_le(u8 active_mode)
 		}
 
 		/* No DMA transfer? */
-		if (!rx_tc)
+		if (!dma_rx_pending())
 			goto rx_continue;
 
-		/* Missed a DMA trasfer? */
-		if (rx_tc > 1)
-			status |= DMA_OVERFLOW;
+		/* Missed a DMA trasfer? The LE modes do their own hop
+		 * bookkeeping, so retune discards are not reported. */
+		rx_claim();
+		status &= ~DISCARD;
 
 		rssi_iir_update(channel);
 
@@ -1570,6 +2515,8 @@ void bt_generic_le(u8 active_mode)
 		 * threshold. Currently, this is redundant, but allows for
 		 * per-channel or other rssi triggers in the future. */
 		if (cs_trigger || cs_no_squelch) {
+			if (cs_trigger)
+				rssi_cs_count(channel);
 			status |= CS_TRIGGER;
 			hold = CS_HOLD_TIME;
 			cs_trigger = 0;
@@ -1586,6 +2533,10 @@ void bt_generic_le(u8 active_mode)
 		}
 		hold--;
 
+		// keep the previous buffer in front of the new one
+		memcpy(packed, packed + DMA_SIZE, DMA_SIZE);
+		memcpy(packed + DMA_SIZE, (void*)idle_rxbuf, DMA_SIZE);
+
 		// copy the previously unpacked symbols to the front of the buffer
 		memcpy(unpacked, unpacked + DMA_SIZE*8, DMA_SIZE*8);
 
@@ -1602,13 +2553,11 @@ void bt_generic_le(u8 active_mode)
 		if (!ret) break;
 
 	rx_continue:
-		rx_tc = 0;
+		dma_rx_release();
+		rssi_telemetry_poll();
 		rx_err = 0;
 	}
 
-	// disable USB interrupts
-	ICER0 = ICER0_ICE_USB;
-
 	// reset the radio completely
 	cc2400_idle();
 	dio_ssp_stop();
@@ -1627,9 +2576,6 @@ void bt_le_sync(u8 active_mode)
 
 	le.link_state = LINK_LISTENING;
 
-	// enable USB interrupts
-	ISER0 = ISER0_ISE_USB;
-
 	RXLED_CLR;
 
 	queue_init();
@@ -1657,15 +2603,21 @@ void bt_le_sync(u8 active_mode)
 			requested_channel = 0;
 		}
 
+		if (adv_dedup && (u32)clkn_mono - adv_summary_last >= ADV_SUMMARY_INTERVAL) {
+			adv_summary_last = (u32)clkn_mono;
+			adv_summary_send(NULL);
+		}
+
 		RXLED_CLR;
 
 		/* Wait for DMA. Meanwhile keep track of RSSI. */
 		rssi_reset();
 		while ((rx_tc == 0) && (rx_err == 0) && (do_hop == 0) && requested_mode == active_mode)
-			;
+			rssi_telemetry_poll();
 
 		rssi = (int8_t)(cc2400_get(RSSI) >> 8);
-		rssi_min = rssi_max = rssi;
+		rssi_add(rssi);
+		rssi_iir_update(channel);
 
 		if (requested_mode != active_mode) {
 			goto cleanup;
@@ -1682,6 +2634,14 @@ void bt_le_sync(u8 active_mode)
 		if (!rx_tc)
 			continue;
 
+		TRACE(TRACE_LE_RX, channel);
+
+		/* timestamp of the first transfer, before later ones wrap
+		 * around the metadata ring */
+		idle_buf_clk100ns  = rxbuf_meta[0].clk100ns;
+		idle_buf_clkn_high = rxbuf_meta[0].clkn_high;
+		idle_buf_channel   = rxbuf_meta[0].channel;
+
 		/////////////////////
 		// process the packet
 
@@ -1689,12 +2649,12 @@ void bt_le_sync(u8 active_mode)
 		u8 *p = (u8 *)packet;
 		packet[0] = le.access_address;
 
-		const uint32_t *whit = whitening_word[btle_channel_index(channel-2402)];
+		const uint32_t *whit = le_whitening_word[le_channel_index(channel-2402)];
 		for (i = 0; i < 4; i+= 4) {
-			uint32_t v = rxbuf1[i+0] << 24
-					   | rxbuf1[i+1] << 16
-					   | rxbuf1[i+2] << 8
-					   | rxbuf1[i+3] << 0;
+			uint32_t v = le_rxbuf[i+0] << 24
+					   | le_rxbuf[i+1] << 16
+					   | le_rxbuf[i+2] << 8
+					   | le_rxbuf[i+3] << 0;
 			packet[i/4+1] = rbit(v) ^ whit[i/4];
 		}
 
@@ -1706,7 +2666,7 @@ void bt_le_sync(u8 active_mode)
 		// this allows us enough time to resume RX for subsequent packets on the same channel
 		unsigned total_transfers = ((len + 3) + 4 - 1) / 4;
 		if (total_transfers < 11) {
-			while (DMACC0DestAddr < (uint32_t)rxbuf1 + 4 * total_transfers && rx_err == 0)
+			while (DMACC0DestAddr < (uint32_t)le_rxbuf + 4 * total_transfers && rx_err == 0)
 				;
 		} else { // max transfers? just wait till DMA's done
 			while (DMACC0Config & DMACCxConfig_E && rx_err == 0)
@@ -1719,30 +2679,33 @@ void bt_le_sync(u8 active_mode)
 
 		// unwhiten the rest of the packet
 		for (i = 4; i < 44; i += 4) {
-			uint32_t v = rxbuf1[i+0] << 24
-					   | rxbuf1[i+1] << 16
-					   | rxbuf1[i+2] << 8
-					   | rxbuf1[i+3] << 0;
+			uint32_t v = le_rxbuf[i+0] << 24
+					   | le_rxbuf[i+1] << 16
+					   | le_rxbuf[i+2] << 8
+					   | le_rxbuf[i+3] << 0;
 			packet[i/4+1] = rbit(v) ^ whit[i/4];
 		}
 
 		if (le.crc_verify) {
-			u32 calc_crc = btle_crcgen_lut(le.crc_init_reversed, p + 4, len);
+			u32 calc_crc = le_crcgen_lut(le.crc_init_reversed, p + 4, len);
 			u32 wire_crc = (p[4+len+2] << 16)
 						 | (p[4+len+1] << 8)
 						 | (p[4+len+0] << 0);
-			if (calc_crc != wire_crc) // skip packets with a bad CRC
+			if (calc_crc != wire_crc) { // skip packets with a bad CRC
+				++perf.le_crc_failures;
+				TRACE(TRACE_LE_CRC_FAIL, 0);
 				goto rx_flush;
+			}
 		}
 
 
 		RXLED_SET;
 		packet_cb((uint8_t *)packet);
 
-		// disable USB interrupts while we touch USB data structures
-		ICER0 = ICER0_ICE_USB;
-		enqueue(LE_PACKET, (uint8_t *)packet);
-		ISER0 = ISER0_ISE_USB;
+		if (!adv_dedup || le.link_state != LINK_LISTENING
+		    || adv_dedup_check(p, rssi))
+			enqueue(LE_PACKET, (uint8_t *)packet);
+		TRACE(TRACE_LE_PACKET, len);
 
 		le.last_packet = CLK100NS;
 
@@ -1758,16 +2721,21 @@ void bt_le_sync(u8 active_mode)
 
 		// timeout - FIXME this is an ugly hack
 		u32 now = CLK100NS;
+		if (le_follow_multi())
+			le_follow_expire(now);
 		if (now < le.last_packet)
 			now += 3276800000; // handle rollover
 		if  ( // timeout
 			((le.link_state == LINK_CONNECTED || le.link_state == LINK_CONN_PENDING)
-			&& (now - le.last_packet > 50000000))
+			&& (now - le.last_packet > LE_CONN_TIMEOUT))
 			// jam finished
 			|| (le_jam_count == 1)
 			)
 		{
-			reset_le();
+			if (le_follow_multi() && le_conn_cur != 0)
+				le_follow_drop();
+			else
+				reset_le();
 			le_jam_count = 0;
 			TXLED_CLR;
 
@@ -1791,6 +2759,9 @@ void bt_le_sync(u8 active_mode)
 			restart_jamming = 1;
 		}
 
+		if (le_conn_next != le_conn_cur)
+			le_follow_switch();
+
 		cc2400_set(SYNCL, le.syncl);
 		cc2400_set(SYNCH, le.synch);
 
@@ -1814,6 +2785,7 @@ void bt_le_sync(u8 active_mode)
 				while (!(cc2400_status() & FS_LOCK));
 				cc2400_strobe(SRX);
 			}
+			TRACE(TRACE_LE_RX_RESTART, channel);
 		}
 
 		rx_tc = 0;
@@ -1822,9 +2794,6 @@ void bt_le_sync(u8 active_mode)
 
 cleanup:
 
-	// disable USB interrupts
-	ICER0 = ICER0_ICE_USB;
-
 	// reset the radio completely
 	cc2400_idle();
 	dio_ssp_stop();
@@ -1837,7 +2806,7 @@ cleanup:
  * follows a known AA around */
 int cb_follow_le() {
 	int i, j, k;
-	int idx = whitening_index[btle_channel_index(channel-2402)];
+	int idx = le_whitening_index[le_channel_index(channel-2402)];
 
 	u32 access_address = 0;
 	for (i = 0; i < 31; ++i) {
@@ -1856,8 +2825,8 @@ int cb_follow_le() {
 					if (offset >= DMA_SIZE*8*2) break;
 					int bit = unpacked[offset];
 					if (j >= 4) { // unwhiten data bytes
-						bit ^= whitening[idx];
-						idx = (idx + 1) % sizeof(whitening);
+						bit ^= le_whitening[idx];
+						idx = (idx + 1) % sizeof(le_whitening);
 					}
 					byte |= bit << k;
 				}
@@ -1867,20 +2836,23 @@ int cb_follow_le() {
 			// verify CRC
 			if (le.crc_verify) {
 				int len		 = (idle_rxbuf[5] & 0x3f) + 2;
-				u32 calc_crc = btle_crcgen_lut(le.crc_init_reversed, (uint8_t*)idle_rxbuf + 4, len);
+				u32 calc_crc = le_crcgen_lut(le.crc_init_reversed, (uint8_t*)idle_rxbuf + 4, len);
 				u32 wire_crc = (idle_rxbuf[4+len+2] << 16)
 							 | (idle_rxbuf[4+len+1] << 8)
 							 |  idle_rxbuf[4+len+0];
-				if (calc_crc != wire_crc) // skip packets with a bad CRC
+				if (calc_crc != wire_crc) { // skip packets with a bad CRC
+					++perf.le_crc_failures;
 					break;
+				}
 			}
 
-			// send to PC
-			enqueue(LE_PACKET, (uint8_t*)idle_rxbuf);
+			// enqueue() hands idle_rxbuf over, so look at it first
 			RXLED_SET;
-
 			packet_cb((uint8_t*)idle_rxbuf);
 
+			// send to PC
+			enqueue(LE_PACKET, (uint8_t*)idle_rxbuf);
+
 			break;
 		}
 	}
@@ -1912,6 +2884,7 @@ void connection_follow_cb(u8 *packet) {
 		le.conn_epoch = clkn;
 		le.interval_timer = le.conn_interval - 1;
 		le.conn_count = 0;
+		le_conn_anchor = clkn;
 		le.update_pending = 0;
 
 		// hue hue hue
@@ -1965,6 +2938,10 @@ void connection_follow_cb(u8 *packet) {
 				return;
 			}
 
+			// with several connections, only while a slot is free
+			if (le_follow_multi() && !le_follow_add())
+				return;
+
 			le.link_state = LINK_CONN_PENDING;
 			le.crc_verify = 0; // we will drop many packets if we attempt to filter by CRC
 
@@ -2000,6 +2977,7 @@ void connection_follow_cb(u8 *packet) {
 
 void bt_follow_le() {
 	reset_le();
+	le_follow_reset();
 	packet_cb = connection_follow_cb;
 	bt_le_sync(MODE_BT_FOLLOW_LE);
 
@@ -2021,220 +2999,173 @@ void le_promisc_state(u8 type, void *data, unsigned len) {
 	buf[0] = type;
 	memcpy(&buf[1], data, len);
 	enqueue(LE_PROMISC, (uint8_t*)buf);
-}
-
-// divide, rounding to the nearest integer: round up at 0.5.
-#define DIVIDE_ROUND(N, D) ((N) + (D)/2) / (D)
-
-void promisc_recover_hop_increment(u8 *packet) {
-	static u32 first_ts = 0;
-	if (channel == 2404) {
-		first_ts = CLK100NS;
-		hop_direct_channel = 2406;
-		do_hop = 1;
-	} else if (channel == 2406) {
-		u32 second_ts = CLK100NS;
-		if (second_ts < first_ts)
-			second_ts += 3276800000; // handle rollover
-		// Number of channels hopped between previous and current timestamp.
-		u32 channels_hopped = DIVIDE_ROUND(second_ts - first_ts,
-										   le.conn_interval * LE_BASECLK);
-		if (channels_hopped < 37) {
-			// Get the hop increment based on the number of channels hopped.
-			le.channel_increment = hop_interval_lut[channels_hopped];
-			le.interval_timer = le.conn_interval / 2;
-			le.conn_count = 0;
-			le.conn_epoch = 0;
-			do_hop = 0;
-			// Move on to regular connection following.
-			le.channel_idx = (1 + le.channel_increment) % 37;
-			le.link_state = LINK_CONNECTED;
-			le.crc_verify = 0;
-			hop_mode = HOP_BTLE;
-			packet_cb = connection_follow_cb;
-			le_promisc_state(3, &le.channel_increment, 1);
-
-			if (jam_mode != JAM_NONE)
-				le_jam_count = JAM_COUNT_DEFAULT;
 
-			return;
-		}
-		hop_direct_channel = 2404;
-		do_hop = 1;
-	}
-	else {
-		hop_direct_channel = 2404;
-		do_hop = 1;
+	/* the candidate list is a report rather than a state change */
+	if (type != 4) {
+		++perf.le_promisc_states;
+		TRACE(TRACE_PROMISC_STATE, type);
 	}
 }
 
-void promisc_recover_hop_interval(u8 *packet) {
-	static u32 prev_clk = 0;
-
-	u32 cur_clk = CLK100NS;
-	if (cur_clk < prev_clk)
-		cur_clk += 3267800000; // handle rollover
-	u32 clk_diff = cur_clk - prev_clk;
-	u16 obsv_hop_interval; // observed hop interval
+/* Recover the hop interval and increment of the connection with
+ * le_promisc.hop, then follow it. The second time the connection is heard
+ * the radio stays where it is, as a whole cycle through the channels rules
+ * out multiples of the interval, and after that it moves on to a different
+ * channel for each packet. */
+void promisc_recover_hop(u8 *packet) {
+	u8 idx = le_channel_index(channel - 2402);
+	int r;
 
-	// probably consecutive data packets on the same channel
-	if (clk_diff < 2 * LE_BASECLK)
+	if (!le_hop_solver_add(&le_promisc.hop, idle_buf_clk100ns, idx))
 		return;
+	TRACE(TRACE_PROMISC_OBSERVE, channel);
+
+	r = le_hop_solver_solve(&le_promisc.hop);
+	TRACE(TRACE_PROMISC_SOLVE, r);
+	if (r == 0) {
+		// nothing fits, start again from this packet
+		le_hop_solver_init(&le_promisc.hop);
+		le_hop_solver_add(&le_promisc.hop, idle_buf_clk100ns, idx);
+	} else if (r == 1) {
+		le.conn_interval = le_promisc.hop.conn_interval;
+		le.channel_increment = le_promisc.hop.channel_increment;
+		le_promisc_state(2, &le.conn_interval, 2);
+
+		le.interval_timer = le.conn_interval / 2;
+		le.conn_count = 0;
+		le.conn_epoch = 0;
+		do_hop = 0;
+		// Move on to regular connection following.
+		le.channel_idx = (idx + le.channel_increment) % LE_NUM_DATA_CHANNELS;
+		le.link_state = LINK_CONNECTED;
+		le.crc_verify = 0;
+		hop_mode = HOP_BTLE;
+		packet_cb = connection_follow_cb;
+		le_promisc_state(3, &le.channel_increment, 1);
 
-	if (clk_diff < le_promisc.smallest_hop_interval)
-		le_promisc.smallest_hop_interval = clk_diff;
-
-	obsv_hop_interval = DIVIDE_ROUND(le_promisc.smallest_hop_interval, 37 * LE_BASECLK);
-
-	if (le.conn_interval == obsv_hop_interval) {
-		// 5 consecutive hop intervals: consider it legit and move on
-		++le_promisc.consec_intervals;
-		if (le_promisc.consec_intervals == 5) {
-			packet_cb = promisc_recover_hop_increment;
-			hop_direct_channel = 2404;
-			hop_mode = HOP_DIRECT;
-			do_hop = 1;
-			le_promisc_state(2, &le.conn_interval, 2);
-		}
-	} else {
-		le.conn_interval = obsv_hop_interval;
-		le_promisc.consec_intervals = 0;
+		if (jam_mode != JAM_NONE)
+			le_jam_count = JAM_COUNT_DEFAULT;
+		return;
 	}
 
-	prev_clk = cur_clk;
+	if (le_promisc.hop.n >= 2) {
+		idx = (idx + 1 + le_promisc.hop.n) % LE_NUM_DATA_CHANNELS;
+		hop_direct_channel = le_channel_index_to_phys(idx);
+		hop_mode = HOP_DIRECT;
+		do_hop = 1;
+	}
 }
 
 void promisc_follow_cb(u8 *packet) {
-	int i;
+	u8 idx = le_channel_index(channel - 2402);
+
+	// every packet helps with the hop interval and increment later
+	if (idx < LE_NUM_DATA_CHANNELS)
+		le_hop_solver_add(&le_promisc.hop, idle_buf_clk100ns, idx);
 
 	// get the CRCInit
 	if (!le.crc_verify && packet[4] == 0x01 && packet[5] == 0x00) {
 		u32 crc = (packet[8] << 16) | (packet[7] << 8) | packet[6];
 
-		le.crc_init = btle_reverse_crc(crc, packet + 4, 2);
-		le.crc_init_reversed = 0;
-		for (i = 0; i < 24; ++i)
-			le.crc_init_reversed |= ((le.crc_init >> i) & 1) << (23 - i);
+		le.crc_init = le_reverse_crc(crc, packet + 4, 2);
+		le.crc_init_reversed = le_reverse_bits24(le.crc_init);
 
 		le.crc_verify = 1;
-		packet_cb = promisc_recover_hop_interval;
+		packet_cb = promisc_recover_hop;
 		le_promisc_state(1, &le.crc_init, 3);
 	}
 }
 
-// called when we see an AA, add it to the list
-void see_aa(u32 aa) {
-	int i, max = -1, killme = -1;
-	for (i = 0; i < AA_LIST_SIZE; ++i)
-		if (le_promisc.active_aa[i].aa == aa) {
-			++le_promisc.active_aa[i].count;
-			return;
-		}
+/* AA candidate reports are sent at most this often, in CLK100NS ticks */
+#define AA_REPORT_INTERVAL 1000000
 
-	// evict someone
-	for (i = 0; i < AA_LIST_SIZE; ++i)
-		if (le_promisc.active_aa[i].count < max || max < 0) {
-			killme = i;
-			max = le_promisc.active_aa[i].count;
-		}
+// send the current best AA candidates to the host
+static void report_aa_candidates(void) {
+	le_aa_entry_t top[8];
+	u8 buf[1 + 8 * 5];
+	int i, n;
 
-	le_promisc.active_aa[killme].aa = aa;
-	le_promisc.active_aa[killme].count = 1;
+	n = le_aa_cache_top(&le_promisc.aa_cache, top, 8);
+	buf[0] = n;
+	for (i = 0; i < n; i++) {
+		memcpy(&buf[1 + i * 5], &top[i].aa, 4);
+		buf[1 + i * 5 + 4] = top[i].count > 0xff ? 0xff : top[i].count;
+	}
+	le_promisc_state(4, buf, 1 + n * 5);
+
+	le_promisc.aa_cache_changed = 0;
+	le_promisc.aa_cache_reported = CLK100NS;
 }
 
 /* le promiscuous mode */
-int cb_le_promisc(char *unpacked) {
-	int i, j, k;
-	int idx;
-
-	// empty data PDU: 01 00
-	char desired[4][16] = {
-		{ 1, 0, 0, 0, 0, 0, 0, 0,
-		  0, 0, 0, 0, 0, 0, 0, 0, },
-		{ 1, 0, 0, 1, 0, 0, 0, 0,
-		  0, 0, 0, 0, 0, 0, 0, 0, },
-		{ 1, 0, 1, 0, 0, 0, 0, 0,
-		  0, 0, 0, 0, 0, 0, 0, 0, },
-		{ 1, 0, 1, 1, 0, 0, 0, 0,
-		  0, 0, 0, 0, 0, 0, 0, 0, },
-	};
-
-	for (i = 0; i < 4; ++i) {
-		idx = whitening_index[btle_channel_index(channel-2402)];
+/* Snap aa to the filter target it is within le_aa_filter_errs bits of.
+ * Returns 0 if there is none. */
+static int le_aa_target_match(u32 *aa)
+{
+	int i;
 
-		// whiten the desired data
-		for (j = 0; j < (int)sizeof(desired[i]); ++j) {
-			desired[i][j] ^= whitening[idx];
-			idx = (idx + 1) % sizeof(whitening);
+	for (i = 0; i < le_aa_target_count; i++) {
+		if (bt_count_bits(*aa ^ le_aa_targets[i]) <= le_aa_filter_errs) {
+			*aa = le_aa_targets[i];
+			return 1;
 		}
 	}
+	return 0;
+}
 
-	// then look for that bitsream in our receive buffer
-	for (i = 32; i < (DMA_SIZE*8*2 - 32 - 16); i++) {
-		int ok[4] = { 1, 1, 1, 1 };
-		int matching = -1;
-
-		for (j = 0; j < 4; ++j) {
-			for (k = 0; k < (int)sizeof(desired[j]); ++k) {
-				if (unpacked[i+k] != desired[j][k]) {
-					ok[j] = 0;
-					break;
-				}
-			}
-		}
-
-		// see if any match
-		for (j = 0; j < 4; ++j) {
-			if (ok[j]) {
-				matching = j;
-				break;
-			}
-		}
-
-		// skip if no match
-		if (matching < 0)
-			continue;
-
+int cb_le_promisc(char *unpacked) {
+	int i, j, count, passed = 0;
+	u8 channel_idx = le_channel_index(channel-2402);
+
+	// look for an empty data PDU in our receive buffer
+	for (i = 32;
+	     (i = le_find_empty_pdu(packed, i, DMA_SIZE*8*2 - 32 - 16,
+	                            channel_idx)) >= 0;
+	     i++) {
 		// found a match! unwhiten it and send it home
-		idx = whitening_index[btle_channel_index(channel-2402)];
-		for (j = 0; j < 4+3+3; ++j) {
-			u8 byte = 0;
-			for (k = 0; k < 8; k++) {
-				int offset = k + (j * 8) + i - 32;
-				if (offset >= DMA_SIZE*8*2) break;
-				int bit = unpacked[offset];
-				if (j >= 4) { // unwhiten data bytes
-					bit ^= whitening[idx];
-					idx = (idx + 1) % sizeof(whitening);
-				}
-				byte |= bit << k;
-			}
-			idle_rxbuf[j] = byte;
-		}
+		le_unwhiten(packed, DMA_SIZE*2, i, channel_idx,
+		            (uint8_t*)idle_rxbuf, 4+3+3);
 
 		u32 aa = (idle_rxbuf[3] << 24) |
 				 (idle_rxbuf[2] << 16) |
 				 (idle_rxbuf[1] <<  8) |
 				 (idle_rxbuf[0]);
-		see_aa(aa);
 
-		enqueue(LE_PACKET, (uint8_t*)idle_rxbuf);
+		if (le_aa_target_count) {
+			if (!le_aa_target_match(&aa))
+				continue;
+			passed = 1;
+			for (j = 0; j < 4; j++)
+				idle_rxbuf[j] = (aa >> (8*j)) & 0xff;
+		}
 
-	}
+		count = le_aa_cache_see(&le_promisc.aa_cache, aa);
+		le_promisc.aa_cache_changed = 1;
 
-	// once we see an AA 5 times, start following it
-	for (i = 0; i < AA_LIST_SIZE; ++i) {
-		if (le_promisc.active_aa[i].count > 3) {
-			le_set_access_address(le_promisc.active_aa[i].aa);
+		enqueue(LE_PACKET, (uint8_t*)idle_rxbuf);
+
+		// once we see an AA 5 times, start following it
+		if (count > 3) {
+			le_set_access_address(aa);
 			data_cb = cb_follow_le;
 			packet_cb = promisc_follow_cb;
 			le.crc_verify = 0;
 			le_promisc_state(0, &le.access_address, 4);
+			if (le_aa_target_count)
+				filter_count(1);
 			// quit using the old stuff and switch to sync mode
 			return 0;
 		}
 	}
 
+	// the filter counts buffers, as in bt_stream_rx()
+	if (le_aa_target_count)
+		filter_count(passed);
+
+	if (le_promisc.aa_cache_changed &&
+	    bt_clk100ns_diff(CLK100NS, le_promisc.aa_cache_reported) >= AA_REPORT_INTERVAL)
+		report_aa_candidates();
+
 	return 1;
 }
 
@@ -2289,7 +3220,7 @@ void bt_slave_le() {
 	for (i = 0; i < 6; ++i)
 		adv_ind[i+2] = slave_mac_address[5-i];
 
-	calc_crc = btle_calc_crc(le.crc_init_reversed, adv_ind, adv_ind_len);
+	calc_crc = le_calc_crc(le.crc_init_reversed, adv_ind, adv_ind_len);
 	adv_ind[adv_ind_len+0] = (calc_crc >>  0) & 0xff;
 	adv_ind[adv_ind_len+1] = (calc_crc >>  8) & 0xff;
 	adv_ind[adv_ind_len+2] = (calc_crc >> 16) & 0xff;
@@ -2342,7 +3273,6 @@ void rx_generic_sync(void) {
 
 		cc2400_fifo_read(len, buf+4);
 		enqueue(BR_PACKET, buf);
-		handle_usb(clkn);
 	}
 }
 
@@ -2403,17 +3333,8 @@ void tx_generic(void) {
 }
 
 /* spectrum analysis */
-void specan()
+static void specan_radio_init(void)
 {
-	u16 f;
-	u8 i = 0;
-	u8 buf[DMA_SIZE];
-
-	RXLED_SET;
-
-	queue_init();
-	clkn_start();
-
 #ifdef UBERTOOTH_ONE
 	PAEN_SET;
 	//HGM_SET;
@@ -2425,6 +3346,61 @@ void specan()
 	//FIXME maybe set RSSI.RSSI_FILT
 	while (!(cc2400_status() & XOSC16M_STABLE));
 	while ((cc2400_status() & FS_LOCK));
+}
+
+static void specan_flush(void)
+{
+	if (specan_count == 0)
+		return;
+
+	if (specan_format == SPECAN_FORMAT_COMPACT) {
+		specan_buf[3] = specan_count;
+		enqueue(SPECAN_COMPACT, specan_buf);
+	} else {
+		enqueue(SPECAN, specan_buf);
+	}
+	specan_count = 0;
+}
+
+/* Add one reading to the pending packet. Returns non-zero once the packet
+ * is complete and should be passed to specan_flush(). */
+static int specan_store(u16 f, u8 rssi)
+{
+	u16 first;
+
+	if (specan_format != SPECAN_FORMAT_COMPACT) {
+		specan_buf[3 * specan_count] = (f >> 8) & 0xFF;
+		specan_buf[(3 * specan_count) + 1] = f  & 0xFF;
+		specan_buf[(3 * specan_count) + 2] = rssi;
+		return ++specan_count == 16;
+	}
+
+	/* a run has to be contiguous, start a new one after a skipped bin */
+	first = specan_buf[0] | (specan_buf[1] << 8);
+	if (specan_count && f != first + specan_count)
+		specan_flush();
+
+	if (specan_count == 0) {
+		specan_buf[0] = f & 0xFF;
+		specan_buf[1] = (f >> 8) & 0xFF;
+		specan_buf[2] = 1;
+	}
+	specan_buf[SPECAN_COMPACT_HEADER + specan_count++] = rssi;
+
+	return specan_count == SPECAN_COMPACT_MAX || f == high_freq;
+}
+
+void specan()
+{
+	u16 f;
+
+	RXLED_SET;
+
+	queue_init();
+	clkn_start();
+	specan_count = 0;
+
+	specan_radio_init();
 
 	while (requested_mode == MODE_SPECAN) {
 		for (f = low_freq; f < high_freq + 1; f++) {
@@ -2435,21 +3411,168 @@ void specan()
 
 			/* give the CC2400 time to acquire RSSI reading */
 			volatile u32 j = 500; while (--j); //FIXME crude delay
-			buf[3 * i] = (f >> 8) & 0xFF;
-			buf[(3 * i) + 1] = f  & 0xFF;
-			buf[(3 * i) + 2] = cc2400_get(RSSI) >> 8;
-			i++;
-			if (i == 16) {
-				enqueue(SPECAN, buf);
-				i = 0;
-
-				handle_usb(clkn);
+			if (specan_store(f, cc2400_get(RSSI) >> 8))
+				specan_flush();
+
+			cc2400_strobe(SRFOFF);
+			while ((cc2400_status() & FS_LOCK));
+		}
+	}
+	RXLED_CLR;
+}
+
+/* 100 ns ticks since start, allowing for one wrap of CLK100NS */
+static u32 clk100ns_since(u32 start)
+{
+	u32 now = CLK100NS;
+
+	if (now < start)
+		now += 3125UL * (1UL << 20);
+	return now - start;
+}
+
+/* Poll RSSI after entering RX until three consecutive readings agree to
+ * within one step, returning the time that took. */
+static u16 measure_rssi_settle(void)
+{
+	u32 start = CLK100NS, t;
+	int8_t last, cur;
+	u8 stable = 0;
+
+	last = cc2400_get(RSSI) >> 8;
+	do {
+		cur = cc2400_get(RSSI) >> 8;
+		if (cur - last <= 1 && last - cur <= 1)
+			stable++;
+		else
+			stable = 0;
+		last = cur;
+		t = clk100ns_since(start);
+	} while (stable < 3 && t < SPECAN_SETTLE_MAX);
+
+	return t;
+}
+
+/* Start the synthesiser at the current FSDIV, with the cached VCO values
+ * for bin when there are some and a full calibration otherwise */
+static void specan_fs_on(u16 bin, u16 fstst0, u16 fstst2)
+{
+	if (specan_cal[bin].vco_array == SPECAN_CAL_INVALID) {
+		cc2400_set(FSTST0, fstst0);
+		cc2400_set(FSTST2, fstst2);
+	} else {
+		cc2400_set(FSTST0, fstst0 | FSTST0_VCO_ARRAY_OE |
+		           (specan_cal[bin].vco_array << FSTST0_VCO_ARRAY_O_SHIFT));
+		cc2400_set(FSTST2, fstst2 | FSTST2_VCO_CURRENT_OE |
+		           (specan_cal[bin].vco_current << FSTST2_VCO_CURRENT_O_SHIFT));
+	}
+	cc2400_strobe(SFSON);
+}
+
+/* Wait for the lock started by specan_fs_on(), caching the VCO results of
+ * a full calibration. Returns 0 on a timeout, with the synthesiser off and
+ * the cached values for bin dropped. */
+static int specan_fs_lock(u16 bin)
+{
+	u32 start = CLK100NS;
+
+	while (!(cc2400_status() & FS_LOCK)) {
+		if (clk100ns_since(start) > SPECAN_LOCK_TIMEOUT) {
+			specan_cal[bin].vco_array = SPECAN_CAL_INVALID;
+			cc2400_strobe(SRFOFF);
+			while ((cc2400_status() & FS_LOCK));
+			return 0;
+		}
+	}
+
+	if (specan_cal[bin].vco_array == SPECAN_CAL_INVALID) {
+		specan_cal[bin].vco_array = cc2400_get(FSTST0) & FSTST0_VCO_ARRAY_RES_MASK;
+		specan_cal[bin].vco_current = cc2400_get(FSTST2) & FSTST2_VCO_CURRENT_RES_MASK;
+	}
+	return 1;
+}
+
+/*
+ * Fast spectrum analysis. The first sweep runs the full VCO calibration at
+ * every frequency, caches the results and measures how long RSSI takes to
+ * settle. Later sweeps load the cached values through the FSTST override
+ * bits so that SFSON only has to wait for the PLL, wait for the measured
+ * settle time instead of a fixed delay and queue a finished packet while
+ * the synthesiser is locking.
+ */
+void specan_fast()
+{
+	u16 f, bin, bins, t, settle = 0;
+	u16 fstst0, fstst2;
+	u8 pending = 0;
+	u32 start, sweep_start;
+
+	RXLED_SET;
+
+	queue_init();
+	clkn_start();
+	specan_count = 0;
+
+	specan_radio_init();
+
+	bins = high_freq - low_freq + 1;
+	specan_sweeps = 0;
+	specan_sweep_time = 0;
+
+	/* keep the rest of the test registers as they were */
+	fstst0 = cc2400_get(FSTST0) & ~(FSTST0_VCO_ARRAY_OE | FSTST0_VCO_ARRAY_O_MASK);
+	fstst2 = cc2400_get(FSTST2) & ~(FSTST2_VCO_CURRENT_OE | FSTST2_VCO_CURRENT_O_MASK);
+
+	/* calibration sweep */
+	for (bin = 0; bin < bins && requested_mode == MODE_SPECAN_FAST; bin++) {
+		specan_cal[bin].vco_array = SPECAN_CAL_INVALID;
+		cc2400_set(FSDIV, low_freq + bin - 1);
+		specan_fs_on(bin, fstst0, fstst2);
+		if (!specan_fs_lock(bin))
+			continue;
+		cc2400_strobe(SRX);
+		t = measure_rssi_settle();
+		if (t > settle)
+			settle = t;
+		cc2400_strobe(SRFOFF);
+		while ((cc2400_status() & FS_LOCK));
+	}
+	/* leave a little margin over the worst case seen */
+	specan_settle_time = settle + (settle >> 2);
+
+	while (requested_mode == MODE_SPECAN_FAST) {
+		sweep_start = CLK100NS;
+		for (bin = 0, f = low_freq; bin < bins; bin++, f++) {
+			cc2400_set(FSDIV, f - 1);
+			specan_fs_on(bin, fstst0, fstst2);
+
+			/* queue the last packet while the synthesiser locks */
+			if (pending) {
+				specan_flush();
+				pending = 0;
 			}
 
+			if (!specan_fs_lock(bin))
+				continue;
+			cc2400_strobe(SRX);
+
+			start = CLK100NS;
+			while (clk100ns_since(start) < specan_settle_time);
+			pending = specan_store(f, cc2400_get(RSSI) >> 8);
+
 			cc2400_strobe(SRFOFF);
 			while ((cc2400_status() & FS_LOCK));
 		}
+		specan_sweep_time = clk100ns_since(sweep_start);
+		specan_sweeps++;
 	}
+
+	/* samples short of a full packet still go out */
+	specan_flush();
+
+	/* hand calibration back to the radio */
+	cc2400_set(FSTST0, fstst0);
+	cc2400_set(FSTST2, fstst2);
 	RXLED_CLR;
 }
 
@@ -2513,8 +3636,6 @@ void led_specan()
 
 		i = (i+1) % 3;
 
-		handle_usb(clkn);
-
 		cc2400_strobe(SRFOFF);
 		while ((cc2400_status() & FS_LOCK));
 	}
@@ -2524,11 +3645,11 @@ int main()
 {
 	ubertooth_init();
 	clkn_init();
+	perf_init();
 	ubertooth_usb_init(vendor_request_handler);
 	cc2400_idle();
 
 	while (1) {
-		handle_usb(clkn);
 		if(requested_mode != mode) {
 			switch (requested_mode) {
 				case MODE_RESET:
@@ -2577,6 +3698,9 @@ int main()
 				case MODE_SPECAN:
 					specan();
 					break;
+				case MODE_SPECAN_FAST:
+					specan_fast();
+					break;
 				case MODE_LED_SPECAN:
 					led_specan();
 					break;
@@ -87,16 +87,12 @@ static void ssp_stop() {
 }
 
 static void ego_init(void) {
-	// enable USB interrupts
-	ISER0 = ISER0_ISE_USB;
-
 	dio_ssp_init();
 }
 
 static void ego_deinit(void) {
 	cc2400_strobe(SRFOFF);
 	ssp_stop(); // TODO disable SSP
-	ICER0 = ICER0_ICE_USB;
 }
 
 static void rf_on(void) {
@@ -22,11 +22,19 @@
 #include "ubertooth_clock.h"
 #include "ubertooth.h"
 
+volatile int32_t clk_drift_rate;
+volatile int32_t clk_drift_acc;
+volatile uint64_t clkn_mono;
+volatile uint8_t time_sync_due;
+
 void clkn_stop()
 {
 	/* stop and reset the timer to zero */
 	T0TCR = TCR_Counter_Reset;
 
+	/* count the partial period so that the device tick never goes back */
+	clkn_mono++;
+
 	clkn = 0;
 	last_hop = 0;
 
@@ -34,10 +42,10 @@ void clkn_stop()
 	clk100ns_offset = 0;
 
 	clk_drift_ppm = 0;
-	clk_drift_correction = 0;
+	clk_drift_rate = 0;
+	clk_drift_acc = 0;
 
-	clkn_last_drift_fix = 0;
-	clkn_next_drift_fix = 0;
+	time_sync_due = 1;
 }
 
 void clkn_start()
@@ -38,12 +38,25 @@ volatile uint32_t last_hop;
 volatile uint32_t clkn_offset;
 volatile uint16_t clk100ns_offset;
 
-// linear clock drift
+/*
+ * linear clock drift: clk_drift_rate is added to clk_drift_acc every CLKN
+ * period, and each whole CLK100NS tick that builds up is taken out of the
+ * next period. The rate is in 2^-16 ticks per period, positive when the
+ * clock runs fast.
+ */
 volatile int16_t clk_drift_ppm;
-volatile uint16_t clk_drift_correction;
+extern volatile int32_t clk_drift_rate;
+extern volatile int32_t clk_drift_acc;
 
-volatile uint32_t clkn_last_drift_fix;
-volatile uint32_t clkn_next_drift_fix;
+/*
+ * clkn_mono counts clkn periods while the clock runs.  Unlike clkn it is never
+ * set or adjusted, so clkn_mono * 3125 + T0TC is a monotonic 64-bit device
+ * tick in units of 100 ns.
+ * time_sync_due is raised whenever clkn jumps and every 4096 clkn periods so
+ * that the next packet queued for the host is preceded by a TIME_SYNC.
+ */
+extern volatile uint64_t clkn_mono;
+extern volatile uint8_t time_sync_due;
 
 #define CLK100NS (3125*(clkn & 0xfffff) + T0TC)
 #define LE_BASECLK (12500)                    // 1.25 ms in units of 100ns
@@ -46,23 +46,31 @@ static void cs_threshold_set(int8_t level, cs_samples_t samples)
 	cs_no_squelch = (level <= -120);
 }
 
-void cs_threshold_calc_and_set(uint16_t channel)
+/* Carrier sense threshold for a channel, without touching the radio, so
+ * that it can be worked out ahead of a hop. */
+int8_t cs_threshold_calc(uint16_t channel)
 {
-	int8_t level;
-
 	/* If threshold is max/avg based (>0), reset here while rx is
 	 * off.  TODO - max-to-iir only works in SWEEP mode, where the
 	 * channel is known to be in the BT band, i.e., rssi_iir has a
 	 * value for it. */
 	if (cs_threshold_req > 0) {
 		int8_t rssi = rssi_get_avg(channel);
-		level = rssi - 54 + cs_threshold_req;
-	} else {
-		level = cs_threshold_req;
+		return rssi - 54 + cs_threshold_req;
 	}
+	return cs_threshold_req;
+}
+
+void cs_threshold_apply(int8_t level)
+{
 	cs_threshold_set(level, CS_SAMPLES_4);
 }
 
+void cs_threshold_calc_and_set(uint16_t channel)
+{
+	cs_threshold_apply(cs_threshold_calc(channel));
+}
+
 /* CS comes from CC2400 GIO6, which is LPC P2.2, active low. GPIO
  * triggers EINT3, which could be used for other things (but is not
  * currently). TODO - EINT3 should be managed globally, not turned on
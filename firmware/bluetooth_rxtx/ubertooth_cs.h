@@ -31,6 +31,8 @@ int8_t cs_threshold_req;     // requested CS threshold in dBm
 int8_t cs_threshold_cur;     // current CS threshold in dBm
 volatile uint8_t cs_trigger; // set by intr on P2.2 falling (CS)
 
+int8_t cs_threshold_calc(uint16_t channel);
+void cs_threshold_apply(int8_t level);
 void cs_threshold_calc_and_set(uint16_t channel);
 void cs_trigger_enable(void);
 void cs_trigger_disable(void);
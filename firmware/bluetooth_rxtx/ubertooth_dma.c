@@ -20,6 +20,8 @@
  */
 
 #include "ubertooth_dma.h"
+#include "ubertooth_usb.h"
+#include <stddef.h>
 
 /* DMA linked list items */
 typedef struct {
@@ -29,11 +31,24 @@ typedef struct {
 	uint32_t control;
 } dma_lli;
 
-dma_lli rx_dma_lli1;
-dma_lli rx_dma_lli2;
+usb_pkt_rx* volatile rxpkt[DMA_RING_SIZE];
+volatile dma_buf_meta rxbuf_meta[DMA_RING_SIZE];
+volatile uint8_t le_rxbuf[DMA_SIZE];
+
+volatile uint8_t* volatile idle_rxbuf;
+volatile dma_buf_meta* idle_rxmeta;
+uint32_t rx_tail;
+
+volatile uint32_t rx_tc;
+volatile uint32_t rx_err;
+
+dma_lli rx_dma_lli[DMA_RING_SIZE];
 
 dma_lli le_dma_lli[11]; // 11 x 4 bytes
 
+/* set while the main loop holds the buffer at rx_tail */
+static int rx_claimed;
+
 
 static void dma_enable(void)
 {
@@ -71,49 +86,48 @@ static void dma_disable(void)
 	rx_tc = 0;
 	rx_err = 0;
 
-	active_rxbuf = &rxbuf1[0];
-	idle_rxbuf = &rxbuf2[0];
+	/* empty the receive ring */
+	rx_tail = 0;
+	rx_claimed = 0;
 }
 
 void dma_init()
 {
+	int i;
+
 	/* power up GPDMA controller */
 	PCONP |= PCONP_PCGPDMA;
 
 	dma_disable();
 
-	/* DMA linked lists */
-	rx_dma_lli1.src = (uint32_t)&(DIO_SSP_DR);
-	rx_dma_lli1.dest = (uint32_t)&rxbuf1[0];
-	rx_dma_lli1.next_lli = (uint32_t)&rx_dma_lli2;
-	rx_dma_lli1.control = (DMA_SIZE) |
-			(1 << 12) |        /* source burst size = 4 */
-			(1 << 15) |        /* destination burst size = 4 */
-			(0 << 18) |        /* source width 8 bits */
-			(0 << 21) |        /* destination width 8 bits */
-			DMACCxControl_DI | /* destination increment */
-			DMACCxControl_I;   /* terminal count interrupt enable */
-
-	rx_dma_lli2.src = (uint32_t)&(DIO_SSP_DR);
-	rx_dma_lli2.dest = (uint32_t)&rxbuf2[0];
-	rx_dma_lli2.next_lli = (uint32_t)&rx_dma_lli1;
-	rx_dma_lli2.control = (DMA_SIZE) |
-			(1 << 12) |        /* source burst size = 4 */
-			(1 << 15) |        /* destination burst size = 4 */
-			(0 << 18) |        /* source width 8 bits */
-			(0 << 21) |        /* destination width 8 bits */
-			DMACCxControl_DI | /* destination increment */
-			DMACCxControl_I;   /* terminal count interrupt enable */
+	/* DMA linked list, closed into a ring. The packets stay with the ring
+	 * across modes, so they are only taken from the pool once. */
+	for (i = 0; i < DMA_RING_SIZE; ++i) {
+		if (rxpkt[i] == NULL)
+			rxpkt[i] = usb_alloc();
+		rx_dma_lli[i].src = (uint32_t)&(DIO_SSP_DR);
+		rx_dma_lli[i].dest = (uint32_t)&rxpkt[i]->data[0];
+		rx_dma_lli[i].next_lli = (uint32_t)&rx_dma_lli[(i + 1) & DMA_RING_MASK];
+		rx_dma_lli[i].control = (DMA_SIZE) |
+				(1 << 12) |        /* source burst size = 4 */
+				(1 << 15) |        /* destination burst size = 4 */
+				(0 << 18) |        /* source width 8 bits */
+				(0 << 21) |        /* destination width 8 bits */
+				DMACCxControl_DI | /* destination increment */
+				DMACCxControl_I;   /* terminal count interrupt enable */
+	}
+	idle_rxbuf = rxpkt[DMA_RING_MASK]->data;
+	idle_rxmeta = &rxbuf_meta[DMA_RING_MASK];
 
 	/* enable DMA globally */
 	DMACConfig = DMACConfig_E;
 	while (!(DMACConfig & DMACConfig_E));
 
 	/* configure DMA channel 1 */
-	DMACC0SrcAddr = rx_dma_lli1.src;
-	DMACC0DestAddr = rx_dma_lli1.dest;
-	DMACC0LLI = rx_dma_lli1.next_lli;
-	DMACC0Control = rx_dma_lli1.control;
+	DMACC0SrcAddr = rx_dma_lli[0].src;
+	DMACC0DestAddr = rx_dma_lli[0].dest;
+	DMACC0LLI = rx_dma_lli[0].next_lli;
+	DMACC0Control = rx_dma_lli[0].control;
 	DMACC0Config = DIO_SSP_SRC
 	               | (0x2 << 11)       /* peripheral to memory */
 	               | DMACCxConfig_IE   /* allow error interrupts */
@@ -135,7 +149,7 @@ void dma_init_le()
 
 	for (i = 0; i < 11; ++i) {
 		le_dma_lli[i].src = (uint32_t)&(DIO_SSP_DR);
-		le_dma_lli[i].dest = (uint32_t)&rxbuf1[4 * i];
+		le_dma_lli[i].dest = (uint32_t)&le_rxbuf[4 * i];
 		le_dma_lli[i].next_lli = i < 10 ? (uint32_t)&le_dma_lli[i+1] : 0;
 		le_dma_lli[i].control = 4 |
 				(1 << 12) |        /* source burst size = 4 */
@@ -158,6 +172,80 @@ void dma_init_le()
 			DMACCxConfig_ITC; /* allow terminal count interrupts */
 }
 
+/* Number of completed transfers not yet claimed */
+uint32_t dma_rx_pending()
+{
+	return rx_tc - rx_tail - rx_claimed;
+}
+
+/*
+ * Make the oldest unclaimed transfer the idle buffer. Call only when
+ * dma_rx_pending() is non-zero. Returns the number of transfers that were
+ * overwritten before they could be claimed; they are skipped.
+ */
+uint32_t dma_rx_claim()
+{
+	uint32_t head = rx_tc;
+	uint32_t lost = 0;
+
+	dma_rx_release();
+
+	/* the transfer at rx_tail + DMA_RING_SIZE is (being) written into the
+	 * same slot as rx_tail, and the controller may already have loaded the
+	 * LLI for it once rx_tail + DMA_RING_SIZE - 1 is under way, so keep one
+	 * slot clear as a guard */
+	if (head - rx_tail >= DMA_RING_SIZE - 1) {
+		lost = head - rx_tail - (DMA_RING_SIZE - 2);
+		rx_tail += lost;
+	}
+
+	idle_rxbuf = rxpkt[rx_tail & DMA_RING_MASK]->data;
+	idle_rxmeta = &rxbuf_meta[rx_tail & DMA_RING_MASK];
+	rx_claimed = 1;
+
+	return lost;
+}
+
+/* Hand the idle buffer back to DMA */
+void dma_rx_release()
+{
+	if (rx_claimed) {
+		++rx_tail;
+		rx_claimed = 0;
+	}
+}
+
+/*
+ * Hand the packet holding the idle buffer to the caller and give its ring
+ * slot a fresh packet from the USB pool for the next time around. The idle
+ * buffer moves to the fresh packet, so callers that go on writing to it do
+ * not touch the packet they were given; its contents are undefined. Returns
+ * NULL, leaving the slot alone, if the pool is empty or DMA has come round
+ * so close to the slot that it may already have loaded its LLI; the caller
+ * copies the idle buffer instead.
+ */
+usb_pkt_rx* dma_rx_take()
+{
+	uint32_t slot = rx_tail & DMA_RING_MASK;
+	usb_pkt_rx* pkt = rxpkt[slot];
+	usb_pkt_rx* fresh;
+
+	/* the main loop may have fallen behind since the claim */
+	if (rx_tc - rx_tail >= DMA_RING_SIZE - 1)
+		return NULL;
+
+	fresh = usb_alloc();
+	if (fresh == NULL)
+		return NULL;
+
+	/* with at least one transfer still to complete before DMA reaches
+	 * this slot, the new destination is picked up when it gets there */
+	rxpkt[slot] = fresh;
+	rx_dma_lli[slot].dest = (uint32_t)&fresh->data[0];
+	idle_rxbuf = fresh->data;
+
+	return pkt;
+}
 
 void dio_ssp_start()
 {
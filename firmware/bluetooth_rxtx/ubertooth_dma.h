@@ -24,24 +24,62 @@
 
 #include "inttypes.h"
 #include "ubertooth.h"
+#include "ubertooth_interface.h"
 
-volatile uint8_t rxbuf1[DMA_SIZE];
-volatile uint8_t rxbuf2[DMA_SIZE];
+/*
+ * Receive ring. The DMA controller fills the data of the USB packets in
+ * rxpkt[] in order and wraps around. rx_tc counts completed transfers, so
+ * transfer n lands in rxpkt[n % DMA_RING_SIZE]. The main loop consumes from
+ * rx_tail and may fall up to DMA_RING_SIZE - 2 buffers behind before symbols
+ * are lost; the last slot is a guard against DMA having loaded the LLI of
+ * the slot being claimed. A packet worth sending is swapped for a free one
+ * from the USB pool with dma_rx_take() rather than copied.
+ */
+#ifndef DMA_RING_SIZE
+#define DMA_RING_SIZE 8
+#endif
+#define DMA_RING_MASK (DMA_RING_SIZE - 1)
+
+#if (DMA_RING_SIZE < 4) || (DMA_RING_SIZE & DMA_RING_MASK)
+#error "DMA_RING_SIZE must be a power of two, at least 4"
+#endif
+
+/* State at the end of a transfer, recorded by the DMA interrupt */
+typedef struct {
+	uint32_t clk100ns;
+	uint16_t channel;
+	uint8_t  clkn_high;
+	uint8_t  discard;      /* transfer overlapped a retune */
+} dma_buf_meta;
+
+extern usb_pkt_rx* volatile rxpkt[DMA_RING_SIZE];
+extern volatile dma_buf_meta rxbuf_meta[DMA_RING_SIZE];
+
+/* linear receive buffer for dma_init_le() */
+extern volatile uint8_t le_rxbuf[DMA_SIZE];
 
 /*
- * The active buffer is the one with an active DMA transfer.
- * The idle buffer is the one we can read/write between transfers.
+ * The idle buffer is the one claimed by the main loop. DMA does not write to
+ * it until the ring wraps around to it again.
  */
-volatile uint8_t* volatile active_rxbuf;
-volatile uint8_t* volatile idle_rxbuf;
+extern volatile uint8_t* volatile idle_rxbuf;
+extern volatile dma_buf_meta* idle_rxmeta;
+
+/* next transfer to be claimed by the main loop */
+extern uint32_t rx_tail;
 
 /* rx terminal count and error interrupt counters */
-volatile uint32_t rx_tc;
-volatile uint32_t rx_err;
+extern volatile uint32_t rx_tc;
+extern volatile uint32_t rx_err;
 
 void dma_init();
 void dma_init_le();
 void dio_ssp_start();
 void dio_ssp_stop();
 
+uint32_t dma_rx_pending();
+uint32_t dma_rx_claim();
+void dma_rx_release();
+usb_pkt_rx* dma_rx_take();
+
 #endif
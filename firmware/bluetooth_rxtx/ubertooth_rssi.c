@@ -24,14 +24,32 @@
 #include <string.h>
 
 #define RSSI_IIR_ALPHA 3       // 3/256 = .012
+#define RSSI_FLOOR_RISE 7      // floor creeps up by 1/128 of the difference
+
+enum { RSSI_NONE = 0, RSSI_REPORTED = 1, RSSI_UPDATED = 2 };
 
 int32_t rssi_sum;
 int16_t rssi_iir[79] = {0};
 
-void rssi_reset(void)
+/* per-channel telemetry, see RSSI_TELEMETRY in ubertooth_interface.h */
+int16_t rssi_floor[79];        // scaled x256, like rssi_iir
+uint8_t rssi_cs_triggers[79];
+uint8_t rssi_state[79];        // RSSI_NONE, RSSI_REPORTED or RSSI_UPDATED
+uint8_t rssi_next = 0;         // where the next report carries on from
+
+/* Forget the per-channel state, when a mode starts or ends */
+void rssi_iir_reset(void)
 {
 	memset(rssi_iir, 0, sizeof(rssi_iir));
+	memset(rssi_floor, 0, sizeof(rssi_floor));
+	memset(rssi_cs_triggers, 0, sizeof(rssi_cs_triggers));
+	memset(rssi_state, RSSI_NONE, sizeof(rssi_state));
+	rssi_next = 0;
+}
 
+/* Start collecting samples for a new buffer */
+void rssi_reset(void)
+{
 	rssi_count = 0;
 	rssi_sum = 0;
 	rssi_max = INT8_MIN;
@@ -54,26 +72,77 @@ void rssi_iir_update(uint16_t channel)
 
 	/* Use array to track 79 Bluetooth channels, or just first slot
 	 * of array if the frequency is not a valid Bluetooth channel. */
-	if ( channel < 2402 || channel < 2480 )
+	if ( channel < 2402 || channel > 2480 )
 		channel = 2402;
 
 	int i = channel - 2402;
 
-	// IIR using scaled int math (x256)
-	if (rssi_count != 0)
-		avg = (rssi_sum  + 128) / rssi_count;
+	if (rssi_count == 0)
+		return;
+
+	// IIR using scaled int math (x256), seeded with the first average
+	avg = (rssi_sum  + 128) / rssi_count;
+	if (rssi_state[i] == RSSI_NONE) {
+		rssi_iir[i] = (int16_t)avg;
+		rssi_floor[i] = (int16_t)avg;
+	} else {
+		rssi_iir_acc = rssi_iir[i] * (256-RSSI_IIR_ALPHA);
+		rssi_iir_acc += avg * RSSI_IIR_ALPHA;
+		rssi_iir[i] = (int16_t)((rssi_iir_acc + 128) / 256);
+	}
+
+	/* noise floor: follows quiet buffers down at once, busy ones up slowly */
+	if (avg < rssi_floor[i])
+		rssi_floor[i] = (int16_t)avg;
 	else
-		avg = 0; // really an error
-	rssi_iir_acc = rssi_iir[i] * (256-RSSI_IIR_ALPHA);
-	rssi_iir_acc += avg * RSSI_IIR_ALPHA;
-	rssi_iir[i] = (int16_t)((rssi_iir_acc + 128) / 256);
+		rssi_floor[i] += (avg - rssi_floor[i]) >> RSSI_FLOOR_RISE;
+
+	rssi_state[i] = RSSI_UPDATED;
+}
+
+/* Count a carrier sense trigger on a channel */
+void rssi_cs_count(uint16_t channel)
+{
+	if (channel < 2402 || channel > 2480)
+		return;
+	if (rssi_cs_triggers[channel - 2402] < 0xff)
+		rssi_cs_triggers[channel - 2402]++;
+}
+
+/* Write up to max (channel, average, floor, CS triggers) entries for the
+ * channels updated since their last report to out, 4 bytes each, and clear
+ * them. Returns the number written and sets *more if any are left. */
+int rssi_telemetry_pack(uint8_t* out, int max, int* more)
+{
+	int i, n = 0, scanned;
+
+	for (scanned = 0; scanned < 79; scanned++) {
+		i = rssi_next;
+		if (rssi_state[i] != RSSI_UPDATED)
+			goto next;
+		if (n == max)
+			break;
+
+		out[4*n + 0] = i;
+		out[4*n + 1] = (uint8_t)((rssi_iir[i] + 128) / 256);
+		out[4*n + 2] = (uint8_t)((rssi_floor[i] + 128) / 256);
+		out[4*n + 3] = rssi_cs_triggers[i];
+		rssi_state[i] = RSSI_REPORTED;
+		rssi_cs_triggers[i] = 0;
+		n++;
+	next:
+		rssi_next = (rssi_next + 1) % 79;
+	}
+
+	*more = (scanned < 79);
+	return n;
 }
 
 int8_t rssi_get_avg(uint16_t channel)
 {
 	/* Use array to track 79 Bluetooth channels, or just first slot
 	 * of array if the frequency is not a valid Bluetooth channel. */
-	if ( channel < 2402 || channel < 2480 )
+	if ( channel < 2402 || channel > 2480 )
 		channel = 2402;
 
 	return (rssi_iir[channel-2402] + 128) / 256;
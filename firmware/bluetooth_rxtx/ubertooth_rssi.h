@@ -28,9 +28,12 @@ int8_t rssi_max;
 int8_t rssi_min;
 uint8_t rssi_count;
 
+void rssi_iir_reset(void);
 void rssi_reset(void);
 void rssi_add(int8_t v);
 void rssi_iir_update(uint16_t channel);
 int8_t rssi_get_avg(uint16_t channel);
+void rssi_cs_count(uint16_t channel);
+int rssi_telemetry_pack(uint8_t* out, int max, int* more);
 
 #endif
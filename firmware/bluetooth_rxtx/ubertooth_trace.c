@@ -0,0 +1,69 @@
+/*
+ * Copyright 2026 Great Scott Gadgets
+ *
+ * This file is part of Project Ubertooth.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "ubertooth_trace.h"
+
+trace_entry trace_ring[TRACE_RING_SIZE];
+volatile u32 trace_head = 0;
+volatile u8 trace_flags = 0;
+
+/* next event to be read */
+static u32 trace_tail = 0;
+
+/* Turn tracing on or off, dropping any events not read yet */
+void trace_set(u8 flags)
+{
+	trace_flags = flags;
+	trace_tail = trace_head;
+}
+
+int trace_pending(void)
+{
+	return trace_head != trace_tail;
+}
+
+/*
+ * Copy up to max of the oldest unread events to out, 8 bytes each,
+ * little-endian. Returns the number copied and sets *lost to the number of
+ * events overwritten before they could be read.
+ */
+int trace_read(u8 *out, int max, u32 *lost)
+{
+	u32 head = trace_head;
+	trace_entry *e;
+	int i, n = 0;
+
+	*lost = 0;
+	if (head - trace_tail > TRACE_RING_SIZE) {
+		*lost = head - trace_tail - TRACE_RING_SIZE;
+		trace_tail = head - TRACE_RING_SIZE;
+	}
+
+	for (; trace_tail != head && n < max; trace_tail++, n++) {
+		e = &trace_ring[trace_tail & TRACE_RING_MASK];
+		for (i = 0; i < 4; i++) {
+			out[8*n + i] = (e->cycles >> (8*i)) & 0xff;
+			out[8*n + 4 + i] = (e->event >> (8*i)) & 0xff;
+		}
+	}
+
+	return n;
+}
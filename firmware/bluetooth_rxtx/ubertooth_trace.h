@@ -0,0 +1,60 @@
+/*
+ * Copyright 2026 Great Scott Gadgets
+ *
+ * This file is part of Project Ubertooth.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __UBERTOOTH_TRACE_H
+#define __UBERTOOTH_TRACE_H
+
+#include "ubertooth.h"
+#include "ubertooth_interface.h"
+
+/*
+ * Ring of timestamped trace events, see UBERTOOTH_TRACE in
+ * ubertooth_interface.h. Events are only written from the main loop and
+ * only read from the USB interrupt, so the ring needs no locking. A reader
+ * that falls more than TRACE_RING_SIZE events behind loses the oldest.
+ */
+#define TRACE_RING_SIZE 256
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+
+typedef struct {
+	u32 cycles;       // DWT cycle counter
+	u32 event;        // id | arg << 16
+} trace_entry;
+
+extern trace_entry trace_ring[TRACE_RING_SIZE];
+extern volatile u32 trace_head;
+extern volatile u8 trace_flags;
+
+/* The entry is complete before trace_head moves past it */
+#define TRACE(id, arg) do { \
+	if (trace_flags & TRACE_ENABLE) { \
+		u32 _h = trace_head; \
+		trace_ring[_h & TRACE_RING_MASK].cycles = DWT_CYCCNT; \
+		trace_ring[_h & TRACE_RING_MASK].event = (id) | ((u32)(arg) << 16); \
+		trace_head = _h + 1; \
+	} \
+} while (0)
+
+void trace_set(u8 flags);
+int trace_pending(void);
+int trace_read(u8 *out, int max, u32 *lost);
+
+#endif /* __UBERTOOTH_TRACE_H */
@@ -51,6 +51,8 @@
 #include "usbhw_lpc.h"
 #include "ubertooth.h"
 #include "ubertooth_usb.h"
+#include "ubertooth_clock.h"
+#include "ubertooth_trace.h"
 #include <string.h>
 
 #ifdef UBERTOOTH_ZERO
@@ -74,11 +76,6 @@
 
 #define LE_WORD(x)		((x)&0xFF),((x)>>8)
 
-/*
- * This is supposed to be a lock-free ring buffer, but I haven't verified
- * atomicity of the operations on head and tail.
- */
-
 static u8 abDescriptors[] = {
 
 /* Device descriptor */
@@ -195,17 +192,8 @@ static u8 abDescriptors[] = {
 
 u8 abVendorReqData[258];
 
-/* Unused functions
-void usb_bulk_in_handler(u8 bEP, u8 bEPStatus)
-{
-	if (!(bEPStatus & EP_STATUS_DATA))
-		dequeue_send();
-}
-
-void usb_bulk_out_handler(u8 bEP, u8 bEPStatus)
-{
-}
-*/
+static void usb_bulk_in_handler(u8 bEP, u8 bEPStatus);
+static void usb_frame_handler(u16 wFrame);
 
 VendorRequestHandler *v_req_handler;
 
@@ -252,11 +240,15 @@ int ubertooth_usb_init(VendorRequestHandler *vendor_req_handler)
 	USBRegisterRequestHandler(REQTYPE_TYPE_VENDOR, usb_vendor_request_handler, abVendorReqData);
 
 	// register endpoints
-	//USBHwRegisterEPIntHandler(BULK_IN_EP, usb_bulk_in_handler);
-	//USBHwRegisterEPIntHandler(BULK_OUT_EP, usb_bulk_out_handler);
+	USBHwRegisterEPIntHandler(BULK_IN_EP, usb_bulk_in_handler);
 
-	// enable USB interrupts
-	//ISER0 = ISER0_ISE_USB;
+	// restart bulk IN every frame if the queue ran dry
+	USBHwRegisterFrameHandler(usb_frame_handler);
+
+	// enable USB interrupts at the lowest priority, so that a slow vendor
+	// request never holds up the clock or DMA interrupts
+	IPR6 = (IPR6 & ~0xff) | (0x1f << 3);
+	ISER0 = ISER0_ISE_USB;
 
 	// Enable WCID / driverless setup on Windows - Consumes Vendor Request 0xFF
 	USBRegisterWinusbInterface(0xFF, "{8ac47a88-cc26-4aa9-887b-42ca8cf07a63}");
@@ -267,59 +259,229 @@ int ubertooth_usb_init(VendorRequestHandler *vendor_req_handler)
 	return 0;
 }
 
-usb_pkt_rx fifo[128];
+/*
+ * Packet pool, placed in the AHB SRAM bank so that main SRAM is left for
+ * the stack and everything else. A packet is owned by exactly one of the
+ * free ring, the send queue or the RX DMA ring and moves between them
+ * without being copied. Both rings hold pool indices, are 256 entries long
+ * so that the u8 indices wrap by themselves, and have a single producer
+ * and a single consumer.
+ */
+usb_pkt_rx usb_pool[USB_POOL_SIZE] __attribute__ ((section(".ahbram")));
+
+static u8 free_ring[256];
+static volatile u8 free_head = 0;
+static volatile u8 free_tail = 0;
+static u8 pool_ready = 0;
+
+static u8 send_ring[256];
+static volatile u8 head = 0;
+static volatile u8 tail = 0;
 
-volatile u32 head = 0;
-volatile u32 tail = 0;
+volatile u16 queue_high_water = 0;
+volatile u32 queue_overflows = 0;
+volatile perf_counters perf;
 
+/*
+ * Packet being filled with records by usb_pack_begin()/usb_pack_end(). It is
+ * queued once the next record does not fit, ahead of any other packet, or
+ * handed straight to the USB interrupt when nothing else is waiting.
+ */
+static usb_pkt_rx *pack_pkt = NULL;
+static u8 pack_used = 0;
+
+/* Drop everything waiting to be sent. Packets held by the DMA ring stay
+ * where they are. */
 void queue_init(void)
 {
-	head = 0;
-	tail = 0;
-	memset(fifo, 0, sizeof(fifo));
+	usb_pkt_rx *pkt;
+	int i;
+
+	// the USB interrupt is the only other consumer of the queue
+	ICER0 = ICER0_ICE_USB;
+
+	if (!pool_ready) {
+		memset(usb_pool, 0, sizeof(usb_pool));
+		for (i = 0; i < USB_POOL_SIZE; i++)
+			free_ring[i] = i;
+		free_head = 0;
+		free_tail = USB_POOL_SIZE;
+		pool_ready = 1;
+	}
+
+	while ((pkt = dequeue()) != NULL)
+		usb_free(pkt);
+
+	if (pack_pkt != NULL) {
+		usb_free(pack_pkt);
+		pack_pkt = NULL;
+	}
+
+	queue_high_water = 0;
+	queue_overflows = 0;
+
+	ISER0 = ISER0_ISE_USB;
 }
 
-usb_pkt_rx *usb_enqueue(void)
+/* Take a packet from the pool, NULL if every packet is queued */
+usb_pkt_rx *usb_alloc(void)
 {
-	u8 h = head & 0x7F;
-	u8 t = tail & 0x7F;
-	u8 n = (t + 1) & 0x7F;
+	u8 h = free_head;
+	usb_pkt_rx *pkt;
 
-	/* fail if queue is full */
-	if (h == n) {
+	if (h == free_tail) {
+		++queue_overflows;
+		++perf.usb_alloc_failures;
 		return NULL;
 	}
 
-	++tail;
-	return &fifo[t];
+	free_head = h + 1;
+	pkt = &usb_pool[free_ring[h]];
 
+	/* builders that know nothing of LE connections leave these alone */
+	pkt->le_conn = 0;
+	pkt->reserved = 0;
+	return pkt;
 }
 
-usb_pkt_rx *dequeue(void)
+void usb_free(usb_pkt_rx *pkt)
+{
+	u8 t = free_tail;
+
+	free_ring[t] = pkt - usb_pool;
+	free_tail = t + 1;
+}
+
+static void send_put(usb_pkt_rx *pkt)
 {
-	u8 h = head & 0x7F;
-	u8 t = tail & 0x7F;
+	u8 t = tail;
+	u8 depth;
+
+	send_ring[t] = pkt - usb_pool;
+	tail = t + 1;
 
-	/* fail if queue is empty */
-	if (h == t) {
+	depth = tail - head;
+	if (depth > queue_high_water)
+		queue_high_water = depth;
+	if (depth > perf.usb_high_water)
+		perf.usb_high_water = depth;
+}
+
+/* Queue a filled packet from usb_alloc() for sending */
+void usb_enqueue(usb_pkt_rx *pkt)
+{
+	/* records packed so far go first */
+	usb_pack_flush();
+	send_put(pkt);
+}
+
+/*
+ * Make room for a len byte record in the data of the open packed packet,
+ * queueing it and starting a new one if it is too full. Returns the packet,
+ * with *offset set to where the record goes (0 for a new packet, whose
+ * header the caller fills in), or NULL if the pool is empty. The USB
+ * interrupt is masked until usb_pack_end().
+ */
+usb_pkt_rx *usb_pack_begin(int len, int *offset)
+{
+	ICER0 = ICER0_ICE_USB;
+
+	if (pack_pkt != NULL && pack_used + len > DMA_SIZE) {
+		send_put(pack_pkt);
+		pack_pkt = NULL;
+	}
+
+	if (pack_pkt == NULL) {
+		pack_pkt = usb_alloc();
+		if (pack_pkt == NULL) {
+			ISER0 = ISER0_ISE_USB;
+			return NULL;
+		}
+		memset(pack_pkt->data, 0, DMA_SIZE);
+		pack_used = 0;
+	}
+
+	*offset = pack_used;
+	return pack_pkt;
+}
+
+/* Commit len bytes written after usb_pack_begin(), 0 to write nothing */
+void usb_pack_end(int len)
+{
+	pack_used += len;
+	ISER0 = ISER0_ISE_USB;
+}
+
+/* Queue the open packed packet now, if it holds any records */
+void usb_pack_flush(void)
+{
+	if (pack_pkt == NULL)
+		return;
+
+	ICER0 = ICER0_ICE_USB;
+	if (pack_pkt != NULL && pack_used > 0) {
+		send_put(pack_pkt);
+		pack_pkt = NULL;
+	}
+	ISER0 = ISER0_ISE_USB;
+}
+
+/* Oldest queued packet, to be returned with usb_free() once sent */
+usb_pkt_rx *dequeue(void)
+{
+	u8 h = head;
+
+	/* nothing else waiting, so the open packed packet goes as it is */
+	if (h == tail) {
+		if (pack_pkt != NULL && pack_used > 0) {
+			usb_pkt_rx *pkt = pack_pkt;
+			pack_pkt = NULL;
+			return pkt;
+		}
 		return NULL;
 	}
 
-	++head;
-	return &fifo[h];
+	head = h + 1;
+	return &usb_pool[send_ring[h]];
+}
+
+u16 queue_depth(void)
+{
+	return (u8)(tail - head);
 }
 
 #define USB_KEEP_ALIVE 400000
 u32 last_usb_pkt = 0;  // for keep alive packets
 
-int dequeue_send(u32 clkn)
+/* Send pending trace events in a slot the queue has no use for */
+static int trace_send(u32 clkn)
+{
+	static usb_pkt_rx pkt;
+	u32 lost;
+
+	memset(&pkt, 0, sizeof(pkt));
+	pkt.pkt_type = TRACE;
+	pkt.clkn_high = (clkn >> 20) & 0xff;
+	pkt.clk100ns = CLK100NS;
+	pkt.data[0] = trace_read(&pkt.data[2], TRACE_PACKET_MAX, &lost);
+	pkt.data[1] = lost > 0xff ? 0xff : lost;
+
+	last_usb_pkt = clkn;
+	USBHwEPWrite(BULK_IN_EP, (u8 *)&pkt, sizeof(usb_pkt_rx));
+	return 0;
+}
+
+static int dequeue_send(u32 clkn)
 {
 	usb_pkt_rx *pkt = dequeue();
 	if (pkt != NULL) {
 		last_usb_pkt = clkn;
 		USBHwEPWrite(BULK_IN_EP, (u8 *)pkt, sizeof(usb_pkt_rx));
+		usb_free(pkt);
 		return 1;
 	} else {
+		if ((trace_flags & TRACE_STREAM) && trace_pending())
+			return trace_send(clkn);
 		if (clkn - last_usb_pkt > USB_KEEP_ALIVE) {
 			u8 pkt_type = KEEP_ALIVE;
 			last_usb_pkt = clkn;
@@ -329,10 +491,18 @@ int dequeue_send(u32 clkn)
 	}
 }
 
-void handle_usb(u32 clkn)
+/*
+ * Bulk IN is serviced entirely from the USB interrupt: the main loop only
+ * queues packets. Each endpoint interrupt refills the packet buffer that
+ * was just sent to the host, and the 1 ms frame interrupt restarts sending
+ * after the queue has been empty.
+ */
+static void bulk_in_fill(void)
 {
 	u8 epstat;
 
+	++perf.usb_bulk_services;
+
 	/* write queued packets to USB if possible */
 	epstat = USBHwEPGetStatus(BULK_IN_EP);
 	if (!(epstat & EPSTAT_B1FULL)) {
@@ -341,7 +511,14 @@ void handle_usb(u32 clkn)
 	if (!(epstat & EPSTAT_B2FULL)) {
 		dequeue_send(clkn);
 	}
+}
 
-	/* polled "interrupt" */
-	USBHwISR();
+static void usb_bulk_in_handler(u8 bEP, u8 bEPStatus)
+{
+	bulk_in_fill();
+}
+
+static void usb_frame_handler(u16 wFrame)
+{
+	bulk_in_fill();
 }
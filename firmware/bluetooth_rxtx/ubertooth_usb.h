@@ -53,12 +53,26 @@
 #include "ubertooth.h"
 #include "ubertooth_interface.h"
 
+/* packets in the USB queue pool, at most 255 */
+#define USB_POOL_SIZE 240
+
+extern volatile u16 queue_high_water;
+extern volatile u32 queue_overflows;
+
+/* see UBERTOOTH_GET_PERF_COUNTERS */
+extern volatile perf_counters perf;
+
 typedef int (VendorRequestHandler)(u8 request, u16 *request_params, u8 *data, int *data_len);
 
 int ubertooth_usb_init(VendorRequestHandler *vendor_req_handler);
 void queue_init();
-usb_pkt_rx *usb_enqueue();
+usb_pkt_rx *usb_alloc();
+void usb_free(usb_pkt_rx *pkt);
+void usb_enqueue(usb_pkt_rx *pkt);
+usb_pkt_rx *usb_pack_begin(int len, int *offset);
+void usb_pack_end(int len);
+void usb_pack_flush(void);
 usb_pkt_rx *dequeue();
-void handle_usb(u32 clkn);
+u16 queue_depth();
 
 #endif /* __UBERTOOTH_USB_H */
@@ -80,6 +80,16 @@
 #define FS_LOCK              (1 << 2)
 #define FH_EVENT             (1 << 0)
 
+/* FSTST0/FSTST2 VCO calibration results and overrides */
+#define FSTST0_VCO_ARRAY_OE       (1 << 10)
+#define FSTST0_VCO_ARRAY_O_SHIFT  5
+#define FSTST0_VCO_ARRAY_O_MASK   (0x1f << FSTST0_VCO_ARRAY_O_SHIFT)
+#define FSTST0_VCO_ARRAY_RES_MASK 0x1f
+#define FSTST2_VCO_CURRENT_OE       (1 << 12)
+#define FSTST2_VCO_CURRENT_O_SHIFT  6
+#define FSTST2_VCO_CURRENT_O_MASK   (0x3f << FSTST2_VCO_CURRENT_O_SHIFT)
+#define FSTST2_VCO_CURRENT_RES_MASK 0x3f
+
 /* GIO signals */
 #define GIO_PA_EN             3  /* Active high PA enable signal */
 #define GIO_PA_EN_N           4  /* Active low PA enable signal */
@@ -266,6 +266,15 @@
 #define IPR8  LPC17_REG(0xE000E420) /* Interrupt Priority Register 8 */
 #define STIR  LPC17_REG(0xE000EF00) /* Software Trigger Interrupt Register */
 
+/* Debug and trace registers, for the DWT cycle counter */
+
+#define DEMCR      LPC17_REG(0xE000EDFC) /* Debug Exception and Monitor Control Register */
+#define DWT_CTRL   LPC17_REG(0xE0001000) /* DWT Control Register */
+#define DWT_CYCCNT LPC17_REG(0xE0001004) /* DWT Cycle Count Register */
+
+#define DEMCR_TRCENA       (0x1 << 24) /* Enable DWT and ITM */
+#define DWT_CTRL_CYCCNTENA (0x1 << 0)  /* Enable the cycle counter */
+
 /* Interrupt Set-Enable Register 0 register (ISER0 - 0xE000 E100) */
 #define ISER0_ISE_WDT    (0x1 << 0) /* Watchdog Timer Interrupt Enable */
 #define ISER0_ISE_TIMER0 (0x1 << 1) /* Timer 0 Interrupt Enable */
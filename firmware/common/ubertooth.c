@@ -268,10 +268,17 @@ void cc2400_init()
  * 2. We're saving the second SPI peripheral for an expansion port.
  * 3. The CC2400 needs CSN held low for the entire transaction which the
  *    LPC17xx SPI peripheral won't do without some workaround anyway.
+ *
+ * Register requests from the host are served in the USB interrupt, so the
+ * USB interrupt is held off for the transaction. Otherwise one could start
+ * in the middle of a main loop transaction and corrupt both.
  */
 u32 cc2400_spi(u8 len, u32 data)
 {
 	u32 msb = 1 << (len - 1);
+	u32 usb_enabled = ISER0 & ISER0_ISE_USB;
+
+	ICER0 = ICER0_ICE_USB;
 
 	/* start transaction by dropping CSN */
 	CSN_CLR;
@@ -293,6 +300,9 @@ u32 cc2400_spi(u8 len, u32 data)
 	/* end transaction by raising CSN */
 	CSN_SET;
 
+	if (usb_enabled)
+		ISER0 = ISER0_ISE_USB;
+
 	return data;
 }
 
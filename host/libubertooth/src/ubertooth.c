@@ -28,6 +28,7 @@
 #include <unistd.h>
 
 #include "ubertooth.h"
+#include "ubertooth_bluetooth.h"
 #include "ubertooth_callback.h"
 #include "ubertooth_control.h"
 #include "ubertooth_interface.h"
@@ -100,6 +101,13 @@ void ubertooth_set_timeout(ubertooth_t* ut, int seconds) {
 	alarm(seconds);
 }
 
+static int is_ubertooth(const struct libusb_device_descriptor* desc)
+{
+	return (desc->idVendor == TC13_VENDORID && desc->idProduct == TC13_PRODUCTID)
+	       || (desc->idVendor == U0_VENDORID && desc->idProduct == U0_PRODUCTID)
+	       || (desc->idVendor == U1_VENDORID && desc->idProduct == U1_PRODUCTID);
+}
+
 static struct libusb_device_handle* find_ubertooth_device(int ubertooth_device)
 {
 	struct libusb_device **usb_list = NULL;
@@ -114,9 +122,7 @@ static struct libusb_device_handle* find_ubertooth_device(int ubertooth_device)
 		r = libusb_get_device_descriptor(usb_list[i], &desc);
 		if(r < 0)
 			fprintf(stderr, "couldn't get usb descriptor for dev #%d!\n", i);
-		if ((desc.idVendor == TC13_VENDORID && desc.idProduct == TC13_PRODUCTID)
-		    || (desc.idVendor == U0_VENDORID && desc.idProduct == U0_PRODUCTID)
-		    || (desc.idVendor == U1_VENDORID && desc.idProduct == U1_PRODUCTID))
+		if (is_ubertooth(&desc))
 		{
 			ubertooth_devs[ubertooths] = i;
 			ubertooths++;
@@ -194,8 +200,10 @@ static void rx_xfer_status(int status)
 
 static void cb_xfer(struct libusb_transfer *xfer)
 {
-	int r;
+	int r, i, n;
 	ubertooth_t* ut = (ubertooth_t*)xfer->user_data;
+	usb_pkt_rx records[LE_PACKED_MAX];
+	usb_pkt_rx* rx;
 
 	if (xfer->status != LIBUSB_TRANSFER_COMPLETED) {
 		if(xfer->status == LIBUSB_TRANSFER_TIMED_OUT) {
@@ -214,7 +222,16 @@ static void cb_xfer(struct libusb_transfer *xfer)
 	if(ut->stop_ubertooth)
 		return;
 
-	fifo_inc_write_ptr(ut->fifo);
+	rx = fifo_get_write_element(ut->fifo);
+	if (rx->pkt_type == LE_PACKED) {
+		/* tools that ask for packed LE transfers with cmd_set_le_packed()
+		 * get them back one LE_PACKET at a time */
+		n = ubertooth_unpack_le(rx, records, LE_PACKED_MAX);
+		for (i = 0; i < n; i++)
+			fifo_push(ut->fifo, &records[i]);
+	} else {
+		fifo_inc_write_ptr(ut->fifo);
+	}
 	ut->rx_xfer->buffer = (uint8_t*)fifo_get_write_element(ut->fifo);
 
 	r = libusb_submit_transfer(ut->rx_xfer);
@@ -274,9 +291,26 @@ void ubertooth_bulk_wait(ubertooth_t* ut)
 		usleep(1);
 }
 
+/* Take in packets that are meant for libubertooth rather than the callback.
+ * Returns 1 if rx is one of them and should not be passed on. */
+static int receive_meta(ubertooth_t* ut, const usb_pkt_rx* rx)
+{
+	int meta = ubertooth_time_sync(ut, rx)
+	           || ubertooth_filter_summary(ut, rx)
+	           || ubertooth_rssi_telemetry(ut, rx)
+	           || ubertooth_trace_receive(ut, rx)
+	           || ubertooth_clock_track(ut, rx);
+
+	return meta && !ut->meta_passthrough;
+}
+
 int ubertooth_bulk_receive(ubertooth_t* ut, rx_callback cb, void* cb_args)
 {
 	if (!fifo_empty(ut->fifo)) {
+		if (receive_meta(ut, fifo_peek(ut->fifo))) {
+			fifo_pop(ut->fifo);
+			return 0;
+		}
 		(*cb)(ut, cb_args);
 		if(ut->stop_ubertooth) {
 			if(ut->rx_xfer)
@@ -334,14 +368,96 @@ int stream_rx_file(ubertooth_t* ut, FILE* fp, rx_callback cb, void* cb_args)
 		nitems = fread(buf, sizeof(buf[0]), PKT_LEN, fp);
 		if (nitems != PKT_LEN)
 			return 0;
+		if (receive_meta(ut, (usb_pkt_rx*)buf))
+			continue;
 		fifo_push(ut->fifo, (usb_pkt_rx*)buf);
 		(*cb)(ut, cb_args);
 	}
 }
 
+static void print_afh_map_r(btbb_piconet* pn)
+{
+	uint8_t* afh_map = btbb_piconet_get_afh_map(pn);
+	int i, j;
+
+	printf("%u ", (uint32_t)time(NULL));
+	for (i=0; i<10; i++)
+		for (j=0; j<8; j++)
+			if (afh_map[i] & (1<<j))
+				printf("1");
+			else
+				printf("0");
+	printf("\n");
+}
+
+/* Have the Ubertooth learn the AFH map, so that only changes to it come
+ * over USB rather than every hit. For the first timeout seconds channels
+ * known to be used are skipped to find the rest sooner, then the map is
+ * monitored. Returns a negative value, with nothing started, if the
+ * firmware can not do this. */
+static int rx_afh_learn(ubertooth_t* ut, btbb_piconet* pn, int timeout,
+                        int r_format)
+{
+	uint32_t lap = btbb_piconet_get_lap(pn);
+	time_t now, discover_end = 0, lasttime = 0;
+	int r;
+
+	r = cmd_set_lap_filter(ut->devh, &lap, 1, max_ac_errors);
+	if (r < 0)
+		return r;
+
+	if (timeout) {
+		r = cmd_afh_learn(ut->devh, 0, AFH_LEARN_ENABLE | AFH_LEARN_DISCOVER);
+		discover_end = time(NULL) + timeout;
+	} else {
+		r = cmd_afh_learn(ut->devh, packet_counter_max, AFH_LEARN_ENABLE);
+	}
+	if (r < 0) {
+		cmd_set_lap_filter(ut->devh, NULL, 0, 0);
+		return r;
+	}
+
+	r = ubertooth_bulk_init(ut);
+	if (r < 0)
+		return 0;
+
+	r = ubertooth_bulk_thread_start();
+	if (r < 0)
+		return 0;
+
+	r = cmd_rx_syms(ut->devh);
+	if (r < 0)
+		return 0;
+
+	while(!ut->stop_ubertooth) {
+		ubertooth_bulk_receive(ut, r_format ? cb_afh_learn_r : cb_afh_learn, pn);
+
+		now = time(NULL);
+		if (discover_end && now >= discover_end) {
+			discover_end = 0;
+			cmd_afh_learn(ut->devh, packet_counter_max, AFH_LEARN_ENABLE);
+			if (!r_format)
+				btbb_print_afh_map(pn);
+		}
+		if (r_format && lasttime < now) {
+			lasttime = now;
+			print_afh_map_r(pn);
+		}
+	}
+
+	ubertooth_bulk_thread_stop();
+	return 0;
+}
+
 void rx_afh(ubertooth_t* ut, btbb_piconet* pn, int timeout)
 {
-	int r = btbb_init(max_ac_errors);
+	int r;
+
+	if (rx_afh_learn(ut, pn, timeout, 0) >= 0)
+		return;
+	fprintf(stderr, "falling back to AFH detection on the host\n");
+
+	r = btbb_init(max_ac_errors);
 	if (r < 0)
 		return;
 
@@ -367,12 +483,16 @@ void rx_afh(ubertooth_t* ut, btbb_piconet* pn, int timeout)
 	stream_rx_usb(ut, cb_afh_monitor, pn);
 }
 
-void rx_afh_r(ubertooth_t* ut, btbb_piconet* pn, int timeout __attribute__((unused)))
+void rx_afh_r(ubertooth_t* ut, btbb_piconet* pn, int timeout)
 {
 	static uint32_t lasttime;
+	int r;
 
-	int r = btbb_init(max_ac_errors);
-	int i, j;
+	if (rx_afh_learn(ut, pn, timeout, 1) >= 0)
+		return;
+	fprintf(stderr, "falling back to AFH detection on the host\n");
+
+	r = btbb_init(max_ac_errors);
 	if (r < 0)
 		return;
 
@@ -399,17 +519,7 @@ void rx_afh_r(ubertooth_t* ut, btbb_piconet* pn, int timeout __attribute__((unus
 		ubertooth_bulk_receive(ut, cb_afh_r, pn);
 		if(lasttime < time(NULL)) {
 			lasttime = time(NULL);
-			printf("%u ", (uint32_t)time(NULL));
-			// btbb_print_afh_map(pn);
-
-			uint8_t* afh_map = btbb_piconet_get_afh_map(pn);
-			for (i=0; i<10; i++)
-				for (j=0; j<8; j++)
-					if (afh_map[i] & (1<<j))
-						printf("1");
-					else
-						printf("0");
-			printf("\n");
+			print_afh_map_r(pn);
 		}
 	}
 
@@ -437,6 +547,53 @@ void ubertooth_unpack_symbols(const uint8_t* buf, char* unpacked)
 	}
 }
 
+/* Split an LE_PACKED packet into LE_PACKETs, as they would have been sent
+ * without packing. Any other packet is copied to out as it is. Returns the
+ * number of packets written to out. */
+int ubertooth_unpack_le(const usb_pkt_rx* rx, usb_pkt_rx* out, int max)
+{
+	const uint8_t* r;
+	uint32_t dt, clk100ns;
+	int off = 0, n = 0, len;
+
+	if (rx->pkt_type != LE_PACKED) {
+		if (max < 1)
+			return 0;
+		out[0] = *rx;
+		return 1;
+	}
+
+	while (n < max && off + LE_RECORD_HEADER <= DMA_SIZE) {
+		r = &rx->data[off];
+		len = r[0];
+		if (len == 0 || off + LE_RECORD_HEADER + len > DMA_SIZE)
+			break;
+
+		dt = r[4] | (r[5] << 8) | (r[6] << 16);
+		clk100ns = le32toh(rx->clk100ns) + dt;
+
+		memset(&out[n], 0, sizeof(usb_pkt_rx));
+		out[n].pkt_type = LE_PACKET;
+		out[n].status = rx->status;
+		out[n].channel = r[1];
+		out[n].rssi_max = (int8_t)r[2];
+		out[n].rssi_min = (int8_t)r[3];
+		out[n].clkn_high = rx->clkn_high;
+		out[n].le_conn = rx->le_conn;
+		if (clk100ns >= BT_CLK100NS_WRAP) {
+			clk100ns -= BT_CLK100NS_WRAP;
+			out[n].clkn_high++;
+		}
+		out[n].clk100ns = htole32(clk100ns);
+		memcpy(out[n].data, r + LE_RECORD_HEADER, len);
+
+		off += LE_RECORD_HEADER + len;
+		n++;
+	}
+
+	return n;
+}
+
 static void cb_dump_bitstream(ubertooth_t* ut, void* args __attribute__((unused)))
 {
 	int i;
@@ -482,10 +639,15 @@ static void cb_dump_full(ubertooth_t* ut, void* args __attribute__((unused)))
 /* dump received symbols to stdout */
 void rx_dump(ubertooth_t* ut, int bitstream)
 {
-	if (bitstream)
+	if (bitstream) {
 		stream_rx_usb(ut, cb_dump_bitstream, NULL);
-	else
+	} else {
+		/* keep TIME_SYNC and FILTER_SUMMARY packets in the dump for
+		 * stream_rx_file() */
+		ut->meta_passthrough = 1;
 		stream_rx_usb(ut, cb_dump_full, NULL);
+		ut->meta_passthrough = 0;
+	}
 }
 
 void ubertooth_stop(ubertooth_t* ut)
@@ -494,6 +656,8 @@ void ubertooth_stop(ubertooth_t* ut)
 	if(ut->rx_xfer != NULL)
 		libusb_cancel_transfer(ut->rx_xfer);
 	if (ut->devh != NULL) {
+		if (ut->trace)
+			cmd_set_trace(ut->devh, 0);
 		cmd_stop(ut->devh);
 		libusb_release_interface(ut->devh, 0);
 	}
@@ -517,6 +681,11 @@ void ubertooth_stop(ubertooth_t* ut)
 		lell_pcapng_close(ut->h_pcapng_le);
 		ut->h_pcapng_le = NULL;
 	}
+
+	if (ut->trace) {
+		trace_writer_close(ut->trace);
+		ut->trace = NULL;
+	}
 }
 
 ubertooth_t* ubertooth_init()
@@ -538,6 +707,23 @@ ubertooth_t* ubertooth_init()
 	ut->start_clk100ns = 0;
 	ut->last_clk100ns = 0;
 	ut->clk100ns_upper = 0;
+	ut->time_synced = 0;
+	ut->meta_passthrough = 0;
+	ut->filter_passed = 0;
+	ut->filter_dropped = 0;
+	ut->sync_tick = 0;
+	ut->sync_clk100ns = 0;
+	ut->start_tick = 0;
+	memset(ut->channel_quality, 0, sizeof(ut->channel_quality));
+	ut->channel_reports = 0;
+	ut->print_channel_quality = 0;
+	ut->trace = NULL;
+	ut->clock_tracking = 0;
+	ut->clock_locked = 0;
+	ut->clock_phase_err = 0;
+	ut->clock_drift_ppm = 0;
+	ut->clock_updates = 0;
+	ut->clock_relocks = 0;
 
 	ut->h_pcap_bredr = NULL;
 	ut->h_pcap_le = NULL;
@@ -572,6 +758,29 @@ int ubertooth_connect(ubertooth_t* ut, int ubertooth_device)
 	return 1;
 }
 
+/* Number of attached Ubertooth devices, or a negative libusb error */
+int ubertooth_count(void)
+{
+	struct libusb_device **usb_list = NULL;
+	struct libusb_device_descriptor desc;
+	int usb_devs, i, ubertooths = 0;
+	int r = libusb_init(NULL);
+
+	if (r < 0)
+		return r;
+
+	usb_devs = libusb_get_device_list(NULL, &usb_list);
+	for(i = 0 ; i < usb_devs ; ++i) {
+		if (libusb_get_device_descriptor(usb_list[i], &desc) == 0
+		    && is_ubertooth(&desc))
+			ubertooths++;
+	}
+	libusb_free_device_list(usb_list, 1);
+	libusb_exit(NULL);
+
+	return ubertooths;
+}
+
 ubertooth_t* ubertooth_start(int ubertooth_device)
 {
 	ubertooth_t* ut = ubertooth_init();
@@ -24,6 +24,8 @@
 
 #include "ubertooth_control.h"
 #include "ubertooth_fifo.h"
+#include "ubertooth_specan.h"
+#include "ubertooth_trace.h"
 #include <btbb.h>
 
 /* specan output types
@@ -32,15 +34,37 @@ enum specan_modes {
 	SPECAN_STDOUT         = 0,
 	SPECAN_GNUPLOT_NORMAL = 1,
 	SPECAN_GNUPLOT_3D     = 2,
-	SPECAN_FILE           = 3
+	SPECAN_FILE           = 3,
+	SPECAN_SWEEP          = 4,
+	SPECAN_STATS          = 5
 };
 
+/* SPECAN_SWEEP output is a stream of frames, one per complete sweep.
+ * Each frame is a little-endian header followed by num_bins signed
+ * RSSI values, one per step MHz starting at low_freq:
+ *   [0-3]   SPECAN_SWEEP_MAGIC
+ *   [4-7]   clk100ns, device timestamp of the first sample in the sweep
+ *   [8-9]   low_freq
+ *   [10-11] high_freq
+ *   [12-13] step
+ *   [14-15] num_bins */
+#define SPECAN_SWEEP_MAGIC 0x50575355 /* "USWP" */
+#define SPECAN_SWEEP_HEADER_LEN 16
+
 enum board_ids {
 	BOARD_ID_UBERTOOTH_ZERO = 0,
 	BOARD_ID_UBERTOOTH_ONE  = 1,
 	BOARD_ID_TC13BADGE      = 2
 };
 
+/* Channel quality from RSSI_TELEMETRY reports, values in dBm */
+typedef struct {
+	int8_t rssi_avg;
+	int8_t noise_floor;
+	uint32_t cs_triggers;       /* total since the map was started */
+	uint32_t report;            /* last report to cover the channel, 0 never */
+} channel_quality_t;
+
 typedef struct {
 	/* Ringbuffers for USB and Bluetooth symbols */
 	fifo_t* fifo;
@@ -54,6 +78,37 @@ typedef struct {
 	uint64_t last_clk100ns;
 	uint64_t clk100ns_upper;
 
+	/* exact device time, see TIME_SYNC in ubertooth_interface.h */
+	uint8_t time_synced;
+	uint64_t sync_tick;
+	uint32_t sync_clk100ns;
+	uint64_t start_tick;
+
+	/* from the last FILTER_SUMMARY */
+	uint32_t filter_passed;
+	uint32_t filter_dropped;
+
+	/* live channel quality map, see RSSI_TELEMETRY */
+	channel_quality_t channel_quality[NUM_BREDR_CHANNELS];
+	uint32_t channel_reports;
+	uint8_t print_channel_quality;
+
+	/* where streamed TRACE packets go, dropped if NULL */
+	trace_writer_t* trace;
+
+	/* the device keeps CLKN locked to the piconet rather than cb_rx, and
+	 * the last CLOCK_TRACK report */
+	uint8_t clock_tracking;
+	uint8_t clock_locked;
+	int32_t clock_phase_err;    /* CLK100NS ticks */
+	double clock_drift_ppm;
+	uint32_t clock_updates;
+	uint32_t clock_relocks;
+
+	/* hand TIME_SYNC, FILTER_SUMMARY, RSSI_TELEMETRY, TRACE and CLOCK_TRACK
+	 * packets to the callback too */
+	uint8_t meta_passthrough;
+
 	btbb_pcap_handle* h_pcap_bredr;
 	lell_pcap_handle* h_pcap_le;
 	btbb_pcapng_handle* h_pcapng_bredr;
@@ -76,6 +131,7 @@ void register_cleanup_handler(ubertooth_t* ut, int do_exit);
 ubertooth_t* ubertooth_init();
 int ubertooth_connect(ubertooth_t* ut, int ubertooth_device);
 ubertooth_t* ubertooth_start(int ubertooth_device);
+int ubertooth_count(void);
 void ubertooth_stop(ubertooth_t* ut);
 int ubertooth_get_api(ubertooth_t *ut, uint16_t *version);
 int ubertooth_check_api(ubertooth_t *ut);
@@ -96,5 +152,6 @@ void rx_afh(ubertooth_t* ut, btbb_piconet* pn, int timeout);
 void rx_afh_r(ubertooth_t* ut, btbb_piconet* pn, int timeout);
 
 void ubertooth_unpack_symbols(const uint8_t* buf, char* unpacked);
+int ubertooth_unpack_le(const usb_pkt_rx* rx, usb_pkt_rx* out, int max);
 
 #endif /* __UBERTOOTH_H__ */
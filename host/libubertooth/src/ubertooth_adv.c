@@ -0,0 +1,169 @@
+/*
+ * Copyright 2026 Great Scott Gadgets
+ *
+ * This file is part of Project Ubertooth.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "ubertooth_adv.h"
+#include "ubertooth_bluetooth.h"
+#include "ubertooth_callback.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ADV_ACCESS_ADDRESS 0x8e89bed6
+
+adv_stats_t* adv_stats_init(void)
+{
+	return (adv_stats_t*)calloc(1, sizeof(adv_stats_t));
+}
+
+void adv_stats_free(adv_stats_t* stats)
+{
+	if (stats == NULL)
+		return;
+
+	free(stats->entries);
+	free(stats);
+}
+
+void adv_stats_reset(adv_stats_t* stats)
+{
+	stats->num_entries = 0;
+	stats->summaries = 0;
+}
+
+static adv_stats_entry_t* find_entry(adv_stats_t* stats, uint8_t type,
+                                     const uint8_t* adva, uint32_t hash)
+{
+	adv_stats_entry_t* e;
+	int i;
+
+	for (i = 0; i < stats->num_entries; i++) {
+		e = &stats->entries[i];
+		if (e->type == type && e->hash == hash && !memcmp(e->adva, adva, 6))
+			return e;
+	}
+
+	if (stats->num_entries == stats->max_entries) {
+		int max = stats->max_entries ? 2 * stats->max_entries : 64;
+		e = (adv_stats_entry_t*)realloc(stats->entries,
+		                                max * sizeof(adv_stats_entry_t));
+		if (e == NULL)
+			return NULL;
+		stats->entries = e;
+		stats->max_entries = max;
+	}
+
+	e = &stats->entries[stats->num_entries++];
+	memset(e, 0, sizeof(adv_stats_entry_t));
+	e->type = type;
+	memcpy(e->adva, adva, 6);
+	e->hash = hash;
+	e->rssi_min = INT8_MAX;
+	e->rssi_max = INT8_MIN;
+	return e;
+}
+
+static void add_seen(adv_stats_entry_t* e, uint64_t count, int8_t rssi_min,
+                     int8_t rssi_max, uint64_t first_ns, uint64_t last_ns)
+{
+	if (e->count == 0 || first_ns < e->first_ns)
+		e->first_ns = first_ns;
+	if (last_ns > e->last_ns)
+		e->last_ns = last_ns;
+	if (rssi_min < e->rssi_min)
+		e->rssi_min = rssi_min;
+	if (rssi_max > e->rssi_max)
+		e->rssi_max = rssi_max;
+	e->count += count;
+}
+
+/* Account for an LE_PACKET or ADV_SUMMARY packet. Anything else, including
+ * packets on data channels, is ignored. Returns 1 for an ADV_SUMMARY. */
+int adv_stats_add_packet(adv_stats_t* stats, ubertooth_t* ut,
+                         const usb_pkt_rx* rx)
+{
+	adv_stats_entry_t* e;
+	le_adv_entry_t rec;
+	const uint8_t* pdu = &rx->data[4];
+	uint32_t aa;
+	uint64_t ns;
+	int i, n;
+
+	if (rx->pkt_type == LE_PACKET) {
+		aa = rx->data[0] | (rx->data[1] << 8) | (rx->data[2] << 16)
+		     | ((uint32_t)rx->data[3] << 24);
+		if (aa != ADV_ACCESS_ADDRESS || !le_adv_dedupable(pdu))
+			return 0;
+
+		e = find_entry(stats, pdu[0] & 0x4f, pdu + 2, le_adv_hash(pdu));
+		if (e == NULL)
+			return 0;
+		ns = now_ns_from_clk100ns(ut, rx);
+		add_seen(e, 1, rx->rssi_max, rx->rssi_max, ns, ns);
+		e->forwarded++;
+		return 0;
+	}
+
+	if (rx->pkt_type != ADV_SUMMARY)
+		return 0;
+
+	/* record times are taken relative to the summary's own timestamp, so
+	 * that they do not upset rollover tracking in now_ns_from_clk100ns */
+	ns = now_ns_from_clk100ns(ut, rx);
+	n = rx->data[0];
+	if (n > ADV_SUMMARY_MAX)
+		n = ADV_SUMMARY_MAX;
+
+	for (i = 0; i < n; i++) {
+		le_adv_summary_unpack(&rx->data[1 + i * LE_ADV_SUMMARY_LEN], &rec);
+		e = find_entry(stats, rec.type, rec.adva, rec.hash);
+		if (e == NULL)
+			break;
+		add_seen(e, rec.count, rec.rssi_min, rec.rssi_max,
+		         ns + 100ll * bt_clk100ns_delta(rec.first_clk100ns,
+		                                         le32toh(rx->clk100ns)),
+		         ns + 100ll * bt_clk100ns_delta(rec.last_clk100ns,
+		                                         le32toh(rx->clk100ns)));
+	}
+	stats->summaries++;
+	return 1;
+}
+
+void adv_stats_print(const adv_stats_t* stats, FILE* out)
+{
+	const adv_stats_entry_t* e;
+	int i;
+
+	fprintf(out, "# advertisers %d, summaries %llu\n", stats->num_entries,
+	        (unsigned long long)stats->summaries);
+	for (i = 0; i < stats->num_entries; i++) {
+		e = &stats->entries[i];
+		fprintf(out, "%02x:%02x:%02x:%02x:%02x:%02x, type %u%s, hash %08x, "
+		        "count %llu, forwarded %llu, rssi %d..%d, span %.3f s\n",
+		        e->adva[5], e->adva[4], e->adva[3],
+		        e->adva[2], e->adva[1], e->adva[0],
+		        e->type & 0x0f, (e->type & 0x40) ? " random" : "", e->hash,
+		        (unsigned long long)e->count,
+		        (unsigned long long)e->forwarded,
+		        cc2400_rssi_to_dbm(e->rssi_min),
+		        cc2400_rssi_to_dbm(e->rssi_max),
+		        (e->last_ns - e->first_ns) / 1e9);
+	}
+	fflush(out);
+}
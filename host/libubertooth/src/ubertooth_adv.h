@@ -0,0 +1,60 @@
+/*
+ * Copyright 2026 Great Scott Gadgets
+ *
+ * This file is part of Project Ubertooth.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __UBERTOOTH_ADV_H__
+#define __UBERTOOTH_ADV_H__
+
+#include <stdio.h>
+#include "ubertooth.h"
+
+/* Per-advertiser statistics from LE advertising packets and the ADV_SUMMARY
+ * packets that replace their repeats when UBERTOOTH_ADV_DEDUP is enabled.
+ * An advertiser is one PDU type, AdvA and payload, as in le_adv_hash(). */
+
+typedef struct {
+	uint8_t type;           /* header byte 0 & 0x4f */
+	uint8_t adva[6];        /* as sent, least significant byte first */
+	uint32_t hash;
+
+	uint64_t count;         /* forwarded packets and summarised repeats */
+	uint64_t forwarded;
+	int8_t rssi_min;        /* raw CC2400 readings */
+	int8_t rssi_max;
+	uint64_t first_ns;
+	uint64_t last_ns;
+} adv_stats_entry_t;
+
+typedef struct {
+	adv_stats_entry_t* entries;
+	int num_entries;
+	int max_entries;
+	uint64_t summaries;
+} adv_stats_t;
+
+adv_stats_t* adv_stats_init(void);
+void adv_stats_free(adv_stats_t* stats);
+void adv_stats_reset(adv_stats_t* stats);
+
+int adv_stats_add_packet(adv_stats_t* stats, ubertooth_t* ut,
+                         const usb_pkt_rx* rx);
+void adv_stats_print(const adv_stats_t* stats, FILE* out);
+
+#endif /* __UBERTOOTH_ADV_H__ */
@@ -0,0 +1,1235 @@
+/*
+ * Copyright 2026 Great Scott Gadgets
+ *
+ * This file is part of Project Ubertooth.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* This file is also built into the firmware, keep it free of libc
+ * dependencies beyond the freestanding headers. */
+
+#include <stddef.h>
+#include "ubertooth_bluetooth.h"
+
+/* recip(BT_NUM_CHANNELS) */
+#define BT_RECIP_79 54366675UL
+
+// divide, rounding to the nearest integer: round up at 0.5.
+#define DIVIDE_ROUND(N, D) (((N) + (D)/2) / (D))
+
+const uint8_t le_whitening[127] = {
+	1, 1, 1, 1, 0, 1, 0, 1, 0, 1, 0, 0, 0, 0, 1, 0, 1, 1, 0, 1, 1, 1,
+	1, 0, 0, 1, 1, 1, 0, 0, 1, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 0, 0, 0,
+	0, 1, 1, 0, 1, 1, 0, 1, 0, 1, 1, 1, 0, 1, 0, 0, 0, 1, 1, 0, 0, 1,
+	0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 0, 0, 1, 1, 0, 1, 0, 0,
+	1, 1, 1, 1, 0, 1, 1, 1, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0,
+	1, 1, 1, 0, 1, 1, 0, 0, 0, 1, 0, 1, 0, 0, 1, 0, 1
+};
+
+const uint8_t le_whitening_index[LE_NUM_CHANNELS] = {
+	70, 62, 120, 111, 77, 46, 15, 101, 66, 39, 31, 26, 80,
+	83, 125, 89, 10, 35, 8, 54, 122, 17, 33, 0, 58, 115, 6,
+	94, 86, 49, 52, 20, 40, 27, 84, 90, 63, 112, 47, 102
+};
+
+const uint32_t le_crc_lut[256] = {
+	0x000000, 0x01b4c0, 0x036980, 0x02dd40, 0x06d300, 0x0767c0, 0x05ba80, 0x040e40,
+	0x0da600, 0x0c12c0, 0x0ecf80, 0x0f7b40, 0x0b7500, 0x0ac1c0, 0x081c80, 0x09a840,
+	0x1b4c00, 0x1af8c0, 0x182580, 0x199140, 0x1d9f00, 0x1c2bc0, 0x1ef680, 0x1f4240,
+	0x16ea00, 0x175ec0, 0x158380, 0x143740, 0x103900, 0x118dc0, 0x135080, 0x12e440,
+	0x369800, 0x372cc0, 0x35f180, 0x344540, 0x304b00, 0x31ffc0, 0x332280, 0x329640,
+	0x3b3e00, 0x3a8ac0, 0x385780, 0x39e340, 0x3ded00, 0x3c59c0, 0x3e8480, 0x3f3040,
+	0x2dd400, 0x2c60c0, 0x2ebd80, 0x2f0940, 0x2b0700, 0x2ab3c0, 0x286e80, 0x29da40,
+	0x207200, 0x21c6c0, 0x231b80, 0x22af40, 0x26a100, 0x2715c0, 0x25c880, 0x247c40,
+	0x6d3000, 0x6c84c0, 0x6e5980, 0x6fed40, 0x6be300, 0x6a57c0, 0x688a80, 0x693e40,
+	0x609600, 0x6122c0, 0x63ff80, 0x624b40, 0x664500, 0x67f1c0, 0x652c80, 0x649840,
+	0x767c00, 0x77c8c0, 0x751580, 0x74a140, 0x70af00, 0x711bc0, 0x73c680, 0x727240,
+	0x7bda00, 0x7a6ec0, 0x78b380, 0x790740, 0x7d0900, 0x7cbdc0, 0x7e6080, 0x7fd440,
+	0x5ba800, 0x5a1cc0, 0x58c180, 0x597540, 0x5d7b00, 0x5ccfc0, 0x5e1280, 0x5fa640,
+	0x560e00, 0x57bac0, 0x556780, 0x54d340, 0x50dd00, 0x5169c0, 0x53b480, 0x520040,
+	0x40e400, 0x4150c0, 0x438d80, 0x423940, 0x463700, 0x4783c0, 0x455e80, 0x44ea40,
+	0x4d4200, 0x4cf6c0, 0x4e2b80, 0x4f9f40, 0x4b9100, 0x4a25c0, 0x48f880, 0x494c40,
+	0xda6000, 0xdbd4c0, 0xd90980, 0xd8bd40, 0xdcb300, 0xdd07c0, 0xdfda80, 0xde6e40,
+	0xd7c600, 0xd672c0, 0xd4af80, 0xd51b40, 0xd11500, 0xd0a1c0, 0xd27c80, 0xd3c840,
+	0xc12c00, 0xc098c0, 0xc24580, 0xc3f140, 0xc7ff00, 0xc64bc0, 0xc49680, 0xc52240,
+	0xcc8a00, 0xcd3ec0, 0xcfe380, 0xce5740, 0xca5900, 0xcbedc0, 0xc93080, 0xc88440,
+	0xecf800, 0xed4cc0, 0xef9180, 0xee2540, 0xea2b00, 0xeb9fc0, 0xe94280, 0xe8f640,
+	0xe15e00, 0xe0eac0, 0xe23780, 0xe38340, 0xe78d00, 0xe639c0, 0xe4e480, 0xe55040,
+	0xf7b400, 0xf600c0, 0xf4dd80, 0xf56940, 0xf16700, 0xf0d3c0, 0xf20e80, 0xf3ba40,
+	0xfa1200, 0xfba6c0, 0xf97b80, 0xf8cf40, 0xfcc100, 0xfd75c0, 0xffa880, 0xfe1c40,
+	0xb75000, 0xb6e4c0, 0xb43980, 0xb58d40, 0xb18300, 0xb037c0, 0xb2ea80, 0xb35e40,
+	0xbaf600, 0xbb42c0, 0xb99f80, 0xb82b40, 0xbc2500, 0xbd91c0, 0xbf4c80, 0xbef840,
+	0xac1c00, 0xada8c0, 0xaf7580, 0xaec140, 0xaacf00, 0xab7bc0, 0xa9a680, 0xa81240,
+	0xa1ba00, 0xa00ec0, 0xa2d380, 0xa36740, 0xa76900, 0xa6ddc0, 0xa40080, 0xa5b440,
+	0x81c800, 0x807cc0, 0x82a180, 0x831540, 0x871b00, 0x86afc0, 0x847280, 0x85c640,
+	0x8c6e00, 0x8ddac0, 0x8f0780, 0x8eb340, 0x8abd00, 0x8b09c0, 0x89d480, 0x886040,
+	0x9a8400, 0x9b30c0, 0x99ed80, 0x985940, 0x9c5700, 0x9de3c0, 0x9f3e80, 0x9e8a40,
+	0x972200, 0x9696c0, 0x944b80, 0x95ff40, 0x91f100, 0x9045c0, 0x929880, 0x932c40
+};
+
+const uint32_t le_whitening_word[LE_NUM_CHANNELS][12] = {
+	{ 0xc3bcb240, 0x5f4a371f, 0x9a9cf685, 0x44c5d6c1, 0xe1de5920, 0xafa51b8f,
+	  0xcd4e7b42, 0x2262eb60, 0xf0ef2c90, 0x57d28dc7, 0x66a73da1, 0x113175b0, },
+	{ 0xbcb24089, 0x4a371fc3, 0x9cf6855f, 0xc5d6c19a, 0xde592044, 0xa51b8fe1,
+	  0x4e7b42af, 0x62eb60cd, 0xef2c9022, 0xd28dc7f0, 0xa73da157, 0x3175b066, },
+	{ 0x3da157d2, 0x75b066a7, 0x96481131, 0x46e3f877, 0x9ed0abe9, 0xbad83353,
+	  0xcb240898, 0xa371fc3b, 0xcf6855f4, 0x5d6c19a9, 0xe592044c, 0x51b8fe1d, },
+	{ 0x42afa51b, 0x60cd4e7b, 0x902262eb, 0xc7f0ef2c, 0xa157d28d, 0xb066a73d,
+	  0x48113175, 0xe3f87796, 0xd0abe946, 0xd833539e, 0x240898ba, 0x71fc3bcb, },
+	{ 0x3f877964, 0x0abe946e, 0x833539ed, 0x40898bad, 0x1fc3bcb2, 0x855f4a37,
+	  0xc19a9cf6, 0x2044c5d6, 0x8fe1de59, 0x42afa51b, 0x60cd4e7b, 0x902262eb, },
+	{ 0x40898bad, 0x1fc3bcb2, 0x855f4a37, 0xc19a9cf6, 0x2044c5d6, 0x8fe1de59,
+	  0x42afa51b, 0x60cd4e7b, 0x902262eb, 0xc7f0ef2c, 0xa157d28d, 0xb066a73d, },
+	{ 0xc19a9cf6, 0x2044c5d6, 0x8fe1de59, 0x42afa51b, 0x60cd4e7b, 0x902262eb,
+	  0xc7f0ef2c, 0xa157d28d, 0xb066a73d, 0x48113175, 0xe3f87796, 0xd0abe946, },
+	{ 0xbe946e3f, 0x3539ed0a, 0x898bad83, 0xc3bcb240, 0x5f4a371f, 0x9a9cf685,
+	  0x44c5d6c1, 0xe1de5920, 0xafa51b8f, 0xcd4e7b42, 0x2262eb60, 0xf0ef2c90, },
+	{ 0x3bcb2408, 0xf4a371fc, 0xa9cf6855, 0x4c5d6c19, 0x1de59204, 0xfa51b8fe,
+	  0xd4e7b42a, 0x262eb60c, 0x0ef2c902, 0x7d28dc7f, 0x6a73da15, 0x13175b06, },
+	{ 0x44c5d6c1, 0xe1de5920, 0xafa51b8f, 0xcd4e7b42, 0x2262eb60, 0xf0ef2c90,
+	  0x57d28dc7, 0x66a73da1, 0x113175b0, 0xf8779648, 0xabe946e3, 0x33539ed0, },
+	{ 0xc5d6c19a, 0xde592044, 0xa51b8fe1, 0x4e7b42af, 0x62eb60cd, 0xef2c9022,
+	  0xd28dc7f0, 0xa73da157, 0x3175b066, 0x77964811, 0xe946e3f8, 0x539ed0ab, },
+	{ 0xbad83353, 0xcb240898, 0xa371fc3b, 0xcf6855f4, 0x5d6c19a9, 0xe592044c,
+	  0x51b8fe1d, 0xe7b42afa, 0x2eb60cd4, 0xf2c90226, 0x28dc7f0e, 0x73da157d, },
+	{ 0xc7f0ef2c, 0xa157d28d, 0xb066a73d, 0x48113175, 0xe3f87796, 0xd0abe946,
+	  0xd833539e, 0x240898ba, 0x71fc3bcb, 0x6855f4a3, 0x6c19a9cf, 0x92044c5d, },
+	{ 0xb8fe1de5, 0xb42afa51, 0xb60cd4e7, 0xc902262e, 0xdc7f0ef2, 0xda157d28,
+	  0x5b066a73, 0x64811317, 0x6e3f8779, 0xed0abe94, 0xad833539, 0xb240898b, },
+	{ 0x39ed0abe, 0x8bad8335, 0xbcb24089, 0x4a371fc3, 0x9cf6855f, 0xc5d6c19a,
+	  0xde592044, 0xa51b8fe1, 0x4e7b42af, 0x62eb60cd, 0xef2c9022, 0xd28dc7f0, },
+	{ 0x46e3f877, 0x9ed0abe9, 0xbad83353, 0xcb240898, 0xa371fc3b, 0xcf6855f4,
+	  0x5d6c19a9, 0xe592044c, 0x51b8fe1d, 0xe7b42afa, 0x2eb60cd4, 0xf2c90226, },
+	{ 0x33539ed0, 0x0898bad8, 0xfc3bcb24, 0x55f4a371, 0x19a9cf68, 0x044c5d6c,
+	  0xfe1de592, 0x2afa51b8, 0x0cd4e7b4, 0x02262eb6, 0x7f0ef2c9, 0x157d28dc, },
+	{ 0x4c5d6c19, 0x1de59204, 0xfa51b8fe, 0xd4e7b42a, 0x262eb60c, 0x0ef2c902,
+	  0x7d28dc7f, 0x6a73da15, 0x13175b06, 0x87796481, 0xbe946e3f, 0x3539ed0a, },
+	{ 0xcd4e7b42, 0x2262eb60, 0xf0ef2c90, 0x57d28dc7, 0x66a73da1, 0x113175b0,
+	  0xf8779648, 0xabe946e3, 0x33539ed0, 0x0898bad8, 0xfc3bcb24, 0x55f4a371, },
+	{ 0xb240898b, 0x371fc3bc, 0xf6855f4a, 0xd6c19a9c, 0x592044c5, 0x1b8fe1de,
+	  0x7b42afa5, 0xeb60cd4e, 0x2c902262, 0x8dc7f0ef, 0x3da157d2, 0x75b066a7, },
+	{ 0xcf6855f4, 0x5d6c19a9, 0xe592044c, 0x51b8fe1d, 0xe7b42afa, 0x2eb60cd4,
+	  0xf2c90226, 0x28dc7f0e, 0x73da157d, 0x175b066a, 0x79648113, 0x946e3f87, },
+	{ 0xb066a73d, 0x48113175, 0xe3f87796, 0xd0abe946, 0xd833539e, 0x240898ba,
+	  0x71fc3bcb, 0x6855f4a3, 0x6c19a9cf, 0x92044c5d, 0xb8fe1de5, 0xb42afa51, },
+	{ 0x3175b066, 0x77964811, 0xe946e3f8, 0x539ed0ab, 0x98bad833, 0x3bcb2408,
+	  0xf4a371fc, 0xa9cf6855, 0x4c5d6c19, 0x1de59204, 0xfa51b8fe, 0xd4e7b42a, },
+	{ 0x4e7b42af, 0x62eb60cd, 0xef2c9022, 0xd28dc7f0, 0xa73da157, 0x3175b066,
+	  0x77964811, 0xe946e3f8, 0x539ed0ab, 0x98bad833, 0x3bcb2408, 0xf4a371fc, },
+	{ 0xcb240898, 0xa371fc3b, 0xcf6855f4, 0x5d6c19a9, 0xe592044c, 0x51b8fe1d,
+	  0xe7b42afa, 0x2eb60cd4, 0xf2c90226, 0x28dc7f0e, 0x73da157d, 0x175b066a, },
+	{ 0xb42afa51, 0xb60cd4e7, 0xc902262e, 0xdc7f0ef2, 0xda157d28, 0x5b066a73,
+	  0x64811317, 0x6e3f8779, 0xed0abe94, 0xad833539, 0xb240898b, 0x371fc3bc, },
+	{ 0x3539ed0a, 0x898bad83, 0xc3bcb240, 0x5f4a371f, 0x9a9cf685, 0x44c5d6c1,
+	  0xe1de5920, 0xafa51b8f, 0xcd4e7b42, 0x2262eb60, 0xf0ef2c90, 0x57d28dc7, },
+	{ 0x4a371fc3, 0x9cf6855f, 0xc5d6c19a, 0xde592044, 0xa51b8fe1, 0x4e7b42af,
+	  0x62eb60cd, 0xef2c9022, 0xd28dc7f0, 0xa73da157, 0x3175b066, 0x77964811, },
+	{ 0x371fc3bc, 0xf6855f4a, 0xd6c19a9c, 0x592044c5, 0x1b8fe1de, 0x7b42afa5,
+	  0xeb60cd4e, 0x2c902262, 0x8dc7f0ef, 0x3da157d2, 0x75b066a7, 0x96481131, },
+	{ 0x48113175, 0xe3f87796, 0xd0abe946, 0xd833539e, 0x240898ba, 0x71fc3bcb,
+	  0x6855f4a3, 0x6c19a9cf, 0x92044c5d, 0xb8fe1de5, 0xb42afa51, 0xb60cd4e7, },
+	{ 0xc902262e, 0xdc7f0ef2, 0xda157d28, 0x5b066a73, 0x64811317, 0x6e3f8779,
+	  0xed0abe94, 0xad833539, 0xb240898b, 0x371fc3bc, 0xf6855f4a, 0xd6c19a9c, },
+	{ 0xb60cd4e7, 0xc902262e, 0xdc7f0ef2, 0xda157d28, 0x5b066a73, 0x64811317,
+	  0x6e3f8779, 0xed0abe94, 0xad833539, 0xb240898b, 0x371fc3bc, 0xf6855f4a, },
+	{ 0x2262eb60, 0xf0ef2c90, 0x57d28dc7, 0x66a73da1, 0x113175b0, 0xf8779648,
+	  0xabe946e3, 0x33539ed0, 0x0898bad8, 0xfc3bcb24, 0x55f4a371, 0x19a9cf68, },
+	{ 0x5d6c19a9, 0xe592044c, 0x51b8fe1d, 0xe7b42afa, 0x2eb60cd4, 0xf2c90226,
+	  0x28dc7f0e, 0x73da157d, 0x175b066a, 0x79648113, 0x946e3f87, 0x39ed0abe, },
+	{ 0xdc7f0ef2, 0xda157d28, 0x5b066a73, 0x64811317, 0x6e3f8779, 0xed0abe94,
+	  0xad833539, 0xb240898b, 0x371fc3bc, 0xf6855f4a, 0xd6c19a9c, 0x592044c5, },
+	{ 0xa371fc3b, 0xcf6855f4, 0x5d6c19a9, 0xe592044c, 0x51b8fe1d, 0xe7b42afa,
+	  0x2eb60cd4, 0xf2c90226, 0x28dc7f0e, 0x73da157d, 0x175b066a, 0x79648113, },
+	{ 0xde592044, 0xa51b8fe1, 0x4e7b42af, 0x62eb60cd, 0xef2c9022, 0xd28dc7f0,
+	  0xa73da157, 0x3175b066, 0x77964811, 0xe946e3f8, 0x539ed0ab, 0x98bad833, },
+	{ 0xa157d28d, 0xb066a73d, 0x48113175, 0xe3f87796, 0xd0abe946, 0xd833539e,
+	  0x240898ba, 0x71fc3bcb, 0x6855f4a3, 0x6c19a9cf, 0x92044c5d, 0xb8fe1de5, },
+	{ 0x2044c5d6, 0x8fe1de59, 0x42afa51b, 0x60cd4e7b, 0x902262eb, 0xc7f0ef2c,
+	  0xa157d28d, 0xb066a73d, 0x48113175, 0xe3f87796, 0xd0abe946, 0xd833539e, },
+	{ 0x5f4a371f, 0x9a9cf685, 0x44c5d6c1, 0xe1de5920, 0xafa51b8f, 0xcd4e7b42,
+	  0x2262eb60, 0xf0ef2c90, 0x57d28dc7, 0x66a73da1, 0x113175b0, 0xf8779648, },
+};
+
+/* number of 1 bits in each byte value */
+#define B2(n) n, n + 1, n + 1, n + 2
+#define B4(n) B2(n), B2(n + 1), B2(n + 1), B2(n + 2)
+#define B6(n) B4(n), B4(n + 1), B4(n + 1), B4(n + 2)
+static const uint8_t popcount8[256] = { B6(0), B6(1), B6(1), B6(2) };
+
+/* count the number of 1 bits in a uint64_t */
+uint8_t bt_count_bits(uint64_t n)
+{
+	uint32_t lo = (uint32_t)n, hi = (uint32_t)(n >> 32);
+
+	return popcount8[lo & 0xff] + popcount8[(lo >> 8) & 0xff] +
+	       popcount8[(lo >> 16) & 0xff] + popcount8[lo >> 24] +
+	       popcount8[hi & 0xff] + popcount8[(hi >> 8) & 0xff] +
+	       popcount8[(hi >> 16) & 0xff] + popcount8[hi >> 24];
+}
+
+/* ticks from earlier to later, allowing for one CLK100NS rollover */
+uint32_t bt_clk100ns_diff(uint32_t later, uint32_t earlier)
+{
+	if (later < earlier)
+		later += BT_CLK100NS_WRAP;
+	return later - earlier;
+}
+
+/* signed ticks from b to a, taking the shorter way around the CLK100NS wrap */
+int32_t bt_clk100ns_delta(uint32_t a, uint32_t b)
+{
+	uint32_t d = bt_clk100ns_diff(a, b);
+
+	if (d > BT_CLK100NS_WRAP / 2)
+		return (int32_t)d - (int32_t)BT_CLK100NS_WRAP;
+	return (int32_t)d;
+}
+
+/* Reciprocal for division-free x / d, exact for x < 2^25 and 2 <= d <= 79:
+ * the rounding error of m is at most d, so x * error stays under 2^32. */
+static uint32_t recip(uint32_t d)
+{
+	return (uint32_t)(0xffffffffUL / d) + 1;
+}
+
+static uint32_t mod_recip(uint32_t x, uint32_t d, uint32_t m)
+{
+	return x - (uint32_t)(((uint64_t)x * m) >> 32) * d;
+}
+
+/* Do all of the one time precalculation for a piconet. afh_map is the 10
+ * byte channel map, or NULL for the basic hop sequence. */
+void bt_hop_init(bt_hop_t* hop, uint32_t address, const uint8_t* afh_map)
+{
+	int i, j;
+	uint8_t chan;
+
+	/* populate frequency register bank*/
+	for (i = 0; i < BT_HOP_BANK_SIZE; i++)
+		hop->bank[i] = ((i * 2) % BT_NUM_CHANNELS);
+		/* actual frequency is 2402 + bank[i] MHz */
+
+	/* precalculate some of bt_hop_next()'s variables */
+	hop->a1 = (address >> 23) & 0x1f;
+	hop->b = (address >> 19) & 0x0f;
+	hop->c1 = ((address >> 4) & 0x10) +
+		((address >> 3) & 0x08) +
+		((address >> 2) & 0x04) +
+		((address >> 1) & 0x02) +
+		(address & 0x01);
+	hop->d1 = (address >> 10) & 0x1ff;
+	hop->e = ((address >> 7) & 0x40) +
+		((address >> 6) & 0x20) +
+		((address >> 5) & 0x10) +
+		((address >> 4) & 0x08) +
+		((address >> 3) & 0x04) +
+		((address >> 2) & 0x02) +
+		((address >> 1) & 0x01);
+
+	hop->afh = 0;
+	hop->used_channels = 0;
+	hop->afh_recip = 0;
+	if (afh_map) {
+		for (i = 0; i < 10; i++)
+			hop->used_channels += bt_count_bits((uint64_t) afh_map[i]);
+		j = 0;
+		for (i = 0; i < BT_NUM_CHANNELS; i++) {
+			chan = (i * 2) % BT_NUM_CHANNELS;
+			if (afh_map[chan/8] & (0x1 << (chan % 8)))
+				hop->afh_bank[j++] = chan;
+		}
+		if (hop->used_channels > 0) {
+			for (; j < BT_HOP_BANK_SIZE; j++)
+				hop->afh_bank[j] = hop->afh_bank[j - hop->used_channels];
+			if (hop->used_channels > 1)
+				hop->afh_recip = recip(hop->used_channels);
+			hop->afh = 1;
+		}
+	}
+}
+
+/* The 14 butterflies of PERM5 are split into three groups by their control
+ * bits, each group tabulated for every 5 bit input. */
+/* butterflies 13-9, controlled by p_high */
+static const uint8_t perm5_high[32][32] = {
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+	  16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, },
+	{  0,  8,  2, 10,  4, 12,  6, 14,  1,  9,  3, 11,  5, 13,  7, 15,
+	  16, 24, 18, 26, 20, 28, 22, 30, 17, 25, 19, 27, 21, 29, 23, 31, },
+	{  0,  1,  2,  3, 16, 17, 18, 19,  8,  9, 10, 11, 24, 25, 26, 27,
+	   4,  5,  6,  7, 20, 21, 22, 23, 12, 13, 14, 15, 28, 29, 30, 31, },
+	{  0,  8,  2, 10, 16, 24, 18, 26,  1,  9,  3, 11, 17, 25, 19, 27,
+	   4, 12,  6, 14, 20, 28, 22, 30,  5, 13,  7, 15, 21, 29, 23, 31, },
+	{  0,  1,  8,  9,  4,  5, 12, 13,  2,  3, 10, 11,  6,  7, 14, 15,
+	  16, 17, 24, 25, 20, 21, 28, 29, 18, 19, 26, 27, 22, 23, 30, 31, },
+	{  0,  8,  1,  9,  4, 12,  5, 13,  2, 10,  3, 11,  6, 14,  7, 15,
+	  16, 24, 17, 25, 20, 28, 21, 29, 18, 26, 19, 27, 22, 30, 23, 31, },
+	{  0,  1,  8,  9, 16, 17, 24, 25,  2,  3, 10, 11, 18, 19, 26, 27,
+	   4,  5, 12, 13, 20, 21, 28, 29,  6,  7, 14, 15, 22, 23, 30, 31, },
+	{  0,  8,  1,  9, 16, 24, 17, 25,  2, 10,  3, 11, 18, 26, 19, 27,
+	   4, 12,  5, 13, 20, 28, 21, 29,  6, 14,  7, 15, 22, 30, 23, 31, },
+	{  0,  8,  2, 10,  4, 12,  6, 14,  1,  9,  3, 11,  5, 13,  7, 15,
+	  16, 24, 18, 26, 20, 28, 22, 30, 17, 25, 19, 27, 21, 29, 23, 31, },
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+	  16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, },
+	{  0,  8,  2, 10, 16, 24, 18, 26,  1,  9,  3, 11, 17, 25, 19, 27,
+	   4, 12,  6, 14, 20, 28, 22, 30,  5, 13,  7, 15, 21, 29, 23, 31, },
+	{  0,  1,  2,  3, 16, 17, 18, 19,  8,  9, 10, 11, 24, 25, 26, 27,
+	   4,  5,  6,  7, 20, 21, 22, 23, 12, 13, 14, 15, 28, 29, 30, 31, },
+	{  0,  2,  8, 10,  4,  6, 12, 14,  1,  3,  9, 11,  5,  7, 13, 15,
+	  16, 18, 24, 26, 20, 22, 28, 30, 17, 19, 25, 27, 21, 23, 29, 31, },
+	{  0,  2,  1,  3,  4,  6,  5,  7,  8, 10,  9, 11, 12, 14, 13, 15,
+	  16, 18, 17, 19, 20, 22, 21, 23, 24, 26, 25, 27, 28, 30, 29, 31, },
+	{  0,  2,  8, 10, 16, 18, 24, 26,  1,  3,  9, 11, 17, 19, 25, 27,
+	   4,  6, 12, 14, 20, 22, 28, 30,  5,  7, 13, 15, 21, 23, 29, 31, },
+	{  0,  2,  1,  3, 16, 18, 17, 19,  8, 10,  9, 11, 24, 26, 25, 27,
+	   4,  6,  5,  7, 20, 22, 21, 23, 12, 14, 13, 15, 28, 30, 29, 31, },
+	{  0,  1,  4,  5,  2,  3,  6,  7,  8,  9, 12, 13, 10, 11, 14, 15,
+	  16, 17, 20, 21, 18, 19, 22, 23, 24, 25, 28, 29, 26, 27, 30, 31, },
+	{  0,  8,  4, 12,  2, 10,  6, 14,  1,  9,  5, 13,  3, 11,  7, 15,
+	  16, 24, 20, 28, 18, 26, 22, 30, 17, 25, 21, 29, 19, 27, 23, 31, },
+	{  0,  1, 16, 17,  2,  3, 18, 19,  8,  9, 24, 25, 10, 11, 26, 27,
+	   4,  5, 20, 21,  6,  7, 22, 23, 12, 13, 28, 29, 14, 15, 30, 31, },
+	{  0,  8, 16, 24,  2, 10, 18, 26,  1,  9, 17, 25,  3, 11, 19, 27,
+	   4, 12, 20, 28,  6, 14, 22, 30,  5, 13, 21, 29,  7, 15, 23, 31, },
+	{  0,  1,  4,  5,  8,  9, 12, 13,  2,  3,  6,  7, 10, 11, 14, 15,
+	  16, 17, 20, 21, 24, 25, 28, 29, 18, 19, 22, 23, 26, 27, 30, 31, },
+	{  0,  8,  4, 12,  1,  9,  5, 13,  2, 10,  6, 14,  3, 11,  7, 15,
+	  16, 24, 20, 28, 17, 25, 21, 29, 18, 26, 22, 30, 19, 27, 23, 31, },
+	{  0,  1, 16, 17,  8,  9, 24, 25,  2,  3, 18, 19, 10, 11, 26, 27,
+	   4,  5, 20, 21, 12, 13, 28, 29,  6,  7, 22, 23, 14, 15, 30, 31, },
+	{  0,  8, 16, 24,  1,  9, 17, 25,  2, 10, 18, 26,  3, 11, 19, 27,
+	   4, 12, 20, 28,  5, 13, 21, 29,  6, 14, 22, 30,  7, 15, 23, 31, },
+	{  0,  8,  4, 12,  2, 10,  6, 14,  1,  9,  5, 13,  3, 11,  7, 15,
+	  16, 24, 20, 28, 18, 26, 22, 30, 17, 25, 21, 29, 19, 27, 23, 31, },
+	{  0,  1,  4,  5,  2,  3,  6,  7,  8,  9, 12, 13, 10, 11, 14, 15,
+	  16, 17, 20, 21, 18, 19, 22, 23, 24, 25, 28, 29, 26, 27, 30, 31, },
+	{  0,  8, 16, 24,  2, 10, 18, 26,  1,  9, 17, 25,  3, 11, 19, 27,
+	   4, 12, 20, 28,  6, 14, 22, 30,  5, 13, 21, 29,  7, 15, 23, 31, },
+	{  0,  1, 16, 17,  2,  3, 18, 19,  8,  9, 24, 25, 10, 11, 26, 27,
+	   4,  5, 20, 21,  6,  7, 22, 23, 12, 13, 28, 29, 14, 15, 30, 31, },
+	{  0,  2,  4,  6,  8, 10, 12, 14,  1,  3,  5,  7,  9, 11, 13, 15,
+	  16, 18, 20, 22, 24, 26, 28, 30, 17, 19, 21, 23, 25, 27, 29, 31, },
+	{  0,  2,  4,  6,  1,  3,  5,  7,  8, 10, 12, 14,  9, 11, 13, 15,
+	  16, 18, 20, 22, 17, 19, 21, 23, 24, 26, 28, 30, 25, 27, 29, 31, },
+	{  0,  2, 16, 18,  8, 10, 24, 26,  1,  3, 17, 19,  9, 11, 25, 27,
+	   4,  6, 20, 22, 12, 14, 28, 30,  5,  7, 21, 23, 13, 15, 29, 31, },
+	{  0,  2, 16, 18,  1,  3, 17, 19,  8, 10, 24, 26,  9, 11, 25, 27,
+	   4,  6, 20, 22,  5,  7, 21, 23, 12, 14, 28, 30, 13, 15, 29, 31, },
+};
+
+/* butterflies 8-5, controlled by p_low bits 8-5 */
+static const uint8_t perm5_mid[16][32] = {
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+	  16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, },
+	{  0,  1,  8,  9,  4,  5, 12, 13,  2,  3, 10, 11,  6,  7, 14, 15,
+	  16, 17, 24, 25, 20, 21, 28, 29, 18, 19, 26, 27, 22, 23, 30, 31, },
+	{  0,  4,  2,  6,  1,  5,  3,  7,  8, 12, 10, 14,  9, 13, 11, 15,
+	  16, 20, 18, 22, 17, 21, 19, 23, 24, 28, 26, 30, 25, 29, 27, 31, },
+	{  0,  4,  8, 12,  1,  5,  9, 13,  2,  6, 10, 14,  3,  7, 11, 15,
+	  16, 20, 24, 28, 17, 21, 25, 29, 18, 22, 26, 30, 19, 23, 27, 31, },
+	{  0,  1,  2,  3,  4,  5,  6,  7, 16, 17, 18, 19, 20, 21, 22, 23,
+	   8,  9, 10, 11, 12, 13, 14, 15, 24, 25, 26, 27, 28, 29, 30, 31, },
+	{  0,  1,  8,  9,  4,  5, 12, 13, 16, 17, 24, 25, 20, 21, 28, 29,
+	   2,  3, 10, 11,  6,  7, 14, 15, 18, 19, 26, 27, 22, 23, 30, 31, },
+	{  0,  4,  2,  6,  1,  5,  3,  7, 16, 20, 18, 22, 17, 21, 19, 23,
+	   8, 12, 10, 14,  9, 13, 11, 15, 24, 28, 26, 30, 25, 29, 27, 31, },
+	{  0,  4,  8, 12,  1,  5,  9, 13, 16, 20, 24, 28, 17, 21, 25, 29,
+	   2,  6, 10, 14,  3,  7, 11, 15, 18, 22, 26, 30, 19, 23, 27, 31, },
+	{  0,  1, 16, 17,  4,  5, 20, 21,  8,  9, 24, 25, 12, 13, 28, 29,
+	   2,  3, 18, 19,  6,  7, 22, 23, 10, 11, 26, 27, 14, 15, 30, 31, },
+	{  0,  1, 16, 17,  4,  5, 20, 21,  2,  3, 18, 19,  6,  7, 22, 23,
+	   8,  9, 24, 25, 12, 13, 28, 29, 10, 11, 26, 27, 14, 15, 30, 31, },
+	{  0,  4, 16, 20,  1,  5, 17, 21,  8, 12, 24, 28,  9, 13, 25, 29,
+	   2,  6, 18, 22,  3,  7, 19, 23, 10, 14, 26, 30, 11, 15, 27, 31, },
+	{  0,  4, 16, 20,  1,  5, 17, 21,  2,  6, 18, 22,  3,  7, 19, 23,
+	   8, 12, 24, 28,  9, 13, 25, 29, 10, 14, 26, 30, 11, 15, 27, 31, },
+	{  0,  1,  8,  9,  4,  5, 12, 13, 16, 17, 24, 25, 20, 21, 28, 29,
+	   2,  3, 10, 11,  6,  7, 14, 15, 18, 19, 26, 27, 22, 23, 30, 31, },
+	{  0,  1,  2,  3,  4,  5,  6,  7, 16, 17, 18, 19, 20, 21, 22, 23,
+	   8,  9, 10, 11, 12, 13, 14, 15, 24, 25, 26, 27, 28, 29, 30, 31, },
+	{  0,  4,  8, 12,  1,  5,  9, 13, 16, 20, 24, 28, 17, 21, 25, 29,
+	   2,  6, 10, 14,  3,  7, 11, 15, 18, 22, 26, 30, 19, 23, 27, 31, },
+	{  0,  4,  2,  6,  1,  5,  3,  7, 16, 20, 18, 22, 17, 21, 19, 23,
+	   8, 12, 10, 14,  9, 13, 11, 15, 24, 28, 26, 30, 25, 29, 27, 31, },
+};
+
+/* butterflies 4-0, controlled by p_low bits 4-0 */
+static const uint8_t perm5_low[32][32] = {
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+	  16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, },
+	{  0,  2,  1,  3,  4,  6,  5,  7,  8, 10,  9, 11, 12, 14, 13, 15,
+	  16, 18, 17, 19, 20, 22, 21, 23, 24, 26, 25, 27, 28, 30, 29, 31, },
+	{  0,  1,  2,  3,  8,  9, 10, 11,  4,  5,  6,  7, 12, 13, 14, 15,
+	  16, 17, 18, 19, 24, 25, 26, 27, 20, 21, 22, 23, 28, 29, 30, 31, },
+	{  0,  2,  1,  3,  8, 10,  9, 11,  4,  6,  5,  7, 12, 14, 13, 15,
+	  16, 18, 17, 19, 24, 26, 25, 27, 20, 22, 21, 23, 28, 30, 29, 31, },
+	{  0,  1,  4,  5,  2,  3,  6,  7,  8,  9, 12, 13, 10, 11, 14, 15,
+	  16, 17, 20, 21, 18, 19, 22, 23, 24, 25, 28, 29, 26, 27, 30, 31, },
+	{  0,  2,  4,  6,  1,  3,  5,  7,  8, 10, 12, 14,  9, 11, 13, 15,
+	  16, 18, 20, 22, 17, 19, 21, 23, 24, 26, 28, 30, 25, 27, 29, 31, },
+	{  0,  1,  8,  9,  2,  3, 10, 11,  4,  5, 12, 13,  6,  7, 14, 15,
+	  16, 17, 24, 25, 18, 19, 26, 27, 20, 21, 28, 29, 22, 23, 30, 31, },
+	{  0,  2,  8, 10,  1,  3,  9, 11,  4,  6, 12, 14,  5,  7, 13, 15,
+	  16, 18, 24, 26, 17, 19, 25, 27, 20, 22, 28, 30, 21, 23, 29, 31, },
+	{  0,  1,  2,  3,  4,  5,  6,  7, 16, 17, 18, 19, 20, 21, 22, 23,
+	   8,  9, 10, 11, 12, 13, 14, 15, 24, 25, 26, 27, 28, 29, 30, 31, },
+	{  0,  2,  1,  3,  4,  6,  5,  7, 16, 18, 17, 19, 20, 22, 21, 23,
+	   8, 10,  9, 11, 12, 14, 13, 15, 24, 26, 25, 27, 28, 30, 29, 31, },
+	{  0,  1,  2,  3,  8,  9, 10, 11, 16, 17, 18, 19, 24, 25, 26, 27,
+	   4,  5,  6,  7, 12, 13, 14, 15, 20, 21, 22, 23, 28, 29, 30, 31, },
+	{  0,  2,  1,  3,  8, 10,  9, 11, 16, 18, 17, 19, 24, 26, 25, 27,
+	   4,  6,  5,  7, 12, 14, 13, 15, 20, 22, 21, 23, 28, 30, 29, 31, },
+	{  0,  1,  4,  5,  2,  3,  6,  7, 16, 17, 20, 21, 18, 19, 22, 23,
+	   8,  9, 12, 13, 10, 11, 14, 15, 24, 25, 28, 29, 26, 27, 30, 31, },
+	{  0,  2,  4,  6,  1,  3,  5,  7, 16, 18, 20, 22, 17, 19, 21, 23,
+	   8, 10, 12, 14,  9, 11, 13, 15, 24, 26, 28, 30, 25, 27, 29, 31, },
+	{  0,  1,  8,  9,  2,  3, 10, 11, 16, 17, 24, 25, 18, 19, 26, 27,
+	   4,  5, 12, 13,  6,  7, 14, 15, 20, 21, 28, 29, 22, 23, 30, 31, },
+	{  0,  2,  8, 10,  1,  3,  9, 11, 16, 18, 24, 26, 17, 19, 25, 27,
+	   4,  6, 12, 14,  5,  7, 13, 15, 20, 22, 28, 30, 21, 23, 29, 31, },
+	{  0, 16,  2, 18,  4, 20,  6, 22,  8, 24, 10, 26, 12, 28, 14, 30,
+	   1, 17,  3, 19,  5, 21,  7, 23,  9, 25, 11, 27, 13, 29, 15, 31, },
+	{  0, 16,  1, 17,  4, 20,  5, 21,  8, 24,  9, 25, 12, 28, 13, 29,
+	   2, 18,  3, 19,  6, 22,  7, 23, 10, 26, 11, 27, 14, 30, 15, 31, },
+	{  0, 16,  2, 18,  8, 24, 10, 26,  4, 20,  6, 22, 12, 28, 14, 30,
+	   1, 17,  3, 19,  9, 25, 11, 27,  5, 21,  7, 23, 13, 29, 15, 31, },
+	{  0, 16,  1, 17,  8, 24,  9, 25,  4, 20,  5, 21, 12, 28, 13, 29,
+	   2, 18,  3, 19, 10, 26, 11, 27,  6, 22,  7, 23, 14, 30, 15, 31, },
+	{  0, 16,  4, 20,  2, 18,  6, 22,  8, 24, 12, 28, 10, 26, 14, 30,
+	   1, 17,  5, 21,  3, 19,  7, 23,  9, 25, 13, 29, 11, 27, 15, 31, },
+	{  0, 16,  4, 20,  1, 17,  5, 21,  8, 24, 12, 28,  9, 25, 13, 29,
+	   2, 18,  6, 22,  3, 19,  7, 23, 10, 26, 14, 30, 11, 27, 15, 31, },
+	{  0, 16,  8, 24,  2, 18, 10, 26,  4, 20, 12, 28,  6, 22, 14, 30,
+	   1, 17,  9, 25,  3, 19, 11, 27,  5, 21, 13, 29,  7, 23, 15, 31, },
+	{  0, 16,  8, 24,  1, 17,  9, 25,  4, 20, 12, 28,  5, 21, 13, 29,
+	   2, 18, 10, 26,  3, 19, 11, 27,  6, 22, 14, 30,  7, 23, 15, 31, },
+	{  0,  8,  2, 10,  4, 12,  6, 14, 16, 24, 18, 26, 20, 28, 22, 30,
+	   1,  9,  3, 11,  5, 13,  7, 15, 17, 25, 19, 27, 21, 29, 23, 31, },
+	{  0,  8,  1,  9,  4, 12,  5, 13, 16, 24, 17, 25, 20, 28, 21, 29,
+	   2, 10,  3, 11,  6, 14,  7, 15, 18, 26, 19, 27, 22, 30, 23, 31, },
+	{  0,  4,  2,  6,  8, 12, 10, 14, 16, 20, 18, 22, 24, 28, 26, 30,
+	   1,  5,  3,  7,  9, 13, 11, 15, 17, 21, 19, 23, 25, 29, 27, 31, },
+	{  0,  4,  1,  5,  8, 12,  9, 13, 16, 20, 17, 21, 24, 28, 25, 29,
+	   2,  6,  3,  7, 10, 14, 11, 15, 18, 22, 19, 23, 26, 30, 27, 31, },
+	{  0,  8,  4, 12,  2, 10,  6, 14, 16, 24, 20, 28, 18, 26, 22, 30,
+	   1,  9,  5, 13,  3, 11,  7, 15, 17, 25, 21, 29, 19, 27, 23, 31, },
+	{  0,  8,  4, 12,  1,  9,  5, 13, 16, 24, 20, 28, 17, 25, 21, 29,
+	   2, 10,  6, 14,  3, 11,  7, 15, 18, 26, 22, 30, 19, 27, 23, 31, },
+	{  0,  4,  8, 12,  2,  6, 10, 14, 16, 20, 24, 28, 18, 22, 26, 30,
+	   1,  5,  9, 13,  3,  7, 11, 15, 17, 21, 25, 29, 19, 23, 27, 31, },
+	{  0,  4,  8, 12,  1,  5,  9, 13, 16, 20, 24, 28, 17, 21, 25, 29,
+	   2,  6, 10, 14,  3,  7, 11, 15, 18, 22, 26, 30, 19, 23, 27, 31, },
+};
+
+/* 5 bit permutation */
+uint8_t bt_perm5(uint8_t z, uint8_t p_high, uint16_t p_low)
+{
+	/* z is constrained to 5 bits, p_high to 5 bits, p_low to 9 bits */
+	z = perm5_high[p_high & 0x1f][z & 0x1f];
+	z = perm5_mid[(p_low >> 5) & 0x0f][z];
+	return perm5_low[p_low & 0x1f][z];
+}
+
+/* Channel in MHz for the given master clock */
+uint16_t bt_hop_next(const bt_hop_t* hop, uint32_t clock)
+{
+	uint8_t a, c, x, y1, perm;
+	uint16_t d, y2;
+	uint32_t base_f, f;
+
+	/* Variable names used in Vol 2, Part B, Section 2.6 of the spec */
+	x = (clock >> 2) & 0x1f;
+	y1 = (clock >> 1) & 0x01;
+	y2 = y1 << 5;
+	a = (hop->a1 ^ (clock >> 21)) & 0x1f;
+	/* b is already defined */
+	c = (hop->c1 ^ (clock >> 16)) & 0x1f;
+	d = (hop->d1 ^ (clock >> 7)) & 0x1ff;
+	/* e is already defined */
+	base_f = (clock >> 3) & 0x1fffff0;
+
+	perm = bt_perm5(
+		((x + a) & 0x1f) ^ hop->b,
+		(y1 * 0x1f) ^ c,
+		d);
+	/* hop selection, the final reduction is folded into the banks */
+	if (hop->afh) {
+		if (hop->used_channels == 1)
+			return 2402 + hop->afh_bank[0];
+		f = mod_recip(base_f, hop->used_channels, hop->afh_recip);
+		return 2402 + hop->afh_bank[perm + hop->e + f + y2];
+	}
+	f = mod_recip(base_f, BT_NUM_CHANNELS, BT_RECIP_79);
+	return 2402 + hop->bank[perm + hop->e + f + y2];
+}
+
+/* Fill channels[] with the hop sequence for clock, clock + clock_step, ...
+ * Use a clock_step of 2 for master to slave slots only, 1 for every slot
+ * half. Returns the number of channels written. */
+int bt_hop_sequence(const bt_hop_t* hop, uint32_t clock, uint32_t clock_step,
+                    uint16_t* channels, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++, clock += clock_step)
+		channels[i] = bt_hop_next(hop, clock);
+	return count;
+}
+
+void bt_ac_init(bt_ac_correlator_t* corr)
+{
+	corr->window = 0;
+	corr->bits = 0;
+}
+
+/* Feed len bytes of symbols (MSB first) through the correlator. Returns the
+ * position in buf just past the first access code with fewer than max_errs
+ * bit errors, so the code starts at the returned value minus 64 and may
+ * begin in the previous buffer. Returns -1 if there is none. The whole
+ * buffer is always consumed so that the window stays contiguous. */
+int bt_ac_search(bt_ac_correlator_t* corr, uint64_t target,
+                 const uint8_t* buf, int len, int max_errs)
+{
+	return bt_ac_search_set(corr, &target, 1, buf, len, max_errs, NULL);
+}
+
+/* As bt_ac_search(), for the first of n access codes to appear. If which is
+ * not NULL it is set to the index in targets of the one found. */
+int bt_ac_search_set(bt_ac_correlator_t* corr, const uint64_t* targets, int n,
+                     const uint8_t* buf, int len, int max_errs, int* which)
+{
+	uint64_t w = corr->window, v, x;
+	uint16_t hi;
+	uint8_t byte;
+	int i, k, t, found = -1;
+
+	for (i = 0; i < len; i++) {
+		byte = buf[i];
+
+		/* The eight windows ending in this byte are w shifted by k with
+		 * the top k bits of the byte appended. Most are rejected on the
+		 * errors in their top 16 bits alone. */
+		for (k = 1; k <= 8 && found < 0; k++) {
+			if (corr->bits + k < 64)
+				continue;
+			v = (w << k) | (byte >> (8 - k));
+			for (t = 0; t < n; t++) {
+				x = v ^ targets[t];
+				hi = x >> 48;
+				if (popcount8[hi >> 8] + popcount8[hi & 0xff] >= max_errs)
+					continue;
+				if (bt_count_bits(x) < max_errs) {
+					found = 8 * i + k;
+					if (which)
+						*which = t;
+					break;
+				}
+			}
+		}
+
+		w = (w << 8) | byte;
+		if (corr->bits < 64)
+			corr->bits += 8;
+	}
+
+	corr->window = w;
+	return found;
+}
+
+void bt_afh_learn_init(bt_afh_learn_t* learn, uint32_t max_age)
+{
+	int i;
+
+	for (i = 0; i < 10; i++) {
+		learn->map[i] = 0;
+		learn->changed[i] = 0;
+	}
+	for (i = 0; i < BT_NUM_CHANNELS; i++)
+		learn->last_seen[i] = 0;
+	learn->used = 0;
+	learn->hits = 0;
+	learn->max_age = max_age;
+}
+
+int bt_afh_learn_used(const bt_afh_learn_t* learn, uint8_t channel)
+{
+	if (channel >= BT_NUM_CHANNELS)
+		return 0;
+	return (learn->map[channel / 8] >> (channel % 8)) & 1;
+}
+
+/* Returns 1 if the channel changed state */
+static int afh_learn_set(bt_afh_learn_t* learn, uint8_t channel, int used)
+{
+	uint8_t bit = 1 << (channel % 8);
+
+	if (bt_afh_learn_used(learn, channel) == used)
+		return 0;
+
+	learn->map[channel / 8] ^= bit;
+	learn->changed[channel / 8] ^= bit;
+	if (used)
+		learn->used++;
+	else
+		learn->used--;
+	return 1;
+}
+
+/* Account for a hit on channel (0-78). With fill_gaps, an unused channel
+ * between two used ones is taken to be used but not yet visited. Returns
+ * non-zero if the map changed. */
+int bt_afh_learn_hit(bt_afh_learn_t* learn, uint8_t channel, int fill_gaps)
+{
+	int i, changed;
+
+	if (channel >= BT_NUM_CHANNELS)
+		return 0;
+
+	learn->hits++;
+	learn->last_seen[channel] = learn->hits;
+	changed = afh_learn_set(learn, channel, 1);
+
+	if (changed && fill_gaps) {
+		if (bt_afh_learn_used(learn, channel + 2)
+		    && afh_learn_set(learn, channel + 1, 1))
+			learn->last_seen[channel + 1] = learn->hits;
+		if (channel >= 2 && bt_afh_learn_used(learn, channel - 2)
+		    && afh_learn_set(learn, channel - 1, 1))
+			learn->last_seen[channel - 1] = learn->hits;
+	}
+
+	if (learn->max_age) {
+		for (i = 0; i < BT_NUM_CHANNELS; i++)
+			if (learn->hits - learn->last_seen[i] >= learn->max_age)
+				changed |= afh_learn_set(learn, i, 0);
+	}
+
+	return changed;
+}
+
+void bt_clock_track_init(bt_clock_track_t* ct, int32_t rate)
+{
+	ct->locked = 0;
+	ct->outliers = 0;
+	ct->last_clkn = 0;
+	ct->last_err = 0;
+	ct->rate = rate;
+	ct->rate_clkn = 0;
+	ct->trim_sum = 0;
+	ct->updates = 0;
+	ct->relocks = 0;
+}
+
+/* Feed a phase error measured at clkn into the loop. Returns the trim to
+ * apply to CLKN now in CLK100NS ticks, positive to delay it. ct->rate is
+ * the drift to take out continuously.
+ *
+ * The first error after (re)locking is trimmed in full. After that half
+ * of each error is trimmed, and every BT_CLOCK_TRACK_RATE_DT half of what
+ * was trimmed over the period goes into the rate. Errors are only known to
+ * within a symbol (10 ticks), but that noise mostly cancels out of the
+ * sum of the trims. */
+int32_t bt_clock_track_update(bt_clock_track_t* ct, int32_t err, uint32_t clkn)
+{
+	uint32_t dt;
+
+	if (!ct->locked) {
+		ct->locked = 1;
+		ct->outliers = 0;
+		ct->last_clkn = clkn;
+		ct->last_err = err;
+		ct->rate_clkn = clkn;
+		ct->trim_sum = 0;
+		ct->relocks++;
+		return err;
+	}
+
+	if (err > BT_CLOCK_TRACK_MAX_ERR || err < -BT_CLOCK_TRACK_MAX_ERR) {
+		if (++ct->outliers < BT_CLOCK_TRACK_RELOCK)
+			return 0;
+		ct->locked = 0;
+		return bt_clock_track_update(ct, err, clkn);
+	}
+	ct->outliers = 0;
+
+	dt = clkn - ct->last_clkn;
+	if (dt < BT_CLOCK_TRACK_MIN_DT)
+		return 0;
+
+	ct->last_clkn = clkn;
+	ct->last_err = err;
+	ct->updates++;
+
+	ct->trim_sum += err / 2;
+
+	dt = clkn - ct->rate_clkn;
+	if (dt >= BT_CLOCK_TRACK_RATE_DT) {
+		/* dt is at most a few seconds between packets, so this fits */
+		ct->rate += (int64_t)ct->trim_sum * BT_CLOCK_RATE_ONE / (int32_t)dt / 2;
+		if (ct->rate > BT_CLOCK_RATE_MAX)
+			ct->rate = BT_CLOCK_RATE_MAX;
+		if (ct->rate < -BT_CLOCK_RATE_MAX)
+			ct->rate = -BT_CLOCK_RATE_MAX;
+		ct->rate_clkn = clkn;
+		ct->trim_sum = 0;
+	}
+
+	return err / 2;
+}
+
+uint8_t le_channel_index(uint8_t channel)
+{
+	uint8_t idx;
+	channel /= 2;
+	if (channel == 0)
+		idx = 37;
+	else if (channel < 12)
+		idx = channel - 1;
+	else if (channel == 12)
+		idx = 38;
+	else if (channel < 39)
+		idx = channel - 2;
+	else
+		idx = 39;
+	return idx;
+}
+
+uint16_t le_channel_index_to_phys(uint8_t idx)
+{
+	uint16_t phys;
+	if (idx < 11)
+		phys = 2404 + 2 * idx;
+	else if (idx < 37)
+		phys = 2428 + 2 * (idx - 11);
+	else if (idx == 37)
+		phys = 2402;
+	else if (idx == 38)
+		phys = 2426;
+	else
+		phys = 2480;
+	return phys;
+}
+
+/* data channel index after one hop (channel selection algorithm #1) */
+uint8_t le_next_channel_index(uint8_t idx, uint8_t increment)
+{
+	return (idx + increment) % LE_NUM_DATA_CHANNELS;
+}
+
+// calculate CRC
+//	note 1: crc_init's bits should be in reverse order
+//	note 2: output bytes are in reverse order compared to wire
+//
+//		example output:
+//			0x6ff46e
+//
+//		bytes in packet will be:
+//		  { 0x6e, 0xf4, 0x6f }
+//
+uint32_t le_calc_crc(uint32_t crc_init, const uint8_t* data, int len)
+{
+	uint32_t state = crc_init & 0xffffff;
+	uint32_t lfsr_mask = 0x5a6000; // 010110100110000000000000
+	int i, j;
+
+	for (i = 0; i < len; ++i) {
+		uint8_t cur = data[i];
+		for (j = 0; j < 8; ++j) {
+			int next_bit = (state ^ cur) & 1;
+			cur >>= 1;
+			state >>= 1;
+			if (next_bit) {
+				state |= 1 << 23;
+				state ^= lfsr_mask;
+			}
+		}
+	}
+
+	return state;
+}
+
+// runs the CRC in reverse to generate a CRCInit
+//
+//	crc should be big endian
+//	the return will be big endian
+//
+uint32_t le_reverse_crc(uint32_t crc, const uint8_t* data, int len)
+{
+	uint32_t state = crc;
+	uint32_t lfsr_mask = 0xb4c000; // 101101001100000000000000
+	int i, j;
+
+	for (i = len - 1; i >= 0; --i) {
+		uint8_t cur = data[i];
+		for (j = 0; j < 8; ++j) {
+			int top_bit = state >> 23;
+			state = (state << 1) & 0xffffff;
+			state |= top_bit ^ ((cur >> (7 - j)) & 1);
+			if (top_bit)
+				state ^= lfsr_mask;
+		}
+	}
+
+	return le_reverse_bits24(state);
+}
+
+/*
+ * Calculate a BTLE CRC one byte at a time. Thanks to Dominic Spill and
+ * Michael Ossmann for writing and optimizing this.
+ *
+ * Arguments: CRCInit, pointer to start of packet, length of packet in
+ * bytes
+ * */
+uint32_t le_crcgen_lut(uint32_t crc_init, const uint8_t* data, int len)
+{
+	uint32_t state;
+	int i;
+	uint8_t key;
+
+	state = crc_init & 0xffffff;
+	for (i = 0; i < len; ++i) {
+		key = data[i] ^ (state & 0xff);
+		state = (state >> 8) ^ le_crc_lut[key];
+	}
+	return state;
+}
+
+/* reverse the order of the low 24 bits, e.g. CRCInit to the LFSR order */
+uint32_t le_reverse_bits24(uint32_t v)
+{
+	uint32_t ret = 0;
+	int i;
+
+	for (i = 0; i < 24; ++i)
+		ret |= ((v >> i) & 1) << (23 - i);
+	return ret;
+}
+
+static uint8_t reverse8(uint8_t b)
+{
+	return ((b * 0x0802UL & 0x22110UL) | (b * 0x8020UL & 0x88440UL))
+	       * 0x10101UL >> 16;
+}
+
+static uint16_t reverse16(uint16_t v)
+{
+	return (reverse8(v & 0xff) << 8) | reverse8(v >> 8);
+}
+
+/* 8 symbols starting at symbol position pos, MSB first */
+static uint8_t get_symbols8(const uint8_t* buf, int len, int pos)
+{
+	int i = pos >> 3, shift = pos & 7;
+	uint8_t hi, lo;
+
+	hi = i < len ? buf[i] : 0;
+	if (shift == 0)
+		return hi;
+	lo = i + 1 < len ? buf[i + 1] : 0;
+	return ((hi << shift) | (lo >> (8 - shift))) & 0xff;
+}
+
+/* empty data PDU header, LSB first: LLID 01, any NESN and SN, length 0 */
+#define EMPTY_PDU_HEADER 0x0001
+#define EMPTY_PDU_DONT_CARE 0x000c
+
+int le_find_empty_pdu(const uint8_t* buf, int start, int end,
+                      uint8_t channel_idx)
+{
+	uint16_t whit = le_whitening_word[channel_idx][0] & 0xffff;
+	/* pattern and mask in the order the symbols arrive */
+	uint16_t want = reverse16(EMPTY_PDU_HEADER ^ whit);
+	uint16_t mask = ~reverse16(EMPTY_PDU_DONT_CARE);
+	uint32_t w;
+	int i, k;
+
+	if (start >= end)
+		return -1;
+
+	/* Slide a 24 symbol window a byte at a time and test the eight 16
+	 * symbol candidates that start in its first byte. */
+	for (i = start & ~7; i < end; i += 8) {
+		w = (buf[i >> 3] << 16) | (buf[(i >> 3) + 1] << 8)
+		    | buf[(i >> 3) + 2];
+		for (k = 0; k < 8; k++) {
+			if (i + k < start || i + k >= end)
+				continue;
+			if ((((w >> (8 - k)) ^ want) & mask) == 0)
+				return i + k;
+		}
+	}
+
+	return -1;
+}
+
+void le_unwhiten(const uint8_t* buf, int len, int pdu, uint8_t channel_idx,
+                 uint8_t* out, int out_len)
+{
+	const uint32_t* whit = le_whitening_word[channel_idx];
+	int j;
+
+	for (j = 0; j < out_len; ++j) {
+		out[j] = reverse8(get_symbols8(buf, len, pdu - 32 + 8 * j));
+		if (j >= 4) // unwhiten data bytes
+			out[j] ^= whit[(j - 4) / 4] >> (8 * ((j - 4) % 4));
+	}
+}
+
+void le_aa_cache_init(le_aa_cache_t* cache)
+{
+	int i;
+
+	for (i = 0; i < LE_AA_CACHE_SIZE; i++) {
+		cache->entry[i].aa = 0;
+		cache->entry[i].last_seen = 0;
+		cache->entry[i].count = 0;
+	}
+	cache->tick = 0;
+}
+
+/* how much an entry is worth keeping */
+static uint16_t aa_score(const le_aa_cache_t* cache, const le_aa_entry_t* e)
+{
+	if (cache->tick - e->last_seen > LE_AA_CACHE_MAX_AGE)
+		return 0;
+	return e->count;
+}
+
+// called when we see an AA, returns how many times it has been seen
+int le_aa_cache_see(le_aa_cache_t* cache, uint32_t aa)
+{
+	le_aa_entry_t *e, *victim = NULL;
+	uint32_t slot = (aa * 2654435761UL) >> 26; /* Fibonacci hash, 6 bits */
+	int i;
+
+	cache->tick++;
+
+	for (i = 0; i < LE_AA_CACHE_PROBES; i++) {
+		e = &cache->entry[(slot + i) & (LE_AA_CACHE_SIZE - 1)];
+
+		/* slots only go from empty to used, so the AA is not further on */
+		if (e->count == 0) {
+			victim = e;
+			break;
+		}
+
+		if (e->aa == aa) {
+			if (e->count < 0xffff)
+				e->count++;
+			e->last_seen = cache->tick;
+			return e->count;
+		}
+
+		// evict the least seen, or the oldest of those
+		if (victim == NULL || aa_score(cache, e) < aa_score(cache, victim)
+		    || (aa_score(cache, e) == aa_score(cache, victim)
+		        && e->last_seen < victim->last_seen))
+			victim = e;
+	}
+
+	victim->aa = aa;
+	victim->count = 1;
+	victim->last_seen = cache->tick;
+	return 1;
+}
+
+/* Copy up to max of the most seen, live entries to out, best first.
+ * Returns the number copied. */
+int le_aa_cache_top(const le_aa_cache_t* cache, le_aa_entry_t* out, int max)
+{
+	int i, j, n = 0;
+	uint16_t score;
+
+	for (i = 0; i < LE_AA_CACHE_SIZE; i++) {
+		score = aa_score(cache, &cache->entry[i]);
+		if (score == 0)
+			continue;
+
+		/* insertion sort into the short output list */
+		for (j = n; j > 0 && out[j - 1].count < score; j--)
+			if (j < max)
+				out[j] = out[j - 1];
+		if (j < max) {
+			out[j] = cache->entry[i];
+			if (n < max)
+				n++;
+		}
+	}
+
+	return n;
+}
+
+/* Advertising PDUs worth deduplicating: ADV_IND, ADV_DIRECT_IND,
+ * ADV_NONCONN_IND, SCAN_RSP and ADV_SCAN_IND. SCAN_REQ and CONNECT_REQ are
+ * one-off events and always go through. pdu points at the header. */
+int le_adv_dedupable(const uint8_t* pdu)
+{
+	uint8_t type = pdu[0] & 0x0f;
+
+	if ((pdu[1] & 0x3f) < 6)
+		return 0;
+	return type == 0 || type == 1 || type == 2 || type == 4 || type == 6;
+}
+
+/* FNV-1a over the length and everything in the payload after AdvA */
+uint32_t le_adv_hash(const uint8_t* pdu)
+{
+	uint32_t h = 2166136261UL;
+	int i, len = pdu[1] & 0x3f;
+
+	h = (h ^ len) * 16777619UL;
+	for (i = 2 + 6; i < 2 + len; i++)
+		h = (h ^ pdu[i]) * 16777619UL;
+	return h;
+}
+
+void le_adv_cache_init(le_adv_cache_t* cache)
+{
+	int i;
+
+	for (i = 0; i < LE_ADV_CACHE_SIZE; i++) {
+		cache->entry[i].type = 0xff;
+		cache->entry[i].count = 0;
+	}
+	cache->tick = 0;
+}
+
+static int adva_equal(const uint8_t* a, const uint8_t* b)
+{
+	int i;
+
+	for (i = 0; i < 6; i++)
+		if (a[i] != b[i])
+			return 0;
+	return 1;
+}
+
+/* Look up a dedupable PDU, adding it if it is new. A repeat updates the
+ * entry's counts and returns LE_ADV_REPEAT. If adding it pushed out an
+ * entry with repeats not yet summarised, that entry is copied to evicted. */
+int le_adv_cache_see(le_adv_cache_t* cache, const uint8_t* pdu, int8_t rssi,
+                     uint32_t clk100ns, le_adv_entry_t* evicted)
+{
+	le_adv_entry_t *e, *victim = NULL;
+	uint8_t type = pdu[0] & 0x4f;
+	uint32_t hash = le_adv_hash(pdu);
+	int i, r = LE_ADV_NEW;
+
+	cache->tick++;
+
+	for (i = 0; i < LE_ADV_CACHE_SIZE; i++) {
+		e = &cache->entry[i];
+
+		if (e->type == 0xff) {
+			if (victim == NULL || victim->type != 0xff)
+				victim = e;
+			continue;
+		}
+
+		if (e->type == type && e->hash == hash && adva_equal(e->adva, pdu + 2)) {
+			if (e->count == 0) {
+				e->rssi_min = e->rssi_max = rssi;
+				e->first_clk100ns = clk100ns;
+			}
+			if (e->count < 0xffff)
+				e->count++;
+			if (rssi < e->rssi_min)
+				e->rssi_min = rssi;
+			if (rssi > e->rssi_max)
+				e->rssi_max = rssi;
+			e->last_clk100ns = clk100ns;
+			e->last_seen = cache->tick;
+			return LE_ADV_REPEAT;
+		}
+
+		if (victim == NULL || (victim->type != 0xff
+		                       && e->last_seen < victim->last_seen))
+			victim = e;
+	}
+
+	if (victim->type != 0xff && victim->count > 0) {
+		*evicted = *victim;
+		r = LE_ADV_NEW_EVICTED;
+	}
+
+	victim->type = type;
+	for (i = 0; i < 6; i++)
+		victim->adva[i] = pdu[2 + i];
+	victim->hash = hash;
+	victim->last_seen = cache->tick;
+	victim->count = 0;
+	return r;
+}
+
+static void put32(uint8_t* out, uint32_t v)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		out[i] = (v >> (8*i)) & 0xff;
+}
+
+static uint32_t get32(const uint8_t* in)
+{
+	return in[0] | in[1] << 8 | in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+/* Encode the repeats of an entry as an ADV_SUMMARY record */
+void le_adv_summary_pack(const le_adv_entry_t* e, uint8_t* out)
+{
+	int i;
+
+	out[0] = e->type;
+	for (i = 0; i < 6; i++)
+		out[1 + i] = e->adva[i];
+	put32(out + 7, e->hash);
+	out[11] = e->count & 0xff;
+	out[12] = (e->count >> 8) & 0xff;
+	out[13] = (uint8_t)e->rssi_min;
+	out[14] = (uint8_t)e->rssi_max;
+	put32(out + 15, e->first_clk100ns);
+	put32(out + 19, e->last_clk100ns);
+}
+
+void le_adv_summary_unpack(const uint8_t* in, le_adv_entry_t* e)
+{
+	int i;
+
+	e->type = in[0];
+	for (i = 0; i < 6; i++)
+		e->adva[i] = in[1 + i];
+	e->hash = get32(in + 7);
+	e->last_seen = 0;
+	e->count = in[11] | in[12] << 8;
+	e->rssi_min = (int8_t)in[13];
+	e->rssi_max = (int8_t)in[14];
+	e->first_clk100ns = get32(in + 15);
+	e->last_clk100ns = get32(in + 19);
+}
+
+void le_hop_solver_init(le_hop_solver_t* s)
+{
+	s->n = 0;
+	s->conn_interval = 0;
+	s->channel_increment = 0;
+}
+
+/* Feed the timestamp of a packet heard on data channel channel_idx. Returns
+ * 0 if it is from the same connection event as the last one, which says
+ * nothing new, and 1 if it was taken. When the table is full the oldest
+ * observation goes. */
+int le_hop_solver_add(le_hop_solver_t* s, uint32_t clk100ns,
+                      uint8_t channel_idx)
+{
+	int i;
+
+	if (s->n > 0
+	    && bt_clk100ns_diff(clk100ns, s->clk100ns[s->n - 1]) < 2 * LE_BASECLK)
+		return 0;
+
+	if (s->n == LE_HOP_SOLVER_OBS) {
+		for (i = 1; i < s->n; i++) {
+			s->clk100ns[i - 1] = s->clk100ns[i];
+			s->channel_idx[i - 1] = s->channel_idx[i];
+		}
+		s->n--;
+	}
+
+	s->clk100ns[s->n] = clk100ns;
+	s->channel_idx[s->n] = channel_idx;
+	s->n++;
+	return 1;
+}
+
+/* Does every observation fit conn_interval, putting in hops[j] the number
+ * of connection events from the first observation to the jth, mod 37? */
+static int le_hop_solver_fit(const le_hop_solver_t* s, uint16_t conn_interval,
+                             uint8_t* hops)
+{
+	uint32_t period = (uint32_t)conn_interval * LE_BASECLK;
+	uint32_t dt, events, err;
+	int j;
+
+	for (j = 1; j < s->n; j++) {
+		dt = bt_clk100ns_diff(s->clk100ns[j], s->clk100ns[0]);
+		events = DIVIDE_ROUND(dt, period);
+		if (events == 0)
+			return 0;
+		err = dt > events * period ? dt - events * period
+		                           : events * period - dt;
+		if (err > LE_HOP_SOLVER_TOL + dt / LE_HOP_SOLVER_DRIFT)
+			return 0;
+		hops[j] = events % LE_NUM_DATA_CHANNELS;
+	}
+	return 1;
+}
+
+/* Work through every interval and increment the observations allow,
+ * longest interval first. Returns 1 once there is a single answer, which is
+ * left in conn_interval and channel_increment, 2 while there are several
+ * or too few observations, and 0 if nothing fits. */
+int le_hop_solver_solve(le_hop_solver_t* s)
+{
+	uint8_t hops[LE_HOP_SOLVER_OBS];
+	uint16_t interval, best_interval = 0;
+	uint8_t inc, best_inc = 0, dc;
+	int j, found = 0;
+
+	for (interval = LE_CONN_INTERVAL_MAX; interval >= LE_CONN_INTERVAL_MIN;
+	     interval--) {
+		if (!le_hop_solver_fit(s, interval, hops))
+			continue;
+
+		for (inc = LE_HOP_INCREMENT_MIN; inc <= LE_HOP_INCREMENT_MAX; inc++) {
+			for (j = 1; j < s->n; j++) {
+				dc = (s->channel_idx[j] + LE_NUM_DATA_CHANNELS
+				      - s->channel_idx[0]) % LE_NUM_DATA_CHANNELS;
+				if ((hops[j] * inc) % LE_NUM_DATA_CHANNELS != dc)
+					break;
+			}
+			if (j < s->n)
+				continue;
+
+			/* interval / k hopping inc / k also fits whatever was
+			 * heard, so it is not a different answer. The reverse
+			 * cannot be told apart either: if every gap heard is a
+			 * multiple of k events, the answer is k times too long,
+			 * which more observations make unlikely but not
+			 * impossible. */
+			if (found && best_interval % interval == 0
+			    && (inc * (best_interval / interval))
+			       % LE_NUM_DATA_CHANNELS == best_inc)
+				continue;
+
+			if (found)
+				return 2;
+			found = 1;
+			best_interval = interval;
+			best_inc = inc;
+		}
+	}
+
+	if (!found)
+		return 0;
+	if (s->n < LE_HOP_SOLVER_MIN_OBS)
+		return 2;
+
+	s->conn_interval = best_interval;
+	s->channel_increment = best_inc;
+	return 1;
+}
@@ -0,0 +1,260 @@
+/*
+ * Copyright 2026 Great Scott Gadgets
+ *
+ * This file is part of Project Ubertooth.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Bluetooth algorithms shared by the firmware and libubertooth.
+ *
+ * Nothing in here may touch hardware or firmware globals: every function
+ * takes its state explicitly so that the same code runs on the LPC17xx
+ * and on the host. */
+
+#ifndef __UBERTOOTH_BLUETOOTH_H__
+#define __UBERTOOTH_BLUETOOTH_H__
+
+#include <stdint.h>
+
+#define BT_NUM_CHANNELS 79
+
+/* CLK100NS counts 100ns ticks and wraps at 3125 * 2^20 */
+#define BT_CLK100NS_WRAP 3276800000UL
+
+/* LE link layer timing unit in CLK100NS ticks (1.25 ms) */
+#define LE_BASECLK (12500)
+
+#define LE_NUM_CHANNELS 40
+#define LE_NUM_DATA_CHANNELS 37
+
+/* Largest value of perm + e + f + y2 in the hop selection adder, plus one.
+ * The register banks are unrolled to this length so that the final mod 79
+ * (or mod N for AFH) becomes a table lookup. */
+#define BT_HOP_BANK_SIZE (32 + 128 + BT_NUM_CHANNELS + 32)
+
+/* BR/EDR basic hop selection kernel, see Vol 2, Part B, Section 2.6 */
+typedef struct {
+	/* address derived inputs, constant for a piconet */
+	uint8_t a1, b, c1, e;
+	uint16_t d1;
+
+	/* frequency register bank, channel offsets from 2402 MHz,
+	 * bank[i] == bank[i % 79] */
+	uint8_t bank[BT_HOP_BANK_SIZE];
+
+	/* adapted hop set, only valid when afh is set,
+	 * afh_bank[i] == afh_bank[i % used_channels] */
+	int afh;
+	uint8_t used_channels;
+	uint32_t afh_recip;
+	uint8_t afh_bank[BT_HOP_BANK_SIZE];
+} bt_hop_t;
+
+uint8_t bt_count_bits(uint64_t n);
+uint32_t bt_clk100ns_diff(uint32_t later, uint32_t earlier);
+int32_t bt_clk100ns_delta(uint32_t a, uint32_t b);
+
+void bt_hop_init(bt_hop_t* hop, uint32_t address, const uint8_t* afh_map);
+uint8_t bt_perm5(uint8_t z, uint8_t p_high, uint16_t p_low);
+uint16_t bt_hop_next(const bt_hop_t* hop, uint32_t clock);
+int bt_hop_sequence(const bt_hop_t* hop, uint32_t clock, uint32_t clock_step,
+                    uint16_t* channels, int count);
+
+/* Sliding access code correlator. The window carries the last 64 symbols
+ * across calls, so an access code split over two buffers is still found. */
+typedef struct {
+	uint64_t window;
+	int bits;        /* valid symbols in window, saturates at 64 */
+} bt_ac_correlator_t;
+
+/* most access codes bt_ac_search_set() is meant for, each one costs about
+ * as much as a single bt_ac_search() */
+#define BT_AC_MAX_TARGETS 4
+
+void bt_ac_init(bt_ac_correlator_t* corr);
+int bt_ac_search(bt_ac_correlator_t* corr, uint64_t target,
+                 const uint8_t* buf, int len, int max_errs);
+int bt_ac_search_set(bt_ac_correlator_t* corr, const uint64_t* targets, int n,
+                     const uint8_t* buf, int len, int max_errs, int* which);
+
+/* AFH map learning from access code hits. A channel is used once the
+ * piconet is heard on it, and unused again after max_age hits on other
+ * channels with none of its own, never if max_age is 0. */
+typedef struct {
+	uint8_t map[10];            /* channel n is bit n % 8 of byte n / 8 */
+	uint8_t changed[10];        /* channels flipped, for the caller to clear */
+	uint8_t used;
+	uint32_t hits;
+	uint32_t max_age;
+	uint32_t last_seen[BT_NUM_CHANNELS];
+} bt_afh_learn_t;
+
+void bt_afh_learn_init(bt_afh_learn_t* learn, uint32_t max_age);
+int bt_afh_learn_used(const bt_afh_learn_t* learn, uint8_t channel);
+int bt_afh_learn_hit(bt_afh_learn_t* learn, uint8_t channel, int fill_gaps);
+
+/* Clock tracking while following a piconet. Each access code received
+ * gives the phase error of CLKN against the master's slots in CLK100NS
+ * ticks, positive when the local clock is ahead. A PI loop turns these
+ * into trims of CLKN and an estimate of how fast the local clock runs. */
+#define BT_CLOCK_TRACK_MIN_DT  32    /* CLKN periods between trims */
+#define BT_CLOCK_TRACK_RATE_DT 3200  /* CLKN periods between rate updates */
+#define BT_CLOCK_TRACK_MAX_ERR 1000  /* larger errors are outliers when locked */
+#define BT_CLOCK_TRACK_RELOCK  3     /* outliers in a row that force a relock */
+
+/* rate is in 2^-16 CLK100NS ticks per CLKN period */
+#define BT_CLOCK_RATE_ONE      0x10000
+#define BT_CLOCK_RATE_MAX      40960 /* 200 ppm */
+
+typedef struct {
+	int locked;
+	uint8_t outliers;
+	uint32_t last_clkn;
+	int32_t last_err;
+	int32_t rate;
+	uint32_t rate_clkn;         /* start of the current rate period */
+	int32_t trim_sum;           /* trimmed in the current rate period */
+	uint32_t updates;
+	uint32_t relocks;
+} bt_clock_track_t;
+
+void bt_clock_track_init(bt_clock_track_t* ct, int32_t rate);
+int32_t bt_clock_track_update(bt_clock_track_t* ct, int32_t err, uint32_t clkn);
+
+/* LE channel helpers */
+extern const uint8_t le_whitening[127];
+extern const uint8_t le_whitening_index[LE_NUM_CHANNELS];
+extern const uint32_t le_whitening_word[LE_NUM_CHANNELS][12];
+extern const uint32_t le_crc_lut[256];
+
+uint8_t le_channel_index(uint8_t channel);
+uint16_t le_channel_index_to_phys(uint8_t idx);
+uint8_t le_next_channel_index(uint8_t idx, uint8_t increment);
+
+uint32_t le_calc_crc(uint32_t crc_init, const uint8_t* data, int len);
+uint32_t le_reverse_crc(uint32_t crc, const uint8_t* data, int len);
+uint32_t le_crcgen_lut(uint32_t crc_init, const uint8_t* data, int len);
+uint32_t le_reverse_bits24(uint32_t v);
+
+/* LE promiscuous mode: connection discovery and parameter recovery */
+
+/* Search packed symbols (MSB first, as received) for a whitened empty data
+ * PDU starting at symbol positions start to end - 1. Returns the position
+ * of the PDU header, or -1. The caller must provide 16 symbols past end. */
+int le_find_empty_pdu(const uint8_t* buf, int start, int end,
+                      uint8_t channel_idx);
+
+/* Rebuild a packet starting with the 4 byte AA that precedes the PDU at
+ * symbol position pdu of the len byte buffer. Only the PDU bytes are
+ * dewhitened, symbols past the end read as 0. out_len is at most 4 + 48. */
+void le_unwhiten(const uint8_t* buf, int len, int pdu, uint8_t channel_idx,
+                 uint8_t* out, int out_len);
+
+/* Open-addressed table of recently seen access addresses. An AA is kept in
+ * one of LE_AA_CACHE_PROBES slots after its hash. When they are all taken
+ * the least seen one goes, and entries not seen for LE_AA_CACHE_MAX_AGE
+ * insertions count as unused. */
+#define LE_AA_CACHE_SIZE 64
+#define LE_AA_CACHE_PROBES 8
+#define LE_AA_CACHE_MAX_AGE 1024
+
+typedef struct {
+	uint32_t aa;
+	uint32_t last_seen;
+	uint16_t count;             /* 0 for an empty slot */
+} le_aa_entry_t;
+
+typedef struct {
+	le_aa_entry_t entry[LE_AA_CACHE_SIZE];
+	uint32_t tick;
+} le_aa_cache_t;
+
+void le_aa_cache_init(le_aa_cache_t* cache);
+int le_aa_cache_see(le_aa_cache_t* cache, uint32_t aa);
+int le_aa_cache_top(const le_aa_cache_t* cache, le_aa_entry_t* out, int max);
+
+/* Table of recently seen advertising PDUs for deduplication. A PDU is keyed
+ * by its type and TxAdd bits, AdvA and a hash of the rest of the payload.
+ * Repeats of a known PDU are only counted, and the counts are collected
+ * into summaries (see ADV_SUMMARY in ubertooth_interface.h). When the
+ * table is full the entry seen least recently goes. */
+#define LE_ADV_CACHE_SIZE 32
+
+/* an ADV_SUMMARY record on the wire */
+#define LE_ADV_SUMMARY_LEN 23
+
+typedef struct {
+	uint8_t type;               /* header byte 0 & 0x4f, 0xff for a free slot */
+	uint8_t adva[6];
+	uint32_t hash;
+	uint32_t last_seen;
+
+	/* repeats since the entry was last summarised */
+	uint16_t count;
+	int8_t rssi_min, rssi_max;
+	uint32_t first_clk100ns, last_clk100ns;
+} le_adv_entry_t;
+
+typedef struct {
+	le_adv_entry_t entry[LE_ADV_CACHE_SIZE];
+	uint32_t tick;
+} le_adv_cache_t;
+
+enum le_adv_result {
+	LE_ADV_NEW = 0,             /* forward the PDU */
+	LE_ADV_NEW_EVICTED = 1,     /* forward it, and summarise *evicted */
+	LE_ADV_REPEAT = 2,          /* counted, do not forward */
+};
+
+int le_adv_dedupable(const uint8_t* pdu);
+uint32_t le_adv_hash(const uint8_t* pdu);
+void le_adv_cache_init(le_adv_cache_t* cache);
+int le_adv_cache_see(le_adv_cache_t* cache, const uint8_t* pdu, int8_t rssi,
+                     uint32_t clk100ns, le_adv_entry_t* evicted);
+void le_adv_summary_pack(const le_adv_entry_t* e, uint8_t* out);
+void le_adv_summary_unpack(const uint8_t* in, le_adv_entry_t* e);
+
+/* Connection interval and hop increment recovery from the times at which a
+ * connection is heard on any data channels. A candidate interval must put a
+ * whole number of connection events, within the tolerance, between the
+ * first observation and each later one, and a candidate increment must get
+ * from the first channel to each later one in that many hops. Once the
+ * observations leave a single candidate, it is the answer. */
+#define LE_CONN_INTERVAL_MIN  6      /* 1.25 ms units */
+#define LE_CONN_INTERVAL_MAX  3200
+#define LE_HOP_INCREMENT_MIN  5
+#define LE_HOP_INCREMENT_MAX  16
+
+#define LE_HOP_SOLVER_OBS     16
+#define LE_HOP_SOLVER_MIN_OBS 5
+#define LE_HOP_SOLVER_TOL     5000   /* CLK100NS ticks, */
+#define LE_HOP_SOLVER_DRIFT   8192   /* plus this fraction of the time span */
+
+typedef struct {
+	uint32_t clk100ns[LE_HOP_SOLVER_OBS];
+	uint8_t channel_idx[LE_HOP_SOLVER_OBS];
+	int n;
+	uint16_t conn_interval;     /* the answer, in 1.25 ms units */
+	uint8_t channel_increment;
+} le_hop_solver_t;
+
+void le_hop_solver_init(le_hop_solver_t* s);
+int le_hop_solver_add(le_hop_solver_t* s, uint32_t clk100ns,
+                      uint8_t channel_idx);
+int le_hop_solver_solve(le_hop_solver_t* s);
+
+#endif /* __UBERTOOTH_BLUETOOTH_H__ */
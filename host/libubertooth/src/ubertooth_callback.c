@@ -26,10 +26,11 @@
 #include <unistd.h>
 
 #include "ubertooth_callback.h"
+#include "ubertooth_bluetooth.h"
 
 unsigned int packet_counter_max;
 
-static int8_t cc2400_rssi_to_dbm( const int8_t rssi )
+int8_t cc2400_rssi_to_dbm( const int8_t rssi )
 {
 	/* models the cc2400 datasheet fig 22 for 1M as piece-wise linear */
 	if (rssi < -48) {
@@ -116,12 +117,147 @@ static void track_clk100ns( ubertooth_t* ut, const usb_pkt_rx* rx )
 	ut->last_clk100ns = rx->clk100ns;
 }
 
-static uint64_t now_ns_from_clk100ns( ubertooth_t* ut, const usb_pkt_rx* rx )
+/* Take the device tick from a TIME_SYNC packet. Returns 0 for any other
+ * packet type. */
+int ubertooth_time_sync( ubertooth_t* ut, const usb_pkt_rx* rx )
 {
-	track_clk100ns( ut, rx );
-	return ut->abs_start_ns +
-	       100ull*(uint64_t)((rx->clk100ns - ut->start_clk100ns) & 0xffffffff) +
-	       ((100ull*ut->clk100ns_upper)<<32);
+	uint64_t tick = 0;
+	int i;
+
+	if (rx->pkt_type != TIME_SYNC)
+		return 0;
+
+	for (i = 0; i < 8; i++)
+		tick |= (uint64_t)rx->data[i] << (8*i);
+
+	ut->sync_tick = tick;
+	ut->sync_clk100ns = le32toh(rx->clk100ns);
+	ut->time_synced = 1;
+	return 1;
+}
+
+/* Take the counts from a FILTER_SUMMARY packet. Returns 0 for any other
+ * packet type. */
+int ubertooth_filter_summary( ubertooth_t* ut, const usb_pkt_rx* rx )
+{
+	if (rx->pkt_type != FILTER_SUMMARY)
+		return 0;
+
+	ut->filter_passed = le32toh(*(uint32_t*)&rx->data[0]);
+	ut->filter_dropped = le32toh(*(uint32_t*)&rx->data[4]);
+	fprintf(stderr, "on-device filter: %u passed, %u dropped\n",
+	        ut->filter_passed, ut->filter_dropped);
+	return 1;
+}
+
+/* Fold an RSSI_TELEMETRY packet into the channel quality map. Returns 0 for
+ * any other packet type. */
+int ubertooth_rssi_telemetry( ubertooth_t* ut, const usb_pkt_rx* rx )
+{
+	channel_quality_t* q;
+	const uint8_t* e;
+	int i, n;
+
+	if (rx->pkt_type != RSSI_TELEMETRY)
+		return 0;
+
+	n = rx->data[0];
+	if (n > RSSI_TELEMETRY_MAX)
+		n = RSSI_TELEMETRY_MAX;
+
+	for (i = 0; i < n; i++) {
+		e = &rx->data[2 + 4 * i];
+		if (e[0] >= NUM_BREDR_CHANNELS)
+			continue;
+		q = &ut->channel_quality[e[0]];
+		q->rssi_avg = cc2400_rssi_to_dbm((int8_t)e[1]);
+		q->noise_floor = cc2400_rssi_to_dbm((int8_t)e[2]);
+		q->cs_triggers += e[3];
+		q->report = ut->channel_reports + 1;
+	}
+
+	if (rx->data[1] & RSSI_TELEMETRY_LAST) {
+		ut->channel_reports++;
+		if (ut->print_channel_quality)
+			ubertooth_print_channel_quality( ut, stderr );
+	}
+	return 1;
+}
+
+/* Hand a TRACE packet to ut->trace, if there is one. Returns 0 for any other
+ * packet type. */
+int ubertooth_trace_receive( ubertooth_t* ut, const usb_pkt_rx* rx )
+{
+	if (rx->pkt_type != TRACE)
+		return 0;
+
+	if (ut->trace)
+		trace_writer_add_packet(ut->trace, rx);
+	return 1;
+}
+
+/* Take in a CLOCK_TRACK report. Returns 0 for any other packet type. */
+int ubertooth_clock_track( ubertooth_t* ut, const usb_pkt_rx* rx )
+{
+	const uint8_t* d = rx->data;
+
+	if (rx->pkt_type != CLOCK_TRACK)
+		return 0;
+
+	ut->clock_locked = d[0] & CLOCK_TRACK_LOCKED;
+	ut->clock_phase_err = (int32_t)(d[1] | d[2] << 8 | d[3] << 16 | (uint32_t)d[4] << 24);
+	ut->clock_drift_ppm = (int32_t)(d[5] | d[6] << 8 | d[7] << 16 | (uint32_t)d[8] << 24)
+	                      / CLOCK_TRACK_RATE_PER_PPM;
+	ut->clock_updates = d[9] | d[10] << 8 | d[11] << 16 | (uint32_t)d[12] << 24;
+	ut->clock_relocks = d[13] | d[14] << 8 | d[15] << 16 | (uint32_t)d[16] << 24;
+
+	if (ut->clock_tracking)
+		printf("Clock %s: offset %.1f us, drift %.2f PPM, %u updates, %u locks\n",
+		       ut->clock_locked ? "locked" : "unlocked",
+		       (double)ut->clock_phase_err / 10, ut->clock_drift_ppm,
+		       ut->clock_updates, ut->clock_relocks);
+	return 1;
+}
+
+/* One line per channel seen so far: MHz, average and noise floor in dBm,
+ * carrier sense triggers, and how many reports ago it was last updated */
+void ubertooth_print_channel_quality( const ubertooth_t* ut, FILE* out )
+{
+	const channel_quality_t* q;
+	int i;
+
+	fprintf(out, "# channel quality, report %u\n", ut->channel_reports);
+	for (i = 0; i < NUM_BREDR_CHANNELS; i++) {
+		q = &ut->channel_quality[i];
+		if (q->report == 0)
+			continue;
+		fprintf(out, "%d, %d, %d, %u, %u\n", 2402 + i, q->rssi_avg,
+		        q->noise_floor, q->cs_triggers,
+		        ut->channel_reports - q->report + 1);
+	}
+	fflush(out);
+}
+
+uint64_t now_ns_from_clk100ns( ubertooth_t* ut, const usb_pkt_rx* rx )
+{
+	uint64_t tick;
+
+	/* without TIME_SYNC packets, guess at rollovers from packet order */
+	if (!ut->time_synced) {
+		track_clk100ns( ut, rx );
+		return ut->abs_start_ns + 100ull *
+		       (ut->clk100ns_upper * BT_CLK100NS_WRAP + rx->clk100ns
+		        - ut->start_clk100ns);
+	}
+
+	tick = ut->sync_tick + (int64_t)bt_clk100ns_delta(le32toh(rx->clk100ns),
+	                                                  ut->sync_clk100ns);
+	if (!ut->start_tick) {
+		if (!ut->abs_start_ns)
+			ut->abs_start_ns = now_ns( );
+		ut->start_tick = tick;
+	}
+	return ut->abs_start_ns + 100ull * (tick - ut->start_tick);
 }
 
 /* Sniff for LAPs. If a piconet is provided, use the given LAP to
@@ -306,6 +442,49 @@ out:
 		btbb_packet_unref(pkt);
 }
 
+/* Apply the changes in an AFH_MAP packet to the piconet. Returns 1 if its
+ * map changed. */
+static int afh_map_receive(btbb_piconet* pn, const usb_pkt_rx* rx, int verbose)
+{
+	int i, changed = 0;
+
+	for (i = 0; i < 79; i++) {
+		if (!(rx->data[10 + i/8] & (1 << (i%8))))
+			continue;
+		if (rx->data[i/8] & (1 << (i%8))) {
+			if (btbb_piconet_set_channel_seen(pn, i)) {
+				if (verbose)
+					printf("+ channel %2d is used now\n", i);
+				changed = 1;
+			}
+		} else if (btbb_piconet_clear_channel_seen(pn, i)) {
+			if (verbose)
+				printf("- channel %2d is not used any more\n", i);
+			changed = 1;
+		}
+	}
+	return changed;
+}
+
+/* The map is learnt on the Ubertooth, which only sends the changes */
+void cb_afh_learn(ubertooth_t* ut, void* args)
+{
+	btbb_piconet* pn = (btbb_piconet*)args;
+	usb_pkt_rx usb = fifo_pop(ut->fifo);
+
+	if (usb.pkt_type == AFH_MAP && afh_map_receive(pn, &usb, 1))
+		btbb_print_afh_map(pn);
+}
+
+void cb_afh_learn_r(ubertooth_t* ut, void* args)
+{
+	btbb_piconet* pn = (btbb_piconet*)args;
+	usb_pkt_rx usb = fifo_pop(ut->fifo);
+
+	if (usb.pkt_type == AFH_MAP)
+		afh_map_receive(pn, &usb, 0);
+}
+
 
 /*
  * Sniff Bluetooth Low Energy packets.
@@ -343,6 +522,13 @@ void cb_btle(ubertooth_t* ut, void* args)
 			case 3:
 				printf("Hop increment: %u\n", *(uint8_t *)val);
 				break;
+			case 4:
+				printf("Access Address candidates:\n");
+				for (i = 0; i < rx->data[1] && i < 8; i++)
+					printf("    %08x seen %u\n",
+					       le32toh(*(uint32_t *)&rx->data[2 + i * 5]),
+					       rx->data[2 + i * 5 + 4]);
+				break;
 			default:
 				printf("Unknown %u\n", state);
 				break;
@@ -352,6 +538,26 @@ void cb_btle(ubertooth_t* ut, void* args)
 		return;
 	}
 
+	// repeats of advertising packets, see UBERTOOTH_ADV_DEDUP
+	if (rx->pkt_type == ADV_SUMMARY) {
+		le_adv_entry_t rec;
+
+		if (infile == NULL)
+			systime = time(NULL);
+		for (i = 0; i < rx->data[0] && i < ADV_SUMMARY_MAX; i++) {
+			le_adv_summary_unpack(&rx->data[1 + i * LE_ADV_SUMMARY_LEN], &rec);
+			printf("systime=%u adv summary: addr=%02x:%02x:%02x:%02x:%02x:%02x "
+			       "type=%u hash=%08x repeats=%u rssi=%d..%d span=%.03f ms\n",
+			       systime, rec.adva[5], rec.adva[4], rec.adva[3],
+			       rec.adva[2], rec.adva[1], rec.adva[0], rec.type & 0x0f,
+			       rec.hash, rec.count, rec.rssi_min - 54, rec.rssi_max - 54,
+			       bt_clk100ns_diff(rec.last_clk100ns,
+			                        rec.first_clk100ns) / 10000.0);
+		}
+		fflush(stdout);
+		return;
+	}
+
 	uint64_t nowns = now_ns_from_clk100ns( ut, rx );
 
 	/* Sanity check */
@@ -409,9 +615,12 @@ void cb_btle(ubertooth_t* ut, void* args)
 		rx_ts += 3276800000;
 	u32 ts_diff = rx_ts - prev_ts;
 	prev_ts = rx->clk100ns;
-	printf("systime=%u freq=%d addr=%08x delta_t=%.03f ms rssi=%d\n",
+	printf("systime=%u freq=%d addr=%08x delta_t=%.03f ms rssi=%d",
 	       systime, rx->channel + 2402, lell_get_access_address(pkt),
 	       ts_diff / 10000.0, rx->rssi_min - 54);
+	if (rx->le_conn)
+		printf(" conn=%u", rx->le_conn);
+	printf("\n");
 
 	int len = (rx->data[5] & 0x3f) + 6 + 3;
 	if (len > 50) len = 50;
@@ -541,8 +750,9 @@ void cb_rx(ubertooth_t* ut, void* args)
 	);
 
 	/* calibrate Ubertooth clock such that the first bit of the AC
-	 * arrives CLK_TUNE_TIME after the rising edge of CLKN */
-	if (pn != NULL && infile == NULL) {
+	 * arrives CLK_TUNE_TIME after the rising edge of CLKN, unless the
+	 * Ubertooth is doing it itself */
+	if (pn != NULL && infile == NULL && !ut->clock_tracking) {
 		if (trim_counter < -CLOCK_TRIM_THRESHOLD
 		    || ((clk_offset < CLK_TUNE_TIME) && !calibrated)) {
 			printf("offset < CLK_TUNE_TIME\n");
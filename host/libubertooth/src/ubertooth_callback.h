@@ -26,9 +26,20 @@
 #include "ubertooth_control.h"
 #include "ubertooth.h"
 
+int8_t cc2400_rssi_to_dbm( const int8_t rssi );
+int ubertooth_time_sync( ubertooth_t* ut, const usb_pkt_rx* rx );
+int ubertooth_filter_summary( ubertooth_t* ut, const usb_pkt_rx* rx );
+int ubertooth_rssi_telemetry( ubertooth_t* ut, const usb_pkt_rx* rx );
+int ubertooth_trace_receive( ubertooth_t* ut, const usb_pkt_rx* rx );
+int ubertooth_clock_track( ubertooth_t* ut, const usb_pkt_rx* rx );
+void ubertooth_print_channel_quality( const ubertooth_t* ut, FILE* out );
+uint64_t now_ns_from_clk100ns( ubertooth_t* ut, const usb_pkt_rx* rx );
+
 void cb_afh_initial(ubertooth_t* ut, void* args);
 void cb_afh_monitor(ubertooth_t* ut, void* args);
 void cb_afh_r(ubertooth_t* ut, void* args);
+void cb_afh_learn(ubertooth_t* ut, void* args);
+void cb_afh_learn_r(ubertooth_t* ut, void* args);
 void cb_btle(ubertooth_t* ut, void* args);
 void cb_ego(ubertooth_t* ut, void* args __attribute__((unused)));
 void cb_rx(ubertooth_t* ut, void* args);
@@ -22,6 +22,7 @@
 #include <string.h>
 #include <btbb.h>
 #include "ubertooth_control.h"
+#include "ubertooth_bluetooth.h"
 
 #define CTRL_IN     (LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_IN)
 #define CTRL_OUT    (LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_OUT)
@@ -133,6 +134,369 @@ int cmd_specan(struct libusb_device_handle* devh, u16 low_freq, u16 high_freq)
 	return 0;
 }
 
+int cmd_specan_fast(struct libusb_device_handle* devh, u16 low_freq, u16 high_freq)
+{
+	int r;
+
+	r = libusb_control_transfer(devh, CTRL_OUT, UBERTOOTH_SPECAN_FAST,
+			low_freq, high_freq, NULL, 0, 1000);
+	if (r < 0) {
+		if (r == LIBUSB_ERROR_PIPE) {
+			fprintf(stderr, "control message unsupported\n");
+		} else {
+			show_libusb_error(r);
+		}
+		return r;
+	}
+	return 0;
+}
+
+/* Old firmware stalls this request, which callers treat as "use triples",
+ * so that case is not reported as an error here. */
+int cmd_set_specan_format(struct libusb_device_handle* devh, u8 format)
+{
+	int r;
+
+	r = libusb_control_transfer(devh, CTRL_OUT, UBERTOOTH_SET_SPECAN_FORMAT,
+			format, 0, NULL, 0, 1000);
+	if (r < 0) {
+		if (r != LIBUSB_ERROR_PIPE)
+			show_libusb_error(r);
+		return r;
+	}
+	return 0;
+}
+
+/* Only send BR packets that contain the access code of the address last
+ * given to cmd_set_bdaddr(), allowing up to max_errors bit errors. */
+int cmd_set_ac_filter(struct libusb_device_handle* devh, u8 enable, u8 max_errors)
+{
+	int r;
+
+	r = libusb_control_transfer(devh, CTRL_OUT, UBERTOOTH_SET_AC_FILTER,
+			enable, max_errors, NULL, 0, 1000);
+	if (r < 0) {
+		if (r == LIBUSB_ERROR_PIPE) {
+			fprintf(stderr, "control message unsupported\n");
+		} else {
+			show_libusb_error(r);
+		}
+		return r;
+	}
+	return 0;
+}
+
+static int set_ac_targets(struct libusb_device_handle* devh, u16 type,
+                          u8* data, int data_len, u8 max_errors)
+{
+	int r;
+
+	r = libusb_control_transfer(devh, CTRL_OUT, UBERTOOTH_SET_AC_TARGETS,
+			max_errors, type, data, data_len, 1000);
+	if (r < 0) {
+		if (r == LIBUSB_ERROR_PIPE) {
+			fprintf(stderr, "control message unsupported\n");
+		} else {
+			show_libusb_error(r);
+		}
+		return r;
+	} else if (r < data_len) {
+		fprintf(stderr, "Only %d of %d bytes transferred\n", r, data_len);
+		return 1;
+	}
+	return 0;
+}
+
+/* Only send BR_PACKETs holding the access code of one of the count LAPs,
+ * allowing up to max_errors bit errors. count 0 removes the filter. */
+int cmd_set_lap_filter(struct libusb_device_handle* devh, const u32* laps,
+                       int count, u8 max_errors)
+{
+	u8 data[8 * BT_AC_MAX_TARGETS];
+	u64 syncword;
+	int i, j;
+
+	if (count > BT_AC_MAX_TARGETS) {
+		fprintf(stderr, "At most %d LAPs can be filtered on\n",
+		        BT_AC_MAX_TARGETS);
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		syncword = btbb_gen_syncword(laps[i] & 0xffffff);
+		for (j = 0; j < 8; j++)
+			data[8*i + j] = (syncword >> (8*j)) & 0xff;
+	}
+
+	return set_ac_targets(devh, AC_TARGETS_BR, data, 8 * count, max_errors);
+}
+
+/* Only report and follow LE connections using one of the count access
+ * addresses in promiscuous mode. count 0 removes the filter. */
+int cmd_set_aa_filter(struct libusb_device_handle* devh, const u32* aas,
+                      int count, u8 max_errors)
+{
+	u8 data[4 * BT_AC_MAX_TARGETS];
+	int i, j;
+
+	if (count > BT_AC_MAX_TARGETS) {
+		fprintf(stderr, "At most %d access addresses can be filtered on\n",
+		        BT_AC_MAX_TARGETS);
+		return -1;
+	}
+
+	for (i = 0; i < count; i++)
+		for (j = 0; j < 4; j++)
+			data[4*i + j] = (aas[i] >> (8*j)) & 0xff;
+
+	return set_ac_targets(devh, AC_TARGETS_LE, data, 4 * count, max_errors);
+}
+
+int cmd_set_time_sync(struct libusb_device_handle* devh, u8 enable)
+{
+	int r;
+
+	r = libusb_control_transfer(devh, CTRL_OUT, UBERTOOTH_TIME_SYNC,
+			enable, 0, NULL, 0, 1000);
+	if (r < 0) {
+		if (r == LIBUSB_ERROR_PIPE) {
+			fprintf(stderr, "control message unsupported\n");
+		} else {
+			show_libusb_error(r);
+		}
+		return r;
+	}
+	return 0;
+}
+
+int cmd_set_le_packed(struct libusb_device_handle* devh, u8 enable)
+{
+	int r;
+
+	r = libusb_control_transfer(devh, CTRL_OUT, UBERTOOTH_LE_PACKED,
+			enable, 0, NULL, 0, 1000);
+	if (r < 0) {
+		if (r == LIBUSB_ERROR_PIPE) {
+			fprintf(stderr, "control message unsupported\n");
+		} else {
+			show_libusb_error(r);
+		}
+		return r;
+	}
+	return 0;
+}
+
+int cmd_set_adv_dedup(struct libusb_device_handle* devh, u8 enable)
+{
+	int r;
+
+	r = libusb_control_transfer(devh, CTRL_OUT, UBERTOOTH_ADV_DEDUP,
+			enable, 0, NULL, 0, 1000);
+	if (r < 0) {
+		if (r == LIBUSB_ERROR_PIPE) {
+			fprintf(stderr, "control message unsupported\n");
+		} else {
+			show_libusb_error(r);
+		}
+		return r;
+	}
+	return 0;
+}
+
+int cmd_set_rssi_telemetry(struct libusb_device_handle* devh, u16 period_ms)
+{
+	int r;
+
+	r = libusb_control_transfer(devh, CTRL_OUT, UBERTOOTH_RSSI_TELEMETRY,
+			period_ms, 0, NULL, 0, 1000);
+	if (r < 0) {
+		if (r == LIBUSB_ERROR_PIPE) {
+			fprintf(stderr, "control message unsupported\n");
+		} else {
+			show_libusb_error(r);
+		}
+		return r;
+	}
+	return 0;
+}
+
+int cmd_get_specan_rate(struct libusb_device_handle* devh, specan_rate* rate)
+{
+	u8 data[12];
+	int r;
+
+	r = libusb_control_transfer(devh, CTRL_IN, UBERTOOTH_GET_SPECAN_RATE, 0, 0,
+			data, sizeof(data), 1000);
+	if (r < 0) {
+		if (r == LIBUSB_ERROR_PIPE) {
+			fprintf(stderr, "control message unsupported\n");
+		} else {
+			show_libusb_error(r);
+		}
+		return r;
+	}
+	if (r < (int)sizeof(data))
+		return -1;
+
+	rate->sweeps = data[0] | data[1] << 8 | data[2] << 16 | data[3] << 24;
+	rate->sweep_time = data[4] | data[5] << 8 | data[6] << 16 | data[7] << 24;
+	rate->settle_time = data[8] | data[9] << 8;
+	rate->bins = data[10] | data[11] << 8;
+	return 0;
+}
+
+int cmd_get_queue_stats(struct libusb_device_handle* devh,
+                        usb_queue_stats* stats, int reset)
+{
+	u8 data[10];
+	int r;
+
+	r = libusb_control_transfer(devh, CTRL_IN, UBERTOOTH_GET_QUEUE_STATS,
+			reset ? 1 : 0, 0, data, sizeof(data), 1000);
+	if (r < 0) {
+		if (r == LIBUSB_ERROR_PIPE) {
+			fprintf(stderr, "control message unsupported\n");
+		} else {
+			show_libusb_error(r);
+		}
+		return r;
+	}
+	if (r < (int)sizeof(data))
+		return -1;
+
+	stats->size = data[0] | data[1] << 8;
+	stats->depth = data[2] | data[3] << 8;
+	stats->high_water = data[4] | data[5] << 8;
+	stats->overflows = data[6] | data[7] << 8 | data[8] << 16 | data[9] << 24;
+	return 0;
+}
+
+int cmd_get_perf_counters(struct libusb_device_handle* devh,
+                          perf_counters* perf, int reset)
+{
+	u8 data[sizeof(perf_counters)];
+	u32* counters = (u32*)perf;
+	int i, r;
+
+	r = libusb_control_transfer(devh, CTRL_IN, UBERTOOTH_GET_PERF_COUNTERS,
+			reset ? 1 : 0, 0, data, sizeof(data), 1000);
+	if (r < 0) {
+		if (r == LIBUSB_ERROR_PIPE) {
+			fprintf(stderr, "control message unsupported\n");
+		} else {
+			show_libusb_error(r);
+		}
+		return r;
+	}
+	if (r < (int)sizeof(data))
+		return -1;
+
+	for (i = 0; i < (int)(sizeof(perf_counters) / 4); i++)
+		counters[i] = data[4*i] | data[4*i+1] << 8 | data[4*i+2] << 16
+		              | (u32)data[4*i+3] << 24;
+	return 0;
+}
+
+int cmd_set_trace(struct libusb_device_handle* devh, u8 flags)
+{
+	int r;
+
+	r = libusb_control_transfer(devh, CTRL_OUT, UBERTOOTH_TRACE,
+			flags, 0, NULL, 0, 1000);
+	if (r < 0) {
+		if (r == LIBUSB_ERROR_PIPE) {
+			fprintf(stderr, "control message unsupported\n");
+		} else {
+			show_libusb_error(r);
+		}
+		return r;
+	}
+	return 0;
+}
+
+/* Read up to TRACE_READ_MAX trace events into events, TRACE_EVENT_LEN bytes
+ * each. Returns the number read, or a libusb error. */
+int cmd_get_trace(struct libusb_device_handle* devh, u8* events, u32* lost)
+{
+	u8 data[4 + TRACE_READ_MAX * TRACE_EVENT_LEN];
+	int r;
+
+	r = libusb_control_transfer(devh, CTRL_IN, UBERTOOTH_GET_TRACE, 0, 0,
+			data, sizeof(data), 1000);
+	if (r < 0) {
+		if (r == LIBUSB_ERROR_PIPE) {
+			fprintf(stderr, "control message unsupported\n");
+		} else {
+			show_libusb_error(r);
+		}
+		return r;
+	}
+	if (r < 4)
+		return -1;
+
+	*lost = data[0] | data[1] << 8 | data[2] << 16 | (u32)data[3] << 24;
+	memcpy(events, &data[4], r - 4);
+	return (r - 4) / TRACE_EVENT_LEN;
+}
+
+/* Keep CLKN locked to the followed piconet on the device, allowing up to
+ * max_errors (1-4) bit errors in its access code, or as many as the access
+ * code filter allows if 0, see UBERTOOTH_CLOCK_TRACK */
+int cmd_clock_track(struct libusb_device_handle* devh, u8 enable, u8 max_errors)
+{
+	int r;
+
+	r = libusb_control_transfer(devh, CTRL_OUT, UBERTOOTH_CLOCK_TRACK,
+			enable, max_errors, NULL, 0, 1000);
+	if (r < 0) {
+		if (r == LIBUSB_ERROR_PIPE) {
+			fprintf(stderr, "control message unsupported\n");
+		} else {
+			show_libusb_error(r);
+		}
+		return r;
+	}
+	return 0;
+}
+
+/* Follow up to max_connections LE connections at once, see
+ * UBERTOOTH_LE_FOLLOW_MULTI. Must come before cmd_btle_sniffing(). */
+int cmd_le_follow_multi(struct libusb_device_handle* devh, u8 max_connections)
+{
+	int r;
+
+	r = libusb_control_transfer(devh, CTRL_OUT, UBERTOOTH_LE_FOLLOW_MULTI,
+			max_connections, 0, NULL, 0, 1000);
+	if (r < 0) {
+		if (r == LIBUSB_ERROR_PIPE) {
+			fprintf(stderr, "control message unsupported\n");
+		} else {
+			show_libusb_error(r);
+		}
+		return r;
+	}
+	return 0;
+}
+
+/* Learn the AFH map on the device, see UBERTOOTH_AFH_LEARN. flags 0 stops
+ * learning. */
+int cmd_afh_learn(struct libusb_device_handle* devh, u16 max_age, u8 flags)
+{
+	int r;
+
+	r = libusb_control_transfer(devh, CTRL_OUT, UBERTOOTH_AFH_LEARN,
+			max_age, flags, NULL, 0, 1000);
+	if (r < 0) {
+		if (r == LIBUSB_ERROR_PIPE) {
+			fprintf(stderr, "control message unsupported\n");
+		} else {
+			show_libusb_error(r);
+		}
+		return r;
+	}
+	return 0;
+}
+
 int cmd_led_specan(struct libusb_device_handle* devh, u16 rssi_threshold)
 {
 	int r;
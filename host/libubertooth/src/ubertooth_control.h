@@ -85,6 +85,27 @@ int cmd_ping(struct libusb_device_handle* devh);
 int cmd_rx_syms(struct libusb_device_handle* devh);
 int cmd_tx_syms(struct libusb_device_handle* devh);
 int cmd_specan(struct libusb_device_handle* devh, u16 low_freq, u16 high_freq);
+int cmd_specan_fast(struct libusb_device_handle* devh, u16 low_freq, u16 high_freq);
+int cmd_set_specan_format(struct libusb_device_handle* devh, u8 format);
+int cmd_get_specan_rate(struct libusb_device_handle* devh, specan_rate* rate);
+int cmd_get_queue_stats(struct libusb_device_handle* devh,
+                        usb_queue_stats* stats, int reset);
+int cmd_get_perf_counters(struct libusb_device_handle* devh,
+                          perf_counters* perf, int reset);
+int cmd_set_trace(struct libusb_device_handle* devh, u8 flags);
+int cmd_get_trace(struct libusb_device_handle* devh, u8* events, u32* lost);
+int cmd_afh_learn(struct libusb_device_handle* devh, u16 max_age, u8 flags);
+int cmd_clock_track(struct libusb_device_handle* devh, u8 enable, u8 max_errors);
+int cmd_le_follow_multi(struct libusb_device_handle* devh, u8 max_connections);
+int cmd_set_ac_filter(struct libusb_device_handle* devh, u8 enable, u8 max_errors);
+int cmd_set_lap_filter(struct libusb_device_handle* devh, const u32* laps,
+                       int count, u8 max_errors);
+int cmd_set_aa_filter(struct libusb_device_handle* devh, const u32* aas,
+                      int count, u8 max_errors);
+int cmd_set_time_sync(struct libusb_device_handle* devh, u8 enable);
+int cmd_set_le_packed(struct libusb_device_handle* devh, u8 enable);
+int cmd_set_adv_dedup(struct libusb_device_handle* devh, u8 enable);
+int cmd_set_rssi_telemetry(struct libusb_device_handle* devh, u16 period_ms);
 int cmd_led_specan(struct libusb_device_handle* devh, u16 rssi_threshold);
 int cmd_set_usrled(struct libusb_device_handle* devh, u16 state);
 int cmd_get_usrled(struct libusb_device_handle* devh);
@@ -64,6 +64,11 @@ usb_pkt_rx fifo_pop(fifo_t* fifo)
 	return fifo->packets[selected];
 }
 
+usb_pkt_rx* fifo_peek(fifo_t* fifo)
+{
+	return &(fifo->packets[fifo->read_ptr]);
+}
+
 usb_pkt_rx* fifo_get_write_element(fifo_t* fifo)
 {
 	return &(fifo->packets[fifo->write_ptr]);
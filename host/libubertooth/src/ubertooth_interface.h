@@ -110,6 +110,22 @@ enum ubertooth_usb_commands {
 	UBERTOOTH_RX_GENERIC         = 67,
 	UBERTOOTH_TX_GENERIC_PACKET  = 68,
 	UBERTOOTH_FIX_CLOCK_DRIFT    = 69,
+	UBERTOOTH_SPECAN_FAST        = 70,
+	UBERTOOTH_GET_SPECAN_RATE    = 71,
+	UBERTOOTH_SET_SPECAN_FORMAT  = 72,
+	UBERTOOTH_SET_AC_FILTER      = 73,
+	UBERTOOTH_GET_QUEUE_STATS    = 74,
+	UBERTOOTH_TIME_SYNC          = 75,
+	UBERTOOTH_LE_PACKED          = 76,
+	UBERTOOTH_SET_AC_TARGETS     = 77,
+	UBERTOOTH_ADV_DEDUP          = 78,
+	UBERTOOTH_RSSI_TELEMETRY     = 79,
+	UBERTOOTH_GET_PERF_COUNTERS  = 80,
+	UBERTOOTH_TRACE              = 81,
+	UBERTOOTH_GET_TRACE          = 82,
+	UBERTOOTH_AFH_LEARN          = 83,
+	UBERTOOTH_CLOCK_TRACK        = 84,
+	UBERTOOTH_LE_FOLLOW_MULTI    = 85,
 };
 
 enum jam_modes {
@@ -133,8 +149,221 @@ enum usb_pkt_types {
 	SPECAN     = 4,
 	LE_PROMISC = 5,
 	EGO_PACKET = 6,
+	SPECAN_COMPACT = 7,
+	TIME_SYNC      = 8,
+	LE_PACKED      = 9,
+	FILTER_SUMMARY = 10,
+	ADV_SUMMARY    = 11,
+	RSSI_TELEMETRY = 12,
+	TRACE          = 13,
+	AFH_MAP        = 14,
+	CLOCK_TRACK    = 15,
 };
 
+/*
+ * Once enabled with UBERTOOTH_TIME_SYNC, a TIME_SYNC packet goes ahead of the
+ * next packet whenever the device clock has been set or stopped, and every
+ * 4096 CLKN periods (1.28 s). clk100ns and clkn_high in the header are
+ * sampled at the same instant as
+ *   data[0-7]  monotonic device tick in units of 100 ns (little-endian)
+ *   data[8-11] CLKN (little-endian)
+ * The tick of any later packet is the tick of the last TIME_SYNC plus the
+ * CLK100NS difference between the two, which is exact across USB stalls and
+ * CLK100NS rollover.
+ */
+
+/*
+ * Once enabled with UBERTOOTH_LE_PACKED, LE packets are sent as records packed
+ * into LE_PACKED packets. The header of an LE_PACKED packet has the
+ * channel, clkn_high and clk100ns of its first record and the status bits of
+ * all of them. data[] holds records back to back, up to a zero length byte or
+ * the end:
+ *   [0]   length of the LE packet (access address, PDU and CRC)
+ *   [1]   channel, MHz above 2402
+ *   [2]   rssi_max
+ *   [3]   rssi_min
+ *   [4-6] CLK100NS ticks since the first record (little-endian)
+ *   [7-]  the LE packet, as in data[] of an LE_PACKET
+ * Packets too long for a record are still sent as LE_PACKET. rssi_avg and
+ * rssi_count are not carried.
+ */
+#define LE_RECORD_HEADER 7
+#define LE_RECORD_MAX_DT 0xffffff
+#define LE_PACKED_MAX    (DMA_SIZE / (LE_RECORD_HEADER + 9))
+
+/*
+ * UBERTOOTH_SET_AC_TARGETS installs an on-device filter, wValue being the
+ * most bit errors to accept and wIndex one of the ac_target_types below.
+ * The data stage holds up to BT_AC_MAX_TARGETS (4) targets, each a 64-bit
+ * BR/EDR sync word or a 32-bit LE access address, little-endian. None
+ * removes the filter.
+ *
+ * BR/EDR: RX_SYMBOLS and follow modes only send buffers holding one of the
+ * access codes. LE: promiscuous mode only reports and follows connections
+ * using one of the access addresses.
+ *
+ * While a filter is installed, a FILTER_SUMMARY packet is sent about every
+ * 10 s with counts since it was installed:
+ *   data[0-3] buffers passed (little-endian)
+ *   data[4-7] buffers dropped (little-endian)
+ */
+enum ac_target_types {
+	AC_TARGETS_BR = 0,
+	AC_TARGETS_LE = 1,
+};
+
+/*
+ * With UBERTOOTH_ADV_DEDUP enabled, LE follow mode only sends the first
+ * copy of a repeated advertising PDU while listening on an advertising
+ * channel. Copies are the same type, AdvA and payload. Repeats are counted
+ * and reported about once a second in ADV_SUMMARY packets:
+ *   data[0]   number of records that follow, at most ADV_SUMMARY_MAX
+ *   data[1-]  records of LE_ADV_SUMMARY_LEN (23) bytes:
+ *     [0]     PDU header byte 0 & 0x4f (PDU type and TxAdd)
+ *     [1-6]   AdvA as sent
+ *     [7-10]  hash of the payload after AdvA, see le_adv_hash()
+ *     [11-12] repeats not forwarded
+ *     [13-14] lowest and highest RSSI of the repeats
+ *     [15-18] CLK100NS of the first repeat
+ *     [19-22] CLK100NS of the last repeat
+ * Multi-byte fields are little-endian.
+ */
+#define ADV_SUMMARY_MAX ((DMA_SIZE - 1) / 23)
+
+/*
+ * UBERTOOTH_RSSI_TELEMETRY sets the period of RSSI_TELEMETRY reports in ms,
+ * wValue 0 turning them off. They are sent in the BR/EDR and LE receive
+ * modes whether or not anything is being captured. A report covers the
+ * channels with RSSI samples since the previous one, and takes as many
+ * packets as needed:
+ *   data[0]   number of entries that follow, at most RSSI_TELEMETRY_MAX
+ *   data[1]   RSSI_TELEMETRY_LAST on the last packet of a report
+ *   data[2-]  entries of 4 bytes:
+ *     [0] channel, MHz above 2402
+ *     [1] IIR average RSSI (raw CC2400 value, like rssi_avg)
+ *     [2] noise floor estimate (raw)
+ *     [3] carrier sense triggers since the last report, saturating
+ */
+#define RSSI_TELEMETRY_MAX  ((DMA_SIZE - 2) / 4)
+#define RSSI_TELEMETRY_LAST 0x01
+
+/*
+ * Firmware event trace. UBERTOOTH_TRACE takes trace_flags in wValue. With
+ * TRACE_ENABLE the firmware records trace_events in a ring, each 8 bytes:
+ *   [0-3] DWT cycle counter, TRACE_CYCLES_PER_US per us, wrapping at 2^32
+ *   [4]   trace_events id
+ *   [5]   0
+ *   [6-7] argument
+ * UBERTOOTH_GET_TRACE returns data[0-3] events lost since the last read,
+ * then up to TRACE_READ_MAX events, oldest first. With TRACE_STREAM events
+ * also go out in TRACE packets whenever the bulk endpoint would otherwise
+ * be idle:
+ *   data[0]   number of events, at most TRACE_PACKET_MAX
+ *   data[1]   events lost, saturating
+ *   data[2-]  events
+ * Multi-byte fields are little-endian.
+ */
+enum trace_flags {
+	TRACE_ENABLE = 0x01,
+	TRACE_STREAM = 0x02,
+};
+
+enum trace_events {
+	TRACE_HOP_START         = 1,  // arg: new channel, MHz
+	TRACE_HOP_LOCK          = 2,  // arg: channel, MHz
+	TRACE_LE_RX             = 3,  // bt_le_sync woken by DMA, arg: channel
+	TRACE_LE_PACKET         = 4,  // packet handled, arg: PDU length
+	TRACE_LE_CRC_FAIL       = 5,
+	TRACE_LE_RX_RESTART     = 6,  // radio back in RX, arg: channel
+	TRACE_PROMISC_STATE     = 7,  // arg: LE_PROMISC state
+	TRACE_PROMISC_OBSERVE   = 8,  // connection heard by promisc_recover_hop(), arg: channel
+	TRACE_PROMISC_SOLVE     = 9,  // arg: le_hop_solver_solve() result
+	TRACE_CLOCK_TRIM        = 10, // arg: CLKN trim in CLK100NS ticks, signed
+	TRACE_LE_FOLLOW_SWITCH  = 11, // radio moved to another connection, arg: slot
+};
+
+#define TRACE_CYCLES_PER_US 100
+#define TRACE_EVENT_LEN     8
+#define TRACE_READ_MAX      31
+#define TRACE_PACKET_MAX    ((DMA_SIZE - 2) / TRACE_EVENT_LEN)
+
+/*
+ * UBERTOOTH_AFH_LEARN makes the firmware work out the AFH map of the piconet
+ * whose access code was installed with UBERTOOTH_SET_AC_TARGETS, while in
+ * HOP_AFH receive mode. wIndex takes afh_learn_flags, 0 turning learning
+ * off. wValue is the number of hits elsewhere after which a channel with no
+ * hit of its own counts as unused again, 0 for never. A channel with a hit
+ * is used, and the radio hops on at once rather than waiting for the dwell
+ * time to run out. With AFH_LEARN_DISCOVER, channels already known to be
+ * used are not visited and a single unused channel between two used ones is
+ * filled in; without it every channel is visited so that the map follows
+ * changes. Sending the request again while learning keeps the map.
+ *
+ * Receive buffers are not sent to the host while learning. Instead an
+ * AFH_MAP packet goes out whenever the map changes:
+ *   data[0-9]   the map, channel n is bit n % 8 of byte n / 8
+ *   data[10-19] channels that changed since the previous AFH_MAP
+ *   data[20]    number of used channels
+ *   data[21-24] hits so far, little-endian
+ */
+enum afh_learn_flags {
+	AFH_LEARN_ENABLE   = 0x01,
+	AFH_LEARN_DISCOVER = 0x02,
+};
+
+/*
+ * UBERTOOTH_CLOCK_TRACK with a non-zero wValue keeps CLKN locked to the
+ * piconet being followed on the device, in place of UBERTOOTH_TRIM_CLOCK
+ * and UBERTOOTH_FIX_CLOCK_DRIFT from the host. A non-zero wIndex sets the
+ * number of access code bit errors allowed, shared with
+ * UBERTOOTH_SET_AC_FILTER and below 5; zero leaves it as it is.
+ * Each access code found sets the phase error of CLKN from where it should
+ * be, CLK_TUNE_TIME before the code, and a PI loop (bt_clock_track_t) trims
+ * CLKN and estimates the drift of the local clock. UBERTOOTH_START_HOPPING
+ * makes the loop lock again. About once a second, and on every (re)lock,
+ * a CLOCK_TRACK packet reports the loop state:
+ *   data[0]     CLOCK_TRACK_LOCKED when locked
+ *   data[1-4]   last phase error in CLK100NS ticks, positive if CLKN is early
+ *   data[5-8]   drift taken out, 2^-16 CLK100NS ticks per CLKN period
+ *               (CLOCK_TRACK_RATE_PER_PPM per ppm), positive if CLKN is fast
+ *   data[9-12]  loop updates since tracking started
+ *   data[13-16] times the loop has (re)locked
+ * Multi-byte fields are little-endian and signed where they can be negative.
+ */
+#define CLOCK_TRACK_LOCKED       0x01
+#define CLOCK_TRACK_RATE_PER_PPM 204.8
+
+/*
+ * UBERTOOTH_LE_FOLLOW_MULTI sets how many LE connections, up to
+ * LE_FOLLOW_MAX, are followed at once in MODE_BT_FOLLOW_LE. It lasts until
+ * the mode ends, and 0 or 1 follows a single connection as before. With
+ * more, each CONNECT_REQ seen takes a free slot in a table of connections
+ * and the radio is shared out between them: it is tuned to whichever one
+ * has the soonest anchor point, and goes back to the advertising channel
+ * for more CONNECT_REQs when no anchor is close. A connection is dropped
+ * after 5 s without a packet. LE_PACKET and LE_PACKED packets from a
+ * followed connection carry its slot, 1 to LE_FOLLOW_MAX, in le_conn, so
+ * all records of an LE_PACKED packet are from the same connection. le_conn
+ * is 0 for anything else.
+ */
+#define LE_FOLLOW_MAX 4
+
+/*
+ * SPECAN packets carry 16 (freq_hi, freq_lo, rssi) triples. SPECAN_COMPACT
+ * packets carry a run of RSSI values at evenly spaced frequencies:
+ *   data[0-1] first frequency in MHz (little-endian)
+ *   data[2]   step in MHz
+ *   data[3]   number of RSSI values that follow
+ *   data[4-]  RSSI values
+ * A run never wraps from the upper frequency back to the lower one.
+ */
+enum specan_formats {
+	SPECAN_FORMAT_TRIPLES = 0,
+	SPECAN_FORMAT_COMPACT = 1,
+};
+#define SPECAN_COMPACT_HEADER 4
+#define SPECAN_COMPACT_MAX    (DMA_SIZE - SPECAN_COMPACT_HEADER)
+
 enum hop_mode {
 	HOP_NONE      = 0,
 	HOP_SWEEP     = 1,
@@ -166,7 +395,8 @@ typedef struct {
 	int8_t rssi_min;   // Min ...
 	int8_t rssi_avg;   // Average ...
 	u8     rssi_count; // Number of ... (0 means RSSI stats are invalid)
-	u8     reserved[2];
+	u8     le_conn;    // followed connection, see UBERTOOTH_LE_FOLLOW_MULTI
+	u8     reserved;
 	u8     data[DMA_SIZE];
 } usb_pkt_rx;
 
@@ -183,6 +413,51 @@ typedef struct {
 	u8 reply_num;
 } rangetest_result;
 
+/*
+ * Fast sweep timing, returned by UBERTOOTH_GET_SPECAN_RATE (12 bytes,
+ * little-endian). Times are in units of 100 ns.
+ */
+typedef struct {
+	u32 sweeps;      // sweeps completed since the mode was started
+	u32 sweep_time;  // duration of the last complete sweep
+	u16 settle_time; // RSSI settle time measured during calibration
+	u16 bins;        // frequencies per sweep
+} specan_rate;
+
+/*
+ * USB packet queue occupancy, returned by UBERTOOTH_GET_QUEUE_STATS (10
+ * bytes, little-endian). A non-zero wValue restarts the high-water mark
+ * and overflow count after reading them.
+ */
+typedef struct {
+	u16 size;        // packets the queue can hold
+	u16 depth;       // packets waiting to be sent
+	u16 high_water;  // largest depth since the mode started or last reset
+	u32 overflows;   // packets dropped because the queue was full
+} usb_queue_stats;
+
+/*
+ * Firmware performance counters, returned by UBERTOOTH_GET_PERF_COUNTERS as
+ * consecutive little-endian u32s in this order. They count from power-up,
+ * across modes; a non-zero wValue clears them after reading. Cycles are
+ * CPU cycles from the DWT cycle counter, 100 per us.
+ */
+typedef struct {
+	u32 dma_transfers;       // DMA terminal count interrupts
+	u32 dma_overflows;       // transfers overwritten before they were read
+	u32 dma_errors;
+	u32 usb_alloc_failures;  // packets dropped because the queue was full
+	u32 usb_high_water;      // most packets ever waiting to be sent
+	u32 usb_bulk_services;   // bulk IN refills by the USB interrupt
+	u32 hops;
+	u32 retune_cycles;       // total cycles from hop start to lock
+	u32 retune_cycles_max;
+	u32 le_crc_failures;
+	u32 le_promisc_states;   // LE promiscuous mode state changes reported
+	u32 retune_latency;      // last hop start to lock, CLK100NS ticks
+	u32 retune_latency_max;
+} perf_counters;
+
 typedef struct {
 	u16 synch;
 	u16 syncl;
@@ -0,0 +1,299 @@
+/*
+ * Copyright 2026 Great Scott Gadgets
+ *
+ * This file is part of Project Ubertooth.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "ubertooth_specan.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define HIST_INDEX(rssi) ((uint8_t)((int)(rssi) + 128))
+#define HIST_RSSI(index) ((int8_t)((int)(index) - 128))
+
+/* Extract (frequency, RSSI) pairs from a SPECAN or SPECAN_COMPACT packet.
+ * Returns the number of samples, 0 for any other packet type. */
+int specan_unpack(const usb_pkt_rx* rx, uint16_t* frequencies, int8_t* rssi,
+                  int max)
+{
+	int j, n = 0;
+	uint16_t first;
+	uint8_t step, count;
+
+	if (rx->pkt_type == SPECAN) {
+		for (j = 0; j < DMA_SIZE-2 && n < max; j += 3, n++) {
+			frequencies[n] = (rx->data[j] << 8) | rx->data[j + 1];
+			rssi[n] = (int8_t)rx->data[j + 2];
+		}
+	} else if (rx->pkt_type == SPECAN_COMPACT) {
+		first = rx->data[0] | (rx->data[1] << 8);
+		step = rx->data[2];
+		count = rx->data[3];
+		if (count > SPECAN_COMPACT_MAX)
+			count = SPECAN_COMPACT_MAX;
+		for (n = 0; n < count && n < max; n++) {
+			frequencies[n] = first + n * step;
+			rssi[n] = (int8_t)rx->data[SPECAN_COMPACT_HEADER + n];
+		}
+	}
+
+	return n;
+}
+
+specan_stats_t* specan_stats_init(uint16_t low_freq, uint16_t high_freq,
+                                  float alpha, int8_t occupancy_threshold,
+                                  uint32_t window_sweeps)
+{
+	specan_stats_t* stats;
+
+	if (high_freq < low_freq || alpha <= 0 || alpha > 1)
+		return NULL;
+
+	stats = (specan_stats_t*)calloc(1, sizeof(specan_stats_t));
+	if (stats == NULL)
+		return NULL;
+
+	stats->low_freq = low_freq;
+	stats->high_freq = high_freq;
+	stats->num_bins = high_freq - low_freq + 1;
+	stats->alpha = alpha;
+	stats->occupancy_threshold = occupancy_threshold;
+	stats->window_sweeps = window_sweeps ? window_sweeps : 1;
+
+	stats->avg = (float*)calloc(stats->num_bins, sizeof(float));
+	stats->max_hold = (int8_t*)calloc(stats->num_bins, sizeof(int8_t));
+	stats->min_hold = (int8_t*)calloc(stats->num_bins, sizeof(int8_t));
+	stats->hist = (uint32_t*)calloc(stats->num_bins * SPECAN_HIST_BINS,
+	                                sizeof(uint32_t));
+	stats->window_occupied = (uint32_t*)calloc(stats->num_bins, sizeof(uint32_t));
+	stats->window_samples = (uint32_t*)calloc(stats->num_bins, sizeof(uint32_t));
+	stats->occupancy = (float*)calloc(stats->num_bins, sizeof(float));
+
+	if (!stats->avg || !stats->max_hold || !stats->min_hold || !stats->hist
+	    || !stats->window_occupied || !stats->window_samples
+	    || !stats->occupancy) {
+		specan_stats_free(stats);
+		return NULL;
+	}
+
+	specan_stats_reset(stats);
+	return stats;
+}
+
+void specan_stats_free(specan_stats_t* stats)
+{
+	if (stats == NULL)
+		return;
+
+	free(stats->avg);
+	free(stats->max_hold);
+	free(stats->min_hold);
+	free(stats->hist);
+	free(stats->window_occupied);
+	free(stats->window_samples);
+	free(stats->occupancy);
+	free(stats);
+}
+
+void specan_stats_reset(specan_stats_t* stats)
+{
+	memset(stats->avg, 0, stats->num_bins * sizeof(float));
+	memset(stats->max_hold, INT8_MIN, stats->num_bins);
+	memset(stats->min_hold, INT8_MAX, stats->num_bins);
+	memset(stats->hist, 0,
+	       stats->num_bins * SPECAN_HIST_BINS * sizeof(uint32_t));
+	memset(stats->window_occupied, 0, stats->num_bins * sizeof(uint32_t));
+	memset(stats->window_samples, 0, stats->num_bins * sizeof(uint32_t));
+	memset(stats->occupancy, 0, stats->num_bins * sizeof(float));
+
+	stats->samples = 0;
+	stats->sweeps = 0;
+	stats->windows = 0;
+	stats->window_pos = 0;
+}
+
+/* Close the current occupancy window and start a new one */
+static void roll_window(specan_stats_t* stats)
+{
+	int i;
+
+	for (i = 0; i < stats->num_bins; i++) {
+		if (stats->window_samples[i])
+			stats->occupancy[i] = (float)stats->window_occupied[i]
+			                      / stats->window_samples[i];
+		stats->window_occupied[i] = 0;
+		stats->window_samples[i] = 0;
+	}
+	stats->window_pos = 0;
+	stats->windows++;
+}
+
+void specan_stats_add_sample(specan_stats_t* stats, uint16_t frequency,
+                             int8_t rssi)
+{
+	int i;
+
+	if (frequency < stats->low_freq || frequency > stats->high_freq)
+		return;
+	i = frequency - stats->low_freq;
+
+	/* seed the average with the first reading rather than zero */
+	if (stats->max_hold[i] < stats->min_hold[i])
+		stats->avg[i] = rssi;
+	else
+		stats->avg[i] += stats->alpha * (rssi - stats->avg[i]);
+
+	if (rssi > stats->max_hold[i])
+		stats->max_hold[i] = rssi;
+	if (rssi < stats->min_hold[i])
+		stats->min_hold[i] = rssi;
+
+	stats->hist[i * SPECAN_HIST_BINS + HIST_INDEX(rssi)]++;
+
+	stats->window_samples[i]++;
+	if (rssi >= stats->occupancy_threshold)
+		stats->window_occupied[i]++;
+
+	stats->samples++;
+
+	if (frequency == stats->high_freq) {
+		stats->sweeps++;
+		if (++stats->window_pos >= stats->window_sweeps)
+			roll_window(stats);
+	}
+}
+
+void specan_stats_add_packet(specan_stats_t* stats, const usb_pkt_rx* rx)
+{
+	uint16_t frequencies[SPECAN_MAX_SAMPLES];
+	int8_t rssi[SPECAN_MAX_SAMPLES];
+	int j, n;
+
+	n = specan_unpack(rx, frequencies, rssi, SPECAN_MAX_SAMPLES);
+	if (n == 0)
+		return;
+
+	for (j = 0; j < n; j++)
+		specan_stats_add_sample(stats, frequencies[j], rssi[j]);
+	stats->last_clk100ns = rx->clk100ns;
+}
+
+/* Smallest RSSI value r such that at least pct percent of the samples in
+ * hist are <= r */
+static int8_t hist_percentile(const uint32_t* hist, unsigned pct)
+{
+	uint64_t total = 0, target, seen = 0;
+	int k;
+
+	for (k = 0; k < SPECAN_HIST_BINS; k++)
+		total += hist[k];
+	if (total == 0)
+		return INT8_MIN;
+
+	if (pct > 100)
+		pct = 100;
+	target = (total * pct + 99) / 100;
+	if (target == 0)
+		target = 1;
+
+	for (k = 0; k < SPECAN_HIST_BINS; k++) {
+		seen += hist[k];
+		if (seen >= target)
+			break;
+	}
+	return HIST_RSSI(k);
+}
+
+int8_t specan_stats_percentile(const specan_stats_t* stats, uint16_t frequency,
+                               unsigned pct)
+{
+	if (frequency < stats->low_freq || frequency > stats->high_freq)
+		return INT8_MIN;
+
+	return hist_percentile(&stats->hist[(frequency - stats->low_freq)
+	                                    * SPECAN_HIST_BINS], pct);
+}
+
+/* Merge groups of 'decimation' adjacent bins into summary lines. Returns the
+ * number of lines written to out. */
+int specan_stats_summarise(const specan_stats_t* stats, unsigned decimation,
+                           specan_summary_t* out, int max_out)
+{
+	uint32_t merged[SPECAN_HIST_BINS];
+	int i, j, k, n = 0, count;
+
+	if (decimation == 0)
+		decimation = 1;
+
+	for (i = 0; i < stats->num_bins && n < max_out; i += decimation) {
+		specan_summary_t* s = &out[n++];
+
+		memset(merged, 0, sizeof(merged));
+		s->freq_lo = stats->low_freq + i;
+		s->avg = 0;
+		s->occupancy = 0;
+		s->max_hold = INT8_MIN;
+		s->min_hold = INT8_MAX;
+
+		for (j = i, count = 0; j < stats->num_bins && count < (int)decimation;
+		     j++, count++) {
+			s->avg += stats->avg[j];
+			s->occupancy += stats->occupancy[j];
+			if (stats->max_hold[j] > s->max_hold)
+				s->max_hold = stats->max_hold[j];
+			if (stats->min_hold[j] < s->min_hold)
+				s->min_hold = stats->min_hold[j];
+			for (k = 0; k < SPECAN_HIST_BINS; k++)
+				merged[k] += stats->hist[j * SPECAN_HIST_BINS + k];
+		}
+
+		s->freq_hi = stats->low_freq + j - 1;
+		s->avg /= count;
+		s->occupancy /= count;
+		s->p50 = hist_percentile(merged, 50);
+		s->p90 = hist_percentile(merged, 90);
+	}
+
+	return n;
+}
+
+void specan_stats_print(const specan_stats_t* stats, unsigned decimation,
+                        FILE* out)
+{
+	specan_summary_t* summary;
+	int i, n;
+
+	summary = (specan_summary_t*)malloc(stats->num_bins
+	                                    * sizeof(specan_summary_t));
+	if (summary == NULL)
+		return;
+
+	n = specan_stats_summarise(stats, decimation, summary, stats->num_bins);
+
+	fprintf(out, "# %f, sweeps %llu, windows %u\n",
+	        ((double)stats->last_clk100ns)/10000000,
+	        (unsigned long long)stats->sweeps, stats->windows);
+	for (i = 0; i < n; i++) {
+		fprintf(out, "%d, %d, %.1f, %d, %d, %d, %d, %.3f\n",
+		        summary[i].freq_lo, summary[i].freq_hi, summary[i].avg,
+		        summary[i].max_hold, summary[i].min_hold,
+		        summary[i].p50, summary[i].p90, summary[i].occupancy);
+	}
+	fflush(out);
+	free(summary);
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2026 Great Scott Gadgets
+ *
+ * This file is part of Project Ubertooth.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __UBERTOOTH_SPECAN_H__
+#define __UBERTOOTH_SPECAN_H__
+
+#include <stdio.h>
+#include "ubertooth_control.h"
+
+/* Running statistics over SPECAN packets. All RSSI values are raw CC2400
+ * readings, as found in the packets, so that nothing is lost to rounding
+ * until a summary is produced. */
+
+#define SPECAN_HIST_BINS 256
+
+/* most samples a single SPECAN or SPECAN_COMPACT packet can hold */
+#define SPECAN_MAX_SAMPLES SPECAN_COMPACT_MAX
+
+typedef struct {
+	uint16_t low_freq;
+	uint16_t high_freq;
+	uint16_t num_bins;
+
+	/* configuration */
+	float alpha;                /* EMA weight of a new sample, 0 < alpha <= 1 */
+	int8_t occupancy_threshold; /* a sample at or above this is "occupied" */
+	uint32_t window_sweeps;     /* sweeps per occupancy window */
+
+	/* per-bin state */
+	float* avg;
+	int8_t* max_hold;
+	int8_t* min_hold;
+	uint32_t* hist;             /* num_bins * SPECAN_HIST_BINS counts */
+	uint32_t* window_occupied;
+	uint32_t* window_samples;
+	float* occupancy;           /* duty cycle of the last complete window */
+
+	uint64_t samples;
+	uint64_t sweeps;
+	uint32_t windows;
+	uint32_t window_pos;
+	uint32_t last_clk100ns;
+} specan_stats_t;
+
+/* One line of a decimated summary, covering freq_lo..freq_hi inclusive */
+typedef struct {
+	uint16_t freq_lo;
+	uint16_t freq_hi;
+	float avg;
+	int8_t max_hold;
+	int8_t min_hold;
+	int8_t p50;
+	int8_t p90;
+	float occupancy;
+} specan_summary_t;
+
+int specan_unpack(const usb_pkt_rx* rx, uint16_t* frequencies, int8_t* rssi,
+                  int max);
+
+specan_stats_t* specan_stats_init(uint16_t low_freq, uint16_t high_freq,
+                                  float alpha, int8_t occupancy_threshold,
+                                  uint32_t window_sweeps);
+void specan_stats_free(specan_stats_t* stats);
+void specan_stats_reset(specan_stats_t* stats);
+
+void specan_stats_add_sample(specan_stats_t* stats, uint16_t frequency,
+                             int8_t rssi);
+void specan_stats_add_packet(specan_stats_t* stats, const usb_pkt_rx* rx);
+
+int8_t specan_stats_percentile(const specan_stats_t* stats, uint16_t frequency,
+                               unsigned pct);
+int specan_stats_summarise(const specan_stats_t* stats, unsigned decimation,
+                           specan_summary_t* out, int max_out);
+void specan_stats_print(const specan_stats_t* stats, unsigned decimation,
+                        FILE* out);
+
+#endif /* __UBERTOOTH_SPECAN_H__ */
@@ -0,0 +1,205 @@
+/*
+ * Copyright 2026 Great Scott Gadgets
+ *
+ * This file is part of Project Ubertooth.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "ubertooth_trace.h"
+#include <stdlib.h>
+#include <string.h>
+
+const char* trace_event_name(uint8_t id)
+{
+	switch (id) {
+	case TRACE_HOP_START:         return "hop start";
+	case TRACE_HOP_LOCK:          return "hop lock";
+	case TRACE_LE_RX:             return "le rx";
+	case TRACE_LE_PACKET:         return "le packet";
+	case TRACE_LE_CRC_FAIL:       return "le crc fail";
+	case TRACE_LE_RX_RESTART:     return "le rx restart";
+	case TRACE_PROMISC_STATE:     return "promisc state";
+	case TRACE_PROMISC_OBSERVE:   return "promisc observe";
+	case TRACE_PROMISC_SOLVE:     return "promisc solve";
+	case TRACE_CLOCK_TRIM:        return "clock trim";
+	case TRACE_LE_FOLLOW_SWITCH:  return "le follow switch";
+	default:                      return "unknown";
+	}
+}
+
+/* Chrome trace spans: an event opens or closes one on its own thread, or
+ * is drawn as an instant */
+enum { SPAN_NONE, SPAN_BEGIN, SPAN_END };
+
+static int span_of(uint8_t id, const char** name, int* tid)
+{
+	switch (id) {
+	case TRACE_HOP_START:
+		*name = "retune"; *tid = 1;
+		return SPAN_BEGIN;
+	case TRACE_HOP_LOCK:
+		*name = "retune"; *tid = 1;
+		return SPAN_END;
+	case TRACE_LE_RX:
+		*name = "le packet"; *tid = 2;
+		return SPAN_BEGIN;
+	case TRACE_LE_RX_RESTART:
+		*name = "le packet"; *tid = 2;
+		return SPAN_END;
+	case TRACE_PROMISC_STATE:
+	case TRACE_PROMISC_OBSERVE:
+	case TRACE_PROMISC_SOLVE:
+		*name = trace_event_name(id); *tid = 3;
+		return SPAN_NONE;
+	default:
+		*name = trace_event_name(id); *tid = 2;
+		return SPAN_NONE;
+	}
+}
+
+trace_writer_t* trace_writer_open(FILE* out, int chrome)
+{
+	trace_writer_t* tw = (trace_writer_t*)calloc(1, sizeof(trace_writer_t));
+	if (tw == NULL)
+		return NULL;
+
+	tw->out = out;
+	tw->chrome = chrome;
+	if (chrome)
+		fprintf(out, "[\n");
+	else
+		fprintf(out, "#        time_us     delta_us  event\n");
+	return tw;
+}
+
+/* A path ending in .json gets the Chrome format, anything else a text
+ * timeline; "-" is stdout. */
+trace_writer_t* trace_writer_open_file(const char* path)
+{
+	trace_writer_t* tw;
+	size_t len = strlen(path);
+	int chrome = len > 5 && !strcmp(path + len - 5, ".json");
+	FILE* out;
+
+	if (!strcmp(path, "-"))
+		return trace_writer_open(stdout, 0);
+
+	out = fopen(path, "w");
+	if (out == NULL)
+		return NULL;
+
+	tw = trace_writer_open(out, chrome);
+	if (tw == NULL) {
+		fclose(out);
+		return NULL;
+	}
+	tw->close_out = 1;
+	return tw;
+}
+
+/* The closing bracket is optional in the Chrome format, so a trace cut
+ * short by ^C still loads. */
+void trace_writer_close(trace_writer_t* tw)
+{
+	if (tw == NULL)
+		return;
+
+	if (tw->chrome)
+		fprintf(tw->out, "{\"name\": \"end\", \"ph\": \"i\", \"s\": \"g\", "
+		        "\"ts\": %.2f, \"pid\": 0, \"tid\": 0}\n]\n",
+		        (double)(tw->prev - tw->first) / TRACE_CYCLES_PER_US);
+	else
+		fprintf(tw->out, "# %llu events, %llu lost\n",
+		        (unsigned long long)tw->events, (unsigned long long)tw->lost);
+	if (tw->close_out)
+		fclose(tw->out);
+	else
+		fflush(tw->out);
+	free(tw);
+}
+
+static void write_event(trace_writer_t* tw, uint64_t cycles, uint8_t id,
+                        uint16_t arg)
+{
+	double ts = (double)(cycles - tw->first) / TRACE_CYCLES_PER_US;
+	const char* name;
+	int tid, span;
+
+	if (!tw->chrome) {
+		fprintf(tw->out, "%16.2f %12.2f  %s %u\n", ts,
+		        (double)(cycles - tw->prev) / TRACE_CYCLES_PER_US,
+		        trace_event_name(id), arg);
+		return;
+	}
+
+	span = span_of(id, &name, &tid);
+	fprintf(tw->out, "{\"name\": \"%s\", \"ph\": \"%s\", \"ts\": %.2f, "
+	        "\"pid\": 0, \"tid\": %d, \"args\": {\"arg\": %u}},\n",
+	        name, span == SPAN_BEGIN ? "B" : span == SPAN_END ? "E" : "i",
+	        ts, tid, arg);
+}
+
+/* Decode n raw events. lost events preceded them. Gaps of more than 2^32
+ * cycles (about 43 s) between events cannot be told from shorter ones. */
+void trace_writer_add(trace_writer_t* tw, const uint8_t* events, int n,
+                      uint32_t lost)
+{
+	const uint8_t* e;
+	uint32_t cycles;
+	uint64_t t;
+	int i;
+
+	if (lost) {
+		tw->lost += lost;
+		if (!tw->chrome)
+			fprintf(tw->out, "# %u events lost\n", lost);
+	}
+
+	for (i = 0; i < n; i++) {
+		e = &events[i * TRACE_EVENT_LEN];
+		cycles = e[0] | e[1] << 8 | e[2] << 16 | (uint32_t)e[3] << 24;
+
+		if (tw->started && cycles < tw->last_cycles)
+			tw->upper += 1ull << 32;
+		tw->last_cycles = cycles;
+		t = tw->upper + cycles;
+		if (!tw->started) {
+			tw->first = tw->prev = t;
+			tw->started = 1;
+		}
+
+		write_event(tw, t, e[4], e[6] | e[7] << 8);
+		tw->prev = t;
+		tw->events++;
+	}
+	fflush(tw->out);
+}
+
+/* Decode a TRACE packet. Returns 0 for any other packet type. */
+int trace_writer_add_packet(trace_writer_t* tw, const usb_pkt_rx* rx)
+{
+	int n;
+
+	if (rx->pkt_type != TRACE)
+		return 0;
+
+	n = rx->data[0];
+	if (n > TRACE_PACKET_MAX)
+		n = TRACE_PACKET_MAX;
+	trace_writer_add(tw, &rx->data[2], n, rx->data[1]);
+	return 1;
+}
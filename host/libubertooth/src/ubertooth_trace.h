@@ -0,0 +1,57 @@
+/*
+ * Copyright 2026 Great Scott Gadgets
+ *
+ * This file is part of Project Ubertooth.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __UBERTOOTH_TRACE_H__
+#define __UBERTOOTH_TRACE_H__
+
+#include <stdio.h>
+#include "ubertooth_control.h"
+
+/* Decoder for firmware trace events (see UBERTOOTH_TRACE in
+ * ubertooth_interface.h), writing either a text timeline or the Chrome
+ * trace event format that chrome://tracing and Perfetto load. */
+
+typedef struct {
+	FILE* out;
+	int chrome;
+	int close_out;
+
+	/* the 32-bit cycle counter, unwrapped */
+	int started;
+	uint32_t last_cycles;
+	uint64_t upper;
+	uint64_t first;
+	uint64_t prev;
+
+	uint64_t events;
+	uint64_t lost;
+} trace_writer_t;
+
+const char* trace_event_name(uint8_t id);
+
+trace_writer_t* trace_writer_open(FILE* out, int chrome);
+trace_writer_t* trace_writer_open_file(const char* path);
+void trace_writer_close(trace_writer_t* tw);
+void trace_writer_add(trace_writer_t* tw, const uint8_t* events, int n,
+                      uint32_t lost);
+int trace_writer_add_packet(trace_writer_t* tw, const usb_pkt_rx* rx);
+
+#endif /* __UBERTOOTH_TRACE_H__ */
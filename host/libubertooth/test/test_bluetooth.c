@@ -0,0 +1,688 @@
+/*
+ * Copyright 2026 Great Scott Gadgets
+ *
+ * This file is part of Project Ubertooth.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Checks of the Bluetooth algorithms shared by the firmware and
+ * libubertooth against known vectors, followed by a rough benchmark of the
+ * ones that run per packet or per DMA buffer in the firmware. Exits
+ * non-zero if any check fails. */
+
+#include "ubertooth_bluetooth.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static int failures = 0;
+static uint32_t lcg_state = 1;
+
+#define CHECK_EQ(what, got, want) \
+	check_eq(__FILE__, __LINE__, what, (long long)(got), (long long)(want))
+
+static void check_eq(const char* file, int line, const char* what,
+                     long long got, long long want)
+{
+	if (got == want)
+		return;
+	fprintf(stderr, "%s:%d: %s: got %lld, expected %lld\n",
+	        file, line, what, got, want);
+	failures++;
+}
+
+static void put_symbol(uint8_t* buf, int pos, int bit)
+{
+	buf[pos >> 3] &= ~(0x80 >> (pos & 7));
+	if (bit)
+		buf[pos >> 3] |= 0x80 >> (pos & 7);
+}
+
+/* Write count symbols of v, LSB first as they go on air, into buf at
+ * symbol position pos. */
+static void put_symbols(uint8_t* buf, int pos, uint64_t v, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		put_symbol(buf, pos + i, (v >> i) & 1);
+}
+
+/* Small deterministic generator for the simulations */
+static uint32_t lcg(void)
+{
+	lcg_state = lcg_state * 1103515245u + 12345u;
+	return lcg_state >> 16;
+}
+
+/*
+ * Known vectors
+ */
+
+/* Basic hop sequence, from the shift and butterfly form of the kernel in
+ * Vol 2, Part B, Section 2.6 */
+static const uint32_t hop_addresses[] = { 0x00000000, 0x2a96ef25, 0x6587cba9 };
+static const uint32_t hop_clocks[] = {
+	0x0000000, 0x0000002, 0x0000004, 0x0000010, 0x0001000,
+	0x0123456, 0x03ffffe, 0x5a5a5a4, 0xffffffe,
+};
+static const uint16_t hop_channels[3][9] = {
+	{ 2402, 2466, 2404, 2410, 2478, 2452, 2443, 2432, 2438 },
+	{ 2451, 2436, 2415, 2457, 2448, 2413, 2456, 2417, 2425 },
+	{ 2418, 2454, 2467, 2422, 2415, 2447, 2445, 2436, 2473 },
+};
+
+static void test_hop_vectors(void)
+{
+	static const struct {
+		uint8_t z, p_high;
+		uint16_t p_low;
+		uint8_t out;
+	} perm5[] = {
+		{ 0x00, 0x00, 0x000,  0 },
+		{ 0x01, 0x00, 0x1ff,  1 },
+		{ 0x15, 0x1f, 0x000,  7 },
+		{ 0x0a, 0x11, 0x155, 17 },
+		{ 0x1f, 0x0c, 0x0aa, 31 },
+		{ 0x07, 0x1b, 0x1c3, 13 },
+	};
+	bt_hop_t hop;
+	uint16_t seq[4];
+	unsigned i, j;
+
+	for (i = 0; i < sizeof(perm5) / sizeof(perm5[0]); i++)
+		CHECK_EQ("bt_perm5",
+		         bt_perm5(perm5[i].z, perm5[i].p_high, perm5[i].p_low),
+		         perm5[i].out);
+
+	for (i = 0; i < 3; i++) {
+		bt_hop_init(&hop, hop_addresses[i], NULL);
+		for (j = 0; j < 9; j++)
+			CHECK_EQ("bt_hop_next", bt_hop_next(&hop, hop_clocks[j]),
+			         hop_channels[i][j]);
+	}
+
+	/* the sequence helper steps the clock, 0 2 4 6 */
+	bt_hop_init(&hop, hop_addresses[0], NULL);
+	bt_hop_sequence(&hop, 0, 2, seq, 4);
+	CHECK_EQ("bt_hop_sequence[0]", seq[0], hop_channels[0][0]);
+	CHECK_EQ("bt_hop_sequence[1]", seq[1], hop_channels[0][1]);
+	CHECK_EQ("bt_hop_sequence[2]", seq[2], hop_channels[0][2]);
+	CHECK_EQ("bt_hop_sequence[3]", seq[3], bt_hop_next(&hop, 6));
+}
+
+/*
+ * Reference implementations, written the way the spec describes them
+ */
+
+/* PERM5 as 14 butterflies on an array of bits */
+static uint8_t ref_perm5(uint8_t z, uint8_t p_high, uint16_t p_low)
+{
+	static const uint8_t index1[] = {0, 2, 1, 3, 0, 1, 0, 3, 1, 0, 2, 1, 0, 1};
+	static const uint8_t index2[] = {1, 3, 2, 4, 4, 3, 2, 4, 4, 3, 4, 3, 3, 2};
+	uint8_t tmp, output, z_bit[5], p[14];
+	int i;
+
+	for (i = 0; i < 9; i++)
+		p[i] = (p_low >> i) & 0x01;
+	for (i = 0; i < 5; i++)
+		p[i + 9] = (p_high >> i) & 0x01;
+	for (i = 0; i < 5; i++)
+		z_bit[i] = (z >> i) & 0x01;
+
+	for (i = 13; i >= 0; i--) {
+		if (p[i]) {
+			tmp = z_bit[index1[i]];
+			z_bit[index1[i]] = z_bit[index2[i]];
+			z_bit[index2[i]] = tmp;
+		}
+	}
+
+	output = 0;
+	for (i = 0; i < 5; i++)
+		output += z_bit[i] << i;
+	return output;
+}
+
+/* The hop kernel with plain % reductions over a bank of 79 or fewer */
+static uint16_t ref_hop_next(uint32_t address, const uint8_t* afh_map,
+                             uint32_t clock)
+{
+	uint8_t bank[BT_NUM_CHANNELS];
+	uint8_t a1, b, c1, e, a, c, x, y1, perm;
+	uint16_t d1, d, y2;
+	uint32_t base_f;
+	int i, n = 0;
+
+	for (i = 0; i < BT_NUM_CHANNELS; i++) {
+		uint8_t chan = (i * 2) % BT_NUM_CHANNELS;
+		if (afh_map == NULL || afh_map[chan / 8] & (1 << (chan % 8)))
+			bank[n++] = chan;
+	}
+
+	a1 = (address >> 23) & 0x1f;
+	b = (address >> 19) & 0x0f;
+	c1 = ((address >> 4) & 0x10) + ((address >> 3) & 0x08)
+	     + ((address >> 2) & 0x04) + ((address >> 1) & 0x02)
+	     + (address & 0x01);
+	d1 = (address >> 10) & 0x1ff;
+	e = ((address >> 7) & 0x40) + ((address >> 6) & 0x20)
+	    + ((address >> 5) & 0x10) + ((address >> 4) & 0x08)
+	    + ((address >> 3) & 0x04) + ((address >> 2) & 0x02)
+	    + ((address >> 1) & 0x01);
+
+	x = (clock >> 2) & 0x1f;
+	y1 = (clock >> 1) & 0x01;
+	y2 = y1 << 5;
+	a = (a1 ^ (clock >> 21)) & 0x1f;
+	c = (c1 ^ (clock >> 16)) & 0x1f;
+	d = (d1 ^ (clock >> 7)) & 0x1ff;
+	base_f = (clock >> 3) & 0x1fffff0;
+
+	perm = ref_perm5(((x + a) % 32) ^ b, (y1 * 0x1f) ^ c, d);
+	return 2402 + bank[(perm + e + base_f % n + y2) % n];
+}
+
+/* The table-driven PERM5 and the division-free kernel against the
+ * references, every PERM5 input and a spread of clocks and channel maps */
+static void test_hop_reference(void)
+{
+	static const uint32_t addresses[] = {
+		0x00000000, 0xffffffff, 0x2a96ef25, 0x6587cba9, 0x9e8b33,
+	};
+	static const uint8_t maps[][10] = {
+		{ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x7f },
+		{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40 },
+		{ 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+		{ 0xff, 0x0f, 0x00, 0x00, 0xf0, 0xff, 0x00, 0x00, 0x00, 0x00 },
+		{ 0x55, 0xaa, 0x55, 0xaa, 0x55, 0xaa, 0x55, 0xaa, 0x55, 0x2a },
+	};
+	bt_hop_t hop;
+	uint32_t clock, z, ph, pl;
+	unsigned i, m;
+	int bad;
+
+	bad = 0;
+	for (pl = 0; pl < 512; pl++)
+		for (ph = 0; ph < 32; ph++)
+			for (z = 0; z < 32; z++)
+				bad += bt_perm5(z, ph, pl) != ref_perm5(z, ph, pl);
+	CHECK_EQ("bt_perm5 mismatches", bad, 0);
+
+	for (i = 0; i < sizeof(addresses) / sizeof(addresses[0]); i++) {
+		bad = 0;
+		bt_hop_init(&hop, addresses[i], NULL);
+		/* every CLK27-1 value near the bottom, then strides over the rest */
+		for (clock = 0; clock < 0x40000; clock += 2)
+			bad += bt_hop_next(&hop, clock)
+			       != ref_hop_next(addresses[i], NULL, clock);
+		for (clock = 0x40000; clock < 0x0ffffffe; clock += 0x1fff2)
+			bad += bt_hop_next(&hop, clock)
+			       != ref_hop_next(addresses[i], NULL, clock);
+		CHECK_EQ("bt_hop_next mismatches", bad, 0);
+
+		for (m = 0; m < sizeof(maps) / sizeof(maps[0]); m++) {
+			bad = 0;
+			bt_hop_init(&hop, addresses[i], maps[m]);
+			for (clock = 0; clock < 0x0ffffffe; clock += 0x3ff2)
+				bad += bt_hop_next(&hop, clock)
+				       != ref_hop_next(addresses[i], maps[m], clock);
+			CHECK_EQ("bt_hop_next AFH mismatches", bad, 0);
+		}
+	}
+}
+
+#define AC_TARGET 0x475c58cc73345e72ULL
+
+static void test_ac_search(void)
+{
+	bt_ac_correlator_t corr;
+	uint8_t buf[32], buf2[16];
+	uint64_t targets[2] = { 0x0123456789abcdefULL, AC_TARGET };
+	int i, which = -1;
+
+	/* the correlator window holds the first symbol in its MSB, put
+	 * AC_TARGET at position 37 with 3 errors */
+	memset(buf, 0x55, sizeof(buf));
+	for (i = 0; i < 64; i++)
+		put_symbol(buf, 37 + i, (AC_TARGET >> (63 - i)) & 1);
+	buf[(37 + 3) >> 3] ^= 0x80 >> ((37 + 3) & 7);
+	buf[(37 + 30) >> 3] ^= 0x80 >> ((37 + 30) & 7);
+	buf[(37 + 61) >> 3] ^= 0x80 >> ((37 + 61) & 7);
+
+	bt_ac_init(&corr);
+	CHECK_EQ("bt_ac_search", bt_ac_search(&corr, AC_TARGET, buf,
+	         sizeof(buf), 5), 37 + 64);
+	bt_ac_init(&corr);
+	CHECK_EQ("bt_ac_search, too many errors", bt_ac_search(&corr, AC_TARGET,
+	         buf, sizeof(buf), 3), -1);
+	bt_ac_init(&corr);
+	CHECK_EQ("bt_ac_search_set", bt_ac_search_set(&corr, targets, 2, buf,
+	         sizeof(buf), 5, &which), 37 + 64);
+	CHECK_EQ("bt_ac_search_set which", which, 1);
+
+	/* split over two buffers, the window carries the first part */
+	bt_ac_init(&corr);
+	CHECK_EQ("bt_ac_search, first half", bt_ac_search(&corr, AC_TARGET, buf,
+	         8, 5), -1);
+	memcpy(buf2, buf + 8, sizeof(buf2));
+	CHECK_EQ("bt_ac_search, second half", bt_ac_search(&corr, AC_TARGET,
+	         buf2, sizeof(buf2), 5), 37 + 64 - 8 * 8);
+}
+
+static void test_le_crc(void)
+{
+	/* ADV_IND header and AdvA, CRCInit 0x555555 */
+	static const uint8_t adv[] = { 0x40, 0x06, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66 };
+	static const uint8_t empty[] = { 0x01, 0x00 };
+	uint32_t init = le_reverse_bits24(0x123456);
+
+	CHECK_EQ("le_reverse_bits24", le_reverse_bits24(0x555555), 0xaaaaaa);
+	CHECK_EQ("le_calc_crc adv", le_calc_crc(0xaaaaaa, adv, sizeof(adv)),
+	         0x3e336a);
+	CHECK_EQ("le_crcgen_lut adv", le_crcgen_lut(0xaaaaaa, adv, sizeof(adv)),
+	         0x3e336a);
+	CHECK_EQ("le_calc_crc empty", le_calc_crc(init, empty, sizeof(empty)),
+	         0x8adc48);
+	CHECK_EQ("le_crcgen_lut empty", le_crcgen_lut(init, empty, sizeof(empty)),
+	         0x8adc48);
+
+	/* promiscuous mode runs the CRC back to CRCInit, in air order */
+	CHECK_EQ("le_reverse_crc adv", le_reverse_crc(0x3e336a, adv, sizeof(adv)),
+	         0x555555);
+	CHECK_EQ("le_reverse_crc empty", le_reverse_crc(0x8adc48, empty,
+	         sizeof(empty)), 0x123456);
+}
+
+static void test_le_channels(void)
+{
+	/* MHz above 2402 to channel index, advertising channels at the ends */
+	static const struct {
+		uint8_t offset, idx;
+	} channels[] = {
+		{  0, 37 }, {  2,  0 }, { 22, 10 }, { 24, 38 },
+		{ 26, 11 }, { 50, 23 }, { 76, 36 }, { 78, 39 },
+	};
+	unsigned i;
+	int bad;
+
+	for (i = 0; i < sizeof(channels) / sizeof(channels[0]); i++) {
+		CHECK_EQ("le_channel_index", le_channel_index(channels[i].offset),
+		         channels[i].idx);
+		CHECK_EQ("le_channel_index_to_phys",
+		         le_channel_index_to_phys(channels[i].idx),
+		         2402 + channels[i].offset);
+	}
+
+	bad = 0;
+	for (i = 0; i < LE_NUM_CHANNELS; i++)
+		bad += le_channel_index(le_channel_index_to_phys(i) - 2402) != i;
+	CHECK_EQ("le_channel_index round trip mismatches", bad, 0);
+
+	CHECK_EQ("le_next_channel_index", le_next_channel_index(3, 16), 19);
+	CHECK_EQ("le_next_channel_index wraps", le_next_channel_index(36, 5), 4);
+}
+
+static void test_le_find_empty_pdu(void)
+{
+	static const uint8_t channels[] = { 0, 12, 36 };
+	uint8_t buf[24], pkt[6];
+	uint16_t header;
+	unsigned i;
+	int pos;
+
+	for (i = 0; i < sizeof(channels); i++) {
+		/* whitened empty PDU with NESN and SN set, after its AA */
+		header = 0x000d ^ (le_whitening_word[channels[i]][0] & 0xffff);
+		pos = 45 + 3 * i;
+		memset(buf, 0, sizeof(buf));
+		put_symbols(buf, pos - 32, 0x50654d2fUL, 32);
+		put_symbols(buf, pos, header, 16);
+
+		CHECK_EQ("le_find_empty_pdu",
+		         le_find_empty_pdu(buf, 0, 8 * (sizeof(buf) - 3), channels[i]),
+		         pos);
+		CHECK_EQ("le_find_empty_pdu, after it",
+		         le_find_empty_pdu(buf, pos + 1, 8 * (sizeof(buf) - 3),
+		                           channels[i]), -1);
+
+		le_unwhiten(buf, sizeof(buf), pos, channels[i], pkt, sizeof(pkt));
+		CHECK_EQ("le_unwhiten aa", pkt[0] | (pkt[1] << 8) | (pkt[2] << 16)
+		         | ((uint32_t)pkt[3] << 24), 0x50654d2fUL);
+		CHECK_EQ("le_unwhiten header", pkt[4] | (pkt[5] << 8), 0x000d);
+	}
+}
+
+static void test_le_aa_cache(void)
+{
+	le_aa_cache_t cache;
+	le_aa_entry_t top[LE_AA_CACHE_SIZE];
+	uint32_t i;
+	int n, found;
+
+	le_aa_cache_init(&cache);
+	CHECK_EQ("le_aa_cache_top empty", le_aa_cache_top(&cache, top, 4), 0);
+	for (i = 1; i <= 3; i++)
+		CHECK_EQ("le_aa_cache_see", le_aa_cache_see(&cache, 0x50654d2f), i);
+	le_aa_cache_see(&cache, 0x8e89bed6);
+	le_aa_cache_see(&cache, 0x8e89bed6);
+	le_aa_cache_see(&cache, 0x12345678);
+
+	n = le_aa_cache_top(&cache, top, 2);
+	CHECK_EQ("le_aa_cache_top count", n, 2);
+	CHECK_EQ("le_aa_cache_top first", top[0].aa, 0x50654d2f);
+	CHECK_EQ("le_aa_cache_top first count", top[0].count, 3);
+	CHECK_EQ("le_aa_cache_top second", top[1].aa, 0x8e89bed6);
+
+	/* noise seen once each does not push out an AA seen more often */
+	for (i = 0; i < 500; i++)
+		le_aa_cache_see(&cache, 0x9e000000 + i * 0x01010101);
+	CHECK_EQ("le_aa_cache_see after noise", le_aa_cache_see(&cache,
+	         0x50654d2f), 4);
+
+	/* but it is forgotten once it has not been seen for long enough */
+	for (i = 0; i <= LE_AA_CACHE_MAX_AGE; i++)
+		le_aa_cache_see(&cache, 0x31000000 + i * 0x00010203);
+	n = le_aa_cache_top(&cache, top, LE_AA_CACHE_SIZE);
+	found = 0;
+	for (i = 0; i < (uint32_t)n; i++)
+		found += top[i].aa == 0x50654d2f;
+	CHECK_EQ("le_aa_cache_top after aging", found, 0);
+}
+
+/* drift in BT_CLOCK_RATE units, 1 ppm of a CLKN period is 204.8 of them */
+#define PPM(x) ((x) * 2048 / 10)
+
+/* Follow a piconet whose clock runs ppm faster than ours, heard at random
+ * intervals with the error only known to the symbol, as in the firmware.
+ * Returns the largest phase error in the second half, in CLK100NS ticks. */
+static int32_t clock_track_sim(bt_clock_track_t* ct, int ppm, int updates)
+{
+	/* phase in 2^-16 ticks, the resolution of the rate */
+	int64_t phase = (int64_t)700 << 16, worst = 0;
+	uint32_t clkn = 0, step;
+	int32_t err, trim;
+	int i;
+
+	lcg_state = 1;
+	for (i = 0; i < updates; i++) {
+		step = 2 + lcg() % 60;
+		clkn += step;
+		phase += (int64_t)step * (PPM(ppm) - ct->rate);
+		err = (int32_t)((phase >> 16) / 10) * 10
+		      + ((int)(lcg() % 3) - 1) * 10;
+		trim = bt_clock_track_update(ct, err, clkn);
+		phase -= (int64_t)trim << 16;
+		if (i >= updates / 2 && (phase > worst || -phase > worst))
+			worst = phase > 0 ? phase : -phase;
+	}
+	return (int32_t)(worst >> 16);
+}
+
+static void test_clock_track(void)
+{
+	static const int drifts[] = { -150, -50, 0, 20, 100, 180 };
+	bt_clock_track_t ct;
+	int32_t worst, trim;
+	unsigned i;
+
+	/* lock, then ignore updates closer together than MIN_DT */
+	bt_clock_track_init(&ct, 0);
+	CHECK_EQ("first trim", bt_clock_track_update(&ct, 700, 1000), 700);
+	CHECK_EQ("locked", ct.locked, 1);
+	CHECK_EQ("too soon", bt_clock_track_update(&ct, 100,
+	         1000 + BT_CLOCK_TRACK_MIN_DT - 1), 0);
+	CHECK_EQ("half trim", bt_clock_track_update(&ct, 100,
+	         1000 + BT_CLOCK_TRACK_MIN_DT), 50);
+
+	/* outliers are dropped until RELOCK of them come in a row */
+	for (i = 1; i < BT_CLOCK_TRACK_RELOCK; i++)
+		CHECK_EQ("outlier", bt_clock_track_update(&ct, 3000,
+		         2000 + 100 * i), 0);
+	CHECK_EQ("relocks before", ct.relocks, 1);
+	trim = bt_clock_track_update(&ct, 3000, 2000 + 100 * i);
+	CHECK_EQ("relock trim", trim, 3000);
+	CHECK_EQ("relocks after", ct.relocks, 2);
+
+	/* the rate settles within 2 ppm of the drift and the phase within two
+	 * symbols of the piconet, with the rate clamped beyond 200 ppm */
+	for (i = 0; i < sizeof(drifts) / sizeof(drifts[0]); i++) {
+		bt_clock_track_init(&ct, 0);
+		worst = clock_track_sim(&ct, drifts[i], 2000);
+		CHECK_EQ("clock track rate within 2 ppm",
+		         ct.rate > PPM(drifts[i]) - PPM(2)
+		         && ct.rate < PPM(drifts[i]) + PPM(2), 1);
+		CHECK_EQ("clock track phase within 20 ticks", worst <= 20, 1);
+		CHECK_EQ("clock track relocks", ct.relocks, 1);
+	}
+	bt_clock_track_init(&ct, 0);
+	clock_track_sim(&ct, 300, 2000);
+	CHECK_EQ("clock track rate clamp", ct.rate, BT_CLOCK_RATE_MAX);
+}
+
+/* Listen the way promiscuous mode does, on one channel until a second
+ * packet is heard and then wherever the connection is least likely to have
+ * been, with timing jitter, a clock drift and one packet in four heard late
+ * in its connection event. Returns what le_hop_solver_solve() last said,
+ * and the connection events it took in *events. */
+static int hop_solver_sim(le_hop_solver_t* s, uint16_t interval, uint8_t inc,
+                          long* events)
+{
+	uint32_t clk = lcg() % 100000, heard;
+	uint8_t c = lcg() % LE_NUM_DATA_CHANNELS;
+	uint8_t listen = lcg() % LE_NUM_DATA_CHANNELS;
+	int r = 2;
+	long ev;
+
+	le_hop_solver_init(s);
+	for (ev = 0; ev < 20000 && r != 1; ev++) {
+		clk += interval * LE_BASECLK + lcg() % 40 - 20;
+		c = le_next_channel_index(c, inc);
+		if (c != listen || lcg() % 10 == 0)
+			continue;
+		heard = clk + (lcg() % 4 == 0 ? 2500 : 0);
+		if (!le_hop_solver_add(s, heard, c))
+			continue;
+		r = le_hop_solver_solve(s);
+		if (r == 0) {
+			le_hop_solver_init(s);
+			le_hop_solver_add(s, heard, c);
+		}
+		if (s->n >= 2)
+			listen = (listen + 1 + s->n) % LE_NUM_DATA_CHANNELS;
+	}
+	*events = ev;
+	return r;
+}
+
+static void test_hop_solver(void)
+{
+	le_hop_solver_t s;
+	uint32_t clk = 123456;
+	uint16_t interval;
+	uint8_t inc, c;
+	long events, total = 0;
+	int i, r, k, solved = 0, multiple = 0, wrong = 0;
+
+	/* interval 24 (30 ms), increment 7, heard every 5th event */
+	le_hop_solver_init(&s);
+	for (i = 0, c = 3; i < LE_HOP_SOLVER_MIN_OBS; i++) {
+		CHECK_EQ("solver add", le_hop_solver_add(&s, clk, c), 1);
+		CHECK_EQ("solver same event", le_hop_solver_add(&s, clk + 1500, c), 0);
+		r = le_hop_solver_solve(&s);
+		if (i < LE_HOP_SOLVER_MIN_OBS - 1)
+			CHECK_EQ("solver too few", r, 2);
+		clk += (5 + i) * 24 * LE_BASECLK;
+		c = (c + (5 + i) * 7) % LE_NUM_DATA_CHANNELS;
+	}
+	CHECK_EQ("solver solved", r, 1);
+	CHECK_EQ("solver interval", s.conn_interval, 24);
+	CHECK_EQ("solver increment", s.channel_increment, 7);
+
+	/* channels no increment reaches in those hops */
+	le_hop_solver_init(&s);
+	le_hop_solver_add(&s, 0, 0);
+	le_hop_solver_add(&s, 24 * LE_BASECLK, 0);
+	CHECK_EQ("solver no fit", le_hop_solver_solve(&s), 0);
+
+	/* Random connections. When every gap heard happens to be a multiple of
+	 * k events, k times the interval hopping k times the increment fits
+	 * just as well, and being the longest it is the answer. That must stay
+	 * rare, and nothing else may come out. */
+	lcg_state = 1;
+	for (i = 0; i < 500; i++) {
+		interval = LE_CONN_INTERVAL_MIN + lcg() % 400;
+		inc = LE_HOP_INCREMENT_MIN + lcg() % 12;
+		r = hop_solver_sim(&s, interval, inc, &events);
+		total += events;
+		if (r != 1)
+			continue;
+		solved++;
+		if (s.conn_interval == interval && s.channel_increment == inc)
+			continue;
+		k = s.conn_interval / interval;
+		if (s.conn_interval % interval == 0
+		    && (inc * k) % LE_NUM_DATA_CHANNELS == s.channel_increment)
+			multiple++;
+		else
+			wrong++;
+	}
+	CHECK_EQ("solver simulations solved", solved, 500);
+	CHECK_EQ("solver simulations wrong", wrong, 0);
+	CHECK_EQ("solver simulations multiples under 1%", multiple < 5, 1);
+	printf("hop solver: %.1f connection events to solve on average, "
+	       "%d of 500 solved as a multiple\n", (double)total / 500, multiple);
+}
+
+/*
+ * Benchmarks, reported in cycles per call where the cycle counter can be
+ * read from user space and in nanoseconds otherwise
+ */
+
+#define BENCH_CALLS 200000
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BENCH_UNIT "cycles"
+static uint64_t bench_now(void)
+{
+	return __builtin_ia32_rdtsc();
+}
+#else
+#define BENCH_UNIT "ns"
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#endif
+
+static volatile uint32_t bench_sink;
+
+static void bench_report(const char* name, uint64_t start, int calls)
+{
+	printf("%-24s %8.1f %s/call\n", name,
+	       (double)(bench_now() - start) / calls, BENCH_UNIT);
+}
+
+static void bench(void)
+{
+	bt_hop_t hop;
+	bt_ac_correlator_t corr;
+	bt_clock_track_t ct;
+	uint8_t buf[50];  /* one firmware DMA buffer */
+	uint64_t start;
+	uint32_t sum = 0;
+	int i;
+
+	bt_hop_init(&hop, hop_addresses[1], NULL);
+	start = bench_now();
+	for (i = 0; i < BENCH_CALLS; i++)
+		sum += bt_hop_next(&hop, (uint32_t)i << 1);
+	bench_report("bt_hop_next", start, BENCH_CALLS);
+
+	start = bench_now();
+	for (i = 0; i < BENCH_CALLS; i++)
+		sum += bt_perm5(i, i >> 5, i >> 10);
+	bench_report("bt_perm5", start, BENCH_CALLS);
+
+	start = bench_now();
+	for (i = 0; i < BENCH_CALLS; i++)
+		sum += ref_perm5(i, i >> 5, i >> 10);
+	bench_report("bt_perm5, reference", start, BENCH_CALLS);
+
+	for (i = 0; i < (int)sizeof(buf); i++)
+		buf[i] = i * 73;
+	bt_ac_init(&corr);
+	start = bench_now();
+	for (i = 0; i < BENCH_CALLS / 100; i++) {
+		buf[0] = i;
+		sum += bt_ac_search(&corr, AC_TARGET, buf, sizeof(buf), 5);
+	}
+	bench_report("bt_ac_search, 50 bytes", start, BENCH_CALLS / 100);
+
+	start = bench_now();
+	for (i = 0; i < BENCH_CALLS / 10; i++) {
+		buf[0] = i;
+		sum += le_calc_crc(0xaaaaaa, buf, 39);
+	}
+	bench_report("le_calc_crc, 39 bytes", start, BENCH_CALLS / 10);
+
+	start = bench_now();
+	for (i = 0; i < BENCH_CALLS / 10; i++) {
+		buf[0] = i;
+		sum += le_crcgen_lut(0xaaaaaa, buf, 39);
+	}
+	bench_report("le_crcgen_lut, 39 bytes", start, BENCH_CALLS / 10);
+
+	start = bench_now();
+	for (i = 0; i < BENCH_CALLS / 10; i++) {
+		buf[0] = i;
+		sum += le_find_empty_pdu(buf, 0, 8 * (sizeof(buf) - 3), i % 37);
+	}
+	bench_report("le_find_empty_pdu", start, BENCH_CALLS / 10);
+
+	bt_clock_track_init(&ct, 0);
+	start = bench_now();
+	for (i = 0; i < BENCH_CALLS; i++)
+		sum += bt_clock_track_update(&ct, (i & 0x3f) - 32, (uint32_t)i * 40);
+	bench_report("bt_clock_track_update", start, BENCH_CALLS);
+
+	bench_sink = sum;
+}
+
+int main(void)
+{
+	test_hop_vectors();
+	test_hop_reference();
+	test_ac_search();
+	test_le_crc();
+	test_le_channels();
+	test_le_find_empty_pdu();
+	test_le_aa_cache();
+	test_clock_track();
+	test_hop_solver();
+
+	if (failures) {
+		fprintf(stderr, "%d check(s) failed\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+
+	bench();
+	return 0;
+}
@@ -0,0 +1,389 @@
+/*
+ * Copyright 2026 Great Scott Gadgets
+ *
+ * This file is part of Project Ubertooth.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* A model of the CC2400 timing that the fast spectrum sweep relies on, so
+ * that the cached VCO calibration and the RSSI settle measurement can be
+ * checked without a radio. The sweep below follows specan_fast() in
+ * firmware/bluetooth_rxtx/bluetooth_rxtx.c step for step, with the register
+ * layout taken from firmware/common/cc2400.h. The timing figures are
+ * assumptions of the model, not measurements: the device reports its own
+ * with UBERTOOTH_GET_SPECAN_RATE. Exits non-zero if any check fails. */
+
+#include "cc2400.h"
+#include <stdio.h>
+
+static int failures = 0;
+static uint32_t lcg_state = 1;
+
+#define CHECK_EQ(what, got, want) \
+	check_eq(__FILE__, __LINE__, what, (long long)(got), (long long)(want))
+
+static void check_eq(const char* file, int line, const char* what,
+                     long long got, long long want)
+{
+	if (got == want)
+		return;
+	fprintf(stderr, "%s:%d: %s: got %lld, expected %lld\n",
+	        file, line, what, got, want);
+	failures++;
+}
+
+static uint32_t lcg(void)
+{
+	lcg_state = lcg_state * 1103515245u + 12345u;
+	return lcg_state >> 16;
+}
+
+/*
+ * The radio, in 100 ns ticks. Frequencies are in MHz, FSDIV one below.
+ */
+
+#define SPI_TICKS        25   /* one register access over the SPI bus */
+#define CAL_TICKS        650  /* SFSON with a full VCO calibration */
+#define PLL_TICKS        180  /* SFSON with the VCO results overridden */
+#define RSSI_FLOOR       (-100)
+
+static struct {
+	uint32_t now;
+	uint16_t fsdiv, fstst0, fstst2;
+	uint16_t vco_array, vco_current;  /* results of the last calibration */
+	int fs_on, lock_fails;
+	uint32_t lock_at, rx_at;
+	int rx_on;
+	int vco_drift;                    /* temperature since calibration */
+	int sfson, full_cals;
+} radio;
+
+static uint16_t model_vco_array(uint16_t f)
+{
+	return ((f - 2300) * 31 / 200 + radio.vco_drift) & 0x1f;
+}
+
+static uint16_t model_vco_current(uint16_t f)
+{
+	return (20 + (f % 17) + radio.vco_drift) & 0x3f;
+}
+
+/* RSSI settles faster at some frequencies than at others */
+static uint32_t model_settle_ticks(uint16_t f)
+{
+	return 90 + (f * 7) % 60;
+}
+
+static int8_t model_level(uint16_t f)
+{
+	return -90 + (f * 13) % 50;
+}
+
+static uint16_t cc2400_get(uint8_t reg)
+{
+	uint32_t t, settle;
+	int level;
+
+	radio.now += SPI_TICKS;
+	switch (reg) {
+	case FSTST0:
+		return (radio.fstst0 & ~FSTST0_VCO_ARRAY_RES_MASK) | radio.vco_array;
+	case FSTST2:
+		return (radio.fstst2 & ~FSTST2_VCO_CURRENT_RES_MASK)
+		       | radio.vco_current;
+	case RSSI:
+		if (!radio.rx_on)
+			return (uint16_t)((uint8_t)RSSI_FLOOR << 8);
+		/* a linear approach to the level, then one step of noise */
+		t = radio.now - radio.rx_at;
+		settle = model_settle_ticks(radio.fsdiv + 1);
+		level = model_level(radio.fsdiv + 1);
+		if (t < settle)
+			level = RSSI_FLOOR + (level - RSSI_FLOOR) * (int)t / (int)settle;
+		level += lcg() & 1;
+		return (uint16_t)((uint8_t)level << 8);
+	}
+	return 0;
+}
+
+static void cc2400_set(uint8_t reg, uint16_t val)
+{
+	radio.now += SPI_TICKS;
+	switch (reg) {
+	case FSDIV:
+		radio.fsdiv = val;
+		break;
+	case FSTST0:
+		radio.fstst0 = val;
+		break;
+	case FSTST2:
+		radio.fstst2 = val;
+		break;
+	}
+}
+
+static int vco_off_by(uint16_t set, uint16_t want)
+{
+	return set > want ? set - want : want - set;
+}
+
+static void cc2400_strobe(uint8_t reg)
+{
+	uint16_t array, current;
+
+	radio.now += SPI_TICKS;
+	switch (reg) {
+	case SFSON:
+		radio.sfson++;
+		radio.fs_on = 1;
+		array = model_vco_array(radio.fsdiv + 1);
+		current = model_vco_current(radio.fsdiv + 1);
+		if ((radio.fstst0 & FSTST0_VCO_ARRAY_OE)
+		    && (radio.fstst2 & FSTST2_VCO_CURRENT_OE)) {
+			/* the PLL only locks if the VCO is close enough */
+			radio.lock_fails = vco_off_by((radio.fstst0
+			        & FSTST0_VCO_ARRAY_O_MASK) >> FSTST0_VCO_ARRAY_O_SHIFT,
+			        array) > 1
+			    || vco_off_by((radio.fstst2 & FSTST2_VCO_CURRENT_O_MASK)
+			        >> FSTST2_VCO_CURRENT_O_SHIFT, current) > 2;
+			radio.lock_at = radio.now + PLL_TICKS;
+		} else {
+			radio.full_cals++;
+			radio.vco_array = array;
+			radio.vco_current = current;
+			radio.lock_fails = 0;
+			radio.lock_at = radio.now + CAL_TICKS;
+		}
+		break;
+	case SRX:
+		radio.rx_on = 1;
+		radio.rx_at = radio.now;
+		break;
+	case SRFOFF:
+		radio.fs_on = 0;
+		radio.rx_on = 0;
+		break;
+	}
+}
+
+static uint8_t cc2400_status(void)
+{
+	radio.now += SPI_TICKS;
+	if (radio.fs_on && !radio.lock_fails
+	    && (int32_t)(radio.now - radio.lock_at) >= 0)
+		return FS_LOCK;
+	return 0;
+}
+
+/* reading the timer takes a cycle or two, call it one tick */
+#define CLK100NS (++radio.now)
+
+/*
+ * The sweep, as in specan_fast()
+ */
+
+#define BINS 84  /* 2400 to 2483 MHz */
+#define SPECAN_CAL_INVALID   0xffff
+#define SPECAN_SETTLE_MAX    300
+#define SPECAN_LOCK_TIMEOUT  1000
+
+static struct {
+	uint16_t vco_array;
+	uint16_t vco_current;
+} specan_cal[BINS];
+static uint16_t specan_settle_time;
+static int8_t samples[BINS];
+static int lock_timeouts;
+
+static uint32_t clk100ns_since(uint32_t start)
+{
+	return CLK100NS - start;
+}
+
+static uint16_t measure_rssi_settle(void)
+{
+	uint32_t start = CLK100NS, t;
+	int8_t last, cur;
+	uint8_t stable = 0;
+
+	last = cc2400_get(RSSI) >> 8;
+	do {
+		cur = cc2400_get(RSSI) >> 8;
+		if (cur - last <= 1 && last - cur <= 1)
+			stable++;
+		else
+			stable = 0;
+		last = cur;
+		t = clk100ns_since(start);
+	} while (stable < 3 && t < SPECAN_SETTLE_MAX);
+
+	return t;
+}
+
+static void specan_fs_on(uint16_t bin, uint16_t fstst0, uint16_t fstst2)
+{
+	if (specan_cal[bin].vco_array == SPECAN_CAL_INVALID) {
+		cc2400_set(FSTST0, fstst0);
+		cc2400_set(FSTST2, fstst2);
+	} else {
+		cc2400_set(FSTST0, fstst0 | FSTST0_VCO_ARRAY_OE |
+		           (specan_cal[bin].vco_array << FSTST0_VCO_ARRAY_O_SHIFT));
+		cc2400_set(FSTST2, fstst2 | FSTST2_VCO_CURRENT_OE |
+		           (specan_cal[bin].vco_current << FSTST2_VCO_CURRENT_O_SHIFT));
+	}
+	cc2400_strobe(SFSON);
+}
+
+static int specan_fs_lock(uint16_t bin)
+{
+	uint32_t start = CLK100NS;
+
+	while (!(cc2400_status() & FS_LOCK)) {
+		if (clk100ns_since(start) > SPECAN_LOCK_TIMEOUT) {
+			specan_cal[bin].vco_array = SPECAN_CAL_INVALID;
+			cc2400_strobe(SRFOFF);
+			while ((cc2400_status() & FS_LOCK));
+			lock_timeouts++;
+			return 0;
+		}
+	}
+
+	if (specan_cal[bin].vco_array == SPECAN_CAL_INVALID) {
+		specan_cal[bin].vco_array = cc2400_get(FSTST0) & FSTST0_VCO_ARRAY_RES_MASK;
+		specan_cal[bin].vco_current = cc2400_get(FSTST2) & FSTST2_VCO_CURRENT_RES_MASK;
+	}
+	return 1;
+}
+
+/* The calibration sweep. Returns its length in ticks. */
+static uint32_t calibrate(uint16_t fstst0, uint16_t fstst2)
+{
+	uint32_t start = radio.now;
+	uint16_t bin, t, settle = 0;
+
+	for (bin = 0; bin < BINS; bin++) {
+		specan_cal[bin].vco_array = SPECAN_CAL_INVALID;
+		cc2400_set(FSDIV, 2400 + bin - 1);
+		specan_fs_on(bin, fstst0, fstst2);
+		if (!specan_fs_lock(bin))
+			continue;
+		cc2400_strobe(SRX);
+		t = measure_rssi_settle();
+		if (t > settle)
+			settle = t;
+		cc2400_strobe(SRFOFF);
+		while ((cc2400_status() & FS_LOCK));
+	}
+	specan_settle_time = settle + (settle >> 2);
+	return radio.now - start;
+}
+
+/* One of the sweeps that follow. Returns its length in ticks. */
+static uint32_t sweep(uint16_t fstst0, uint16_t fstst2)
+{
+	uint32_t start, sweep_start = radio.now;
+	uint16_t bin;
+
+	for (bin = 0; bin < BINS; bin++) {
+		cc2400_set(FSDIV, 2400 + bin - 1);
+		specan_fs_on(bin, fstst0, fstst2);
+		if (!specan_fs_lock(bin)) {
+			samples[bin] = RSSI_FLOOR;
+			continue;
+		}
+		cc2400_strobe(SRX);
+
+		start = CLK100NS;
+		while (clk100ns_since(start) < specan_settle_time);
+		samples[bin] = cc2400_get(RSSI) >> 8;
+
+		cc2400_strobe(SRFOFF);
+		while ((cc2400_status() & FS_LOCK));
+	}
+	return radio.now - sweep_start;
+}
+
+/* bins whose last sample is off the settled level by more than the noise */
+static int unsettled(void)
+{
+	int bin, n = 0, diff;
+
+	for (bin = 0; bin < BINS; bin++) {
+		diff = samples[bin] - model_level(2400 + bin);
+		n += diff < 0 || diff > 1;
+	}
+	return n;
+}
+
+int main(void)
+{
+	uint32_t cal_time, fast_time, t;
+	uint16_t fstst0 = 0, fstst2 = 0;
+	int bin, bad, max_settle = 0;
+
+	/* the first sweep calibrates at every frequency and caches what the
+	 * calibration found */
+	cal_time = calibrate(fstst0, fstst2);
+	CHECK_EQ("full calibrations", radio.full_cals, BINS);
+	CHECK_EQ("lock timeouts, calibrating", lock_timeouts, 0);
+	bad = 0;
+	for (bin = 0; bin < BINS; bin++)
+		bad += specan_cal[bin].vco_array != model_vco_array(2400 + bin)
+		       || specan_cal[bin].vco_current != model_vco_current(2400 + bin);
+	CHECK_EQ("cached calibration mismatches", bad, 0);
+
+	/* the measured settle time covers the slowest frequency */
+	for (bin = 0; bin < BINS; bin++)
+		if ((int)model_settle_ticks(2400 + bin) > max_settle)
+			max_settle = model_settle_ticks(2400 + bin);
+	CHECK_EQ("settle time covers the slowest bin",
+	         specan_settle_time >= max_settle, 1);
+	CHECK_EQ("settle time under SPECAN_SETTLE_MAX",
+	         specan_settle_time < SPECAN_SETTLE_MAX, 1);
+
+	/* later sweeps lock on the cached values without calibrating, and
+	 * every sample is taken after RSSI has settled */
+	fast_time = sweep(fstst0, fstst2);
+	CHECK_EQ("full calibrations after a cached sweep", radio.full_cals, BINS);
+	CHECK_EQ("lock timeouts, cached", lock_timeouts, 0);
+	CHECK_EQ("unsettled samples", unsettled(), 0);
+	CHECK_EQ("cached sweep faster", fast_time < cal_time, 1);
+
+	/* Once the VCO has drifted away from the cache, a bin times out and
+	 * drops its values, calibrates fully on the next sweep and is back to
+	 * the fast path on the one after. */
+	radio.vco_drift = 3;
+	sweep(fstst0, fstst2);
+	CHECK_EQ("lock timeouts, stale cache", lock_timeouts, BINS);
+	sweep(fstst0, fstst2);
+	CHECK_EQ("full calibrations after recovery", radio.full_cals, 2 * BINS);
+	CHECK_EQ("unsettled samples after recovery", unsettled(), 0);
+	t = sweep(fstst0, fstst2);
+	CHECK_EQ("lock timeouts after recovery", lock_timeouts, BINS);
+	CHECK_EQ("recovered sweep time", t, fast_time);
+
+	if (failures) {
+		fprintf(stderr, "%d check(s) failed\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+
+	printf("modelled %d bin sweep: %.2f ms calibrating, %.2f ms cached, "
+	       "settle %.1f us\n", BINS, cal_time / 1e4, fast_time / 1e4,
+	       specan_settle_time / 10.0);
+	return 0;
+}
@@ -32,23 +32,30 @@ class Ubertooth(object):
     def __init__(self):
         self.proc = None
 
+    # binary sweep frame header written by ubertooth-specan -s
+    SWEEP_MAGIC = 0x50575355
+    SWEEP_HEADER = struct.Struct('<IIHHHH')
+
+    def _read_exactly(self, length):
+        data = b''
+        while len(data) < length and self.proc.poll() is None:
+            chunk = self.proc.stdout.read(length - len(data))
+            if not chunk:
+                break
+            data += chunk
+        return data
+
     def specan(self, low_frequency, high_frequency, ubertooth_device=-1):
         spacing_hz = 1e6
         bin_count = int(round((high_frequency - low_frequency) / spacing_hz)) + 1
         frequency_axis = numpy.linspace(low_frequency, high_frequency, num=bin_count, endpoint=True)
-        frame_size = len(frequency_axis)
-        buffer_size = frame_size * 3
-        frequency_index_map = dict(((int(round(frequency_axis[index] / 1e6)), index) for index in range(frame_size)))
 
         low = int(round(low_frequency / 1e6))
         high = int(round(high_frequency / 1e6))
-        args = ["ubertooth-specan", "-d", "-", "-l %d" % low, "-u %d" % high, "-U %d" % ubertooth_device]
+        args = ["ubertooth-specan", "-s", "-", "-l %d" % low, "-u %d" % high, "-U %d" % ubertooth_device]
         self.proc = subprocess.Popen(args, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
 
-        default_raw_rssi = -128
         rssi_offset = -54
-        rssi_values = numpy.empty((bin_count,), dtype=numpy.float32)
-        rssi_values.fill(default_raw_rssi + rssi_offset)
 
         # Give it a chance to time out if it fails to find Ubertooth
         time.sleep(0.5)
@@ -57,20 +64,25 @@ class Ubertooth(object):
             print("Failed to run: ", ' '.join(args))
             return
         while self.proc.poll() is None:
-            data = self.proc.stdout.read(buffer_size)
-            while len(data) >= 3:
-                frequency, raw_rssi_value = struct.unpack('>Hb', data[:3])
-                data = data[3:]
-                if frequency >= low and frequency <= high:
-                    index = frequency_index_map[frequency]
-                    if index == 0:
-                        # new frame, pause as a frame limiter!
-                        time.sleep(0.013)  # I regret nothing
-
-                        # We started a new frame, send the existing frame
-                        yield (frequency_axis, rssi_values)
-                        rssi_values.fill(default_raw_rssi + rssi_offset)
-                    rssi_values[index] = raw_rssi_value + rssi_offset
+            header = self._read_exactly(self.SWEEP_HEADER.size)
+            if len(header) < self.SWEEP_HEADER.size:
+                break
+            magic, clk100ns, sweep_low, sweep_high, step, num_bins = self.SWEEP_HEADER.unpack(header)
+            if magic != self.SWEEP_MAGIC:
+                print("Lost sweep framing from ubertooth-specan")
+                break
+            data = self._read_exactly(num_bins)
+            if len(data) < num_bins:
+                break
+            if sweep_low != low or step != 1 or num_bins != bin_count:
+                continue
+
+            rssi_values = numpy.frombuffer(data, dtype=numpy.int8).astype(numpy.float32)
+            rssi_values += rssi_offset
+
+            # one frame per sweep, pause as a frame limiter!
+            time.sleep(0.013)  # I regret nothing
+            yield (frequency_axis, rssi_values)
 
     def close(self):
         if self.proc and not self.proc.poll():
@@ -0,0 +1,547 @@
+/*
+ * Copyright 2026 Great Scott Gadgets
+ *
+ * This file is part of Project Ubertooth.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Wireshark extcap for Bluetooth LE advertising channels. Each Ubertooth
+ * is an interface of its own; with more than one attached, the "all"
+ * interface follows channels 37, 38 and 39 at once on up to three
+ * devices and writes one pcapng interface per device.
+ */
+
+#include "ubertooth.h"
+#include "ubertooth_callback.h"
+#include <getopt.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define EXTCAP_IFACE_PREFIX "ubertooth"
+#define EXTCAP_IFACE_ALL    "ubertooth-all"
+
+/* LINKTYPE_BLUETOOTH_LE_LL_WITH_PHDR */
+#define DLT_BLUETOOTH_LE_LL_WITH_PHDR 256
+#define LE_PHDR_LEN 10
+#define LE_PHDR_DEWHITENED    0x0001
+#define LE_PHDR_SIGPOWER      0x0002
+#define LE_PHDR_REF_AA_VALID  0x0010
+
+#define ADV_ACCESS_ADDRESS 0x8e89bed6
+#define MAX_DEVICES        3
+#define FIFO_BUFFER_SIZE   (64 * 1024)
+
+enum capture_formats {
+	FORMAT_PCAPNG = 0,
+	FORMAT_PCAP   = 1,
+};
+
+typedef struct {
+	ubertooth_t* ut;
+	int index;
+	int adv_channel;
+	uint32_t interface_id;
+	FILE* out;
+	int format;
+	int error;
+} capture_device;
+
+static const char* board_names[] = {
+	"Ubertooth Zero",
+	"Ubertooth One",
+	"ToorCon 13 Badge"
+};
+
+static volatile int stop_capture = 0;
+
+static void stop_handler(int sig __attribute__((unused)))
+{
+	stop_capture = 1;
+}
+
+static void put_le16(uint8_t* buf, uint16_t val)
+{
+	buf[0] = val & 0xff;
+	buf[1] = (val >> 8) & 0xff;
+}
+
+static void put_le32(uint8_t* buf, uint32_t val)
+{
+	put_le16(buf, val & 0xffff);
+	put_le16(buf + 2, val >> 16);
+}
+
+static uint16_t adv_channel_freq(int adv_channel)
+{
+	if (adv_channel == 38)
+		return 2426;
+	if (adv_channel == 39)
+		return 2480;
+	return 2402;
+}
+
+/*
+ * pcap/pcapng output. Blocks are written in host byte order, as both
+ * formats allow, and left to stdio so that the fifo sees large writes.
+ */
+
+static int write_pad(FILE* out, size_t len)
+{
+	static const uint8_t zero[4] = { 0, };
+	size_t pad = (4 - (len & 3)) & 3;
+
+	return fwrite(zero, 1, pad, out) == pad ? 0 : -1;
+}
+
+static size_t option_len(const char* value)
+{
+	size_t len = strlen(value);
+	return 4 + len + ((4 - (len & 3)) & 3);
+}
+
+static int write_option(FILE* out, uint16_t code, const void* value,
+                        uint16_t len)
+{
+	if (fwrite(&code, 2, 1, out) != 1 || fwrite(&len, 2, 1, out) != 1
+	    || fwrite(value, 1, len, out) != len)
+		return -1;
+	return write_pad(out, len);
+}
+
+static int write_pcapng_shb(FILE* out)
+{
+	const char* appl = "ubertooth-btle-extcap";
+	uint32_t type = 0x0a0d0d0a, magic = 0x1a2b3c4d, len, end = 0;
+	uint16_t major = 1, minor = 0;
+	int64_t section_len = -1;
+
+	len = 28 + option_len(appl) + 4;
+	if (fwrite(&type, 4, 1, out) != 1 || fwrite(&len, 4, 1, out) != 1
+	    || fwrite(&magic, 4, 1, out) != 1 || fwrite(&major, 2, 1, out) != 1
+	    || fwrite(&minor, 2, 1, out) != 1
+	    || fwrite(&section_len, 8, 1, out) != 1
+	    || write_option(out, 4, appl, strlen(appl)) < 0 /* shb_userappl */
+	    || fwrite(&end, 4, 1, out) != 1
+	    || fwrite(&len, 4, 1, out) != 1)
+		return -1;
+	return 0;
+}
+
+static int write_pcapng_idb(FILE* out, const capture_device* dev)
+{
+	char name[32], desc[64];
+	uint32_t type = 1, len, snaplen = 65535, end = 0;
+	uint16_t linktype = DLT_BLUETOOTH_LE_LL_WITH_PHDR, reserved = 0;
+	uint8_t tsresol = 9; /* nanoseconds */
+
+	snprintf(name, sizeof(name), EXTCAP_IFACE_PREFIX "%d", dev->index);
+	snprintf(desc, sizeof(desc), "Ubertooth %d, advertising channel %d",
+	         dev->index, dev->adv_channel);
+
+	len = 16 + option_len(name) + option_len(desc) + 8 + 4 + 4;
+	if (fwrite(&type, 4, 1, out) != 1 || fwrite(&len, 4, 1, out) != 1
+	    || fwrite(&linktype, 2, 1, out) != 1
+	    || fwrite(&reserved, 2, 1, out) != 1
+	    || fwrite(&snaplen, 4, 1, out) != 1
+	    || write_option(out, 2, name, strlen(name)) < 0 /* if_name */
+	    || write_option(out, 3, desc, strlen(desc)) < 0 /* if_description */
+	    || write_option(out, 9, &tsresol, 1) < 0        /* if_tsresol */
+	    || fwrite(&end, 4, 1, out) != 1
+	    || fwrite(&len, 4, 1, out) != 1)
+		return -1;
+	return 0;
+}
+
+static int write_pcap_header(FILE* out)
+{
+	/* nanosecond resolution pcap */
+	uint32_t magic = 0xa1b23c4d, zone = 0, sigfigs = 0, snaplen = 65535;
+	uint32_t network = DLT_BLUETOOTH_LE_LL_WITH_PHDR;
+	uint16_t major = 2, minor = 4;
+
+	if (fwrite(&magic, 4, 1, out) != 1 || fwrite(&major, 2, 1, out) != 1
+	    || fwrite(&minor, 2, 1, out) != 1 || fwrite(&zone, 4, 1, out) != 1
+	    || fwrite(&sigfigs, 4, 1, out) != 1 || fwrite(&snaplen, 4, 1, out) != 1
+	    || fwrite(&network, 4, 1, out) != 1)
+		return -1;
+	return 0;
+}
+
+static int write_record(FILE* out, int format, uint32_t interface_id,
+                        uint64_t ts_ns, const uint8_t* data, uint32_t len)
+{
+	uint32_t hdr[7];
+
+	if (format == FORMAT_PCAP) {
+		hdr[0] = ts_ns / 1000000000ull;
+		hdr[1] = ts_ns % 1000000000ull;
+		hdr[2] = hdr[3] = len;
+		if (fwrite(hdr, 4, 4, out) != 4 || fwrite(data, 1, len, out) != len)
+			return -1;
+		return 0;
+	}
+
+	/* Enhanced Packet Block */
+	hdr[0] = 6;
+	hdr[1] = 32 + len + ((4 - (len & 3)) & 3);
+	hdr[2] = interface_id;
+	hdr[3] = ts_ns >> 32;
+	hdr[4] = ts_ns & 0xffffffff;
+	hdr[5] = hdr[6] = len;
+	if (fwrite(hdr, 4, 7, out) != 7 || fwrite(data, 1, len, out) != len
+	    || write_pad(out, len) < 0 || fwrite(&hdr[1], 4, 1, out) != 1)
+		return -1;
+	return 0;
+}
+
+/* Build a LINKTYPE_BLUETOOTH_LE_LL_WITH_PHDR frame from an LE_PACKET.
+ * Returns the frame length. */
+static int build_le_frame(const usb_pkt_rx* rx, uint8_t* frame)
+{
+	uint32_t aa = rx->data[0] | (rx->data[1] << 8) | (rx->data[2] << 16)
+	              | ((uint32_t)rx->data[3] << 24);
+	uint16_t flags = LE_PHDR_DEWHITENED | LE_PHDR_SIGPOWER;
+	int len = 4 + 2 + (rx->data[5] & 0x3f) + 3;
+
+	if (len > DMA_SIZE)
+		len = DMA_SIZE;
+
+	frame[0] = rx->channel / 2; /* RF channel, 2402 MHz is 0 */
+	frame[1] = (uint8_t)cc2400_rssi_to_dbm(rx->rssi_max);
+	frame[2] = (uint8_t)INT8_MIN; /* noise unknown */
+	frame[3] = 0;
+	if (aa == ADV_ACCESS_ADDRESS) {
+		put_le32(&frame[4], ADV_ACCESS_ADDRESS);
+		flags |= LE_PHDR_REF_AA_VALID;
+	} else {
+		put_le32(&frame[4], 0);
+	}
+	put_le16(&frame[8], flags);
+	memcpy(&frame[LE_PHDR_LEN], rx->data, len);
+
+	return LE_PHDR_LEN + len;
+}
+
+static void list_interfaces(void)
+{
+	int i, j, board, count = ubertooth_count();
+	ubertooth_t* ut;
+	uint8_t serial[17];
+
+	printf("extcap {version=1.0}{help=https://github.com/greatscottgadgets/ubertooth}\n");
+
+	for (i = 0; i < count; i++) {
+		printf("interface {value=" EXTCAP_IFACE_PREFIX "%d}{display=", i);
+		ut = ubertooth_start(i);
+		if (ut == NULL) {
+			printf("Ubertooth %d}\n", i);
+			continue;
+		}
+		board = cmd_get_board_id(ut->devh);
+		if (board >= 0 && board <= BOARD_ID_TC13BADGE)
+			printf("%s", board_names[board]);
+		else
+			printf("Ubertooth %d", i);
+		if (cmd_get_serial(ut->devh, serial) == 0) {
+			printf(" ");
+			for (j = 1; j < 17; j++)
+				printf("%02x", serial[j]);
+		}
+		ubertooth_stop(ut);
+		printf("}\n");
+	}
+
+	if (count > 1)
+		printf("interface {value=" EXTCAP_IFACE_ALL "}{display=Ubertooth, "
+		       "all advertising channels (%d devices)}\n",
+		       count < MAX_DEVICES ? count : MAX_DEVICES);
+}
+
+static void list_dlts(void)
+{
+	printf("dlt {number=%d}{name=BLUETOOTH_LE_LL_WITH_PHDR}"
+	       "{display=Bluetooth Low Energy Link Layer}\n",
+	       DLT_BLUETOOTH_LE_LL_WITH_PHDR);
+}
+
+static void config(const char* interface)
+{
+	if (strcmp(interface, EXTCAP_IFACE_ALL) != 0) {
+		printf("arg {number=0}{call=--channel}{display=Advertising Channel}"
+		       "{type=selector}\n");
+		printf("value {arg=0}{value=37}{display=37}{default=true}\n");
+		printf("value {arg=0}{value=38}{display=38}{default=false}\n");
+		printf("value {arg=0}{value=39}{display=39}{default=false}\n");
+	}
+	printf("arg {number=1}{call=--format}{display=Capture Format}"
+	       "{type=selector}\n");
+	printf("value {arg=1}{value=pcapng}{display=pcapng}{default=true}\n");
+	printf("value {arg=1}{value=pcap}{display=pcap}{default=false}\n");
+}
+
+static int start_device(capture_device* dev)
+{
+	dev->ut = ubertooth_start(dev->index);
+	if (dev->ut == NULL)
+		return -1;
+
+	if (ubertooth_check_api(dev->ut) < 0)
+		return -1;
+
+	cmd_set_modulation(dev->ut->devh, MOD_BT_LOW_ENERGY);
+	cmd_set_channel(dev->ut->devh, adv_channel_freq(dev->adv_channel));
+	cmd_set_time_sync(dev->ut->devh, 1);
+	cmd_set_le_packed(dev->ut->devh, 1);
+	return ubertooth_bulk_init(dev->ut);
+}
+
+/* ubertooth_bulk_receive() callback: meta packets such as TIME_SYNC have
+ * already been taken care of, and LE_PACKED transfers unpacked. */
+static void cb_extcap(ubertooth_t* ut, void* args)
+{
+	capture_device* dev = (capture_device*)args;
+	usb_pkt_rx rx = fifo_pop(ut->fifo);
+	uint8_t frame[LE_PHDR_LEN + DMA_SIZE];
+	int len;
+
+	if (rx.pkt_type != LE_PACKET || dev->error)
+		return;
+
+	len = build_le_frame(&rx, frame);
+	dev->error = write_record(dev->out, dev->format, dev->interface_id,
+	                          now_ns_from_clk100ns(ut, &rx), frame, len);
+}
+
+static int capture(const char* interface, const char* fifo, int adv_channel,
+                   int format)
+{
+	capture_device devs[MAX_DEVICES];
+	int num_devs = 0, i, r = 0, count, got, usb_error = 0;
+	FILE* out;
+
+	memset(devs, 0, sizeof(devs));
+
+	if (strcmp(interface, EXTCAP_IFACE_ALL) == 0) {
+		count = ubertooth_count();
+		if (count > MAX_DEVICES)
+			count = MAX_DEVICES;
+		for (i = 0; i < count; i++) {
+			devs[num_devs].index = i;
+			devs[num_devs].interface_id = num_devs;
+			devs[num_devs].adv_channel = 37 + i;
+			num_devs++;
+		}
+	} else if (strncmp(interface, EXTCAP_IFACE_PREFIX,
+	                   strlen(EXTCAP_IFACE_PREFIX)) == 0) {
+		devs[0].index = atoi(interface + strlen(EXTCAP_IFACE_PREFIX));
+		devs[0].adv_channel = adv_channel;
+		num_devs = 1;
+	}
+
+	if (num_devs == 0) {
+		fprintf(stderr, "Unknown interface '%s'\n", interface);
+		return 1;
+	}
+
+	out = fopen(fifo, "wb");
+	if (out == NULL) {
+		perror(fifo);
+		return 1;
+	}
+	setvbuf(out, NULL, _IOFBF, FIFO_BUFFER_SIZE);
+
+	for (i = 0; i < num_devs; i++) {
+		devs[i].out = out;
+		devs[i].format = format;
+		if (start_device(&devs[i]) < 0) {
+			fprintf(stderr, "Unable to start Ubertooth %d\n", devs[i].index);
+			r = 1;
+			goto out;
+		}
+	}
+
+	if (format == FORMAT_PCAP) {
+		r = write_pcap_header(out);
+	} else {
+		r = write_pcapng_shb(out);
+		for (i = 0; i < num_devs && r == 0; i++)
+			r = write_pcapng_idb(out, &devs[i]);
+	}
+	/* a write error just means Wireshark has gone away */
+	if (r != 0 || fflush(out) != 0) {
+		r = 0;
+		goto out;
+	}
+
+	/* one event thread serves the bulk transfers of every device */
+	if (ubertooth_bulk_thread_start() != 0) {
+		fprintf(stderr, "Unable to start the USB event thread\n");
+		r = 1;
+		goto out;
+	}
+	for (i = 0; i < num_devs && r == 0; i++)
+		r = cmd_btle_sniffing(devs[i].ut->devh, 2);
+
+	while (!stop_capture && r == 0) {
+		got = 0;
+		for (i = 0; i < num_devs && r == 0; i++) {
+			/* cb_xfer() drops the transfer once the device fails */
+			if (devs[i].ut->rx_xfer == NULL) {
+				fprintf(stderr, "USB error on Ubertooth %d\n", devs[i].index);
+				usb_error = 1;
+				r = -1;
+				break;
+			}
+			while (!devs[i].error
+			       && ubertooth_bulk_receive(devs[i].ut, cb_extcap, &devs[i]) == 0)
+				got = 1;
+			r = devs[i].error;
+		}
+
+		/* only push data to Wireshark once the devices are drained */
+		if (!got) {
+			if (fflush(out) != 0)
+				break;
+			usleep(500);
+		}
+	}
+
+	ubertooth_bulk_thread_stop();
+	r = usb_error;
+
+out:
+	for (i = 0; i < num_devs; i++)
+		if (devs[i].ut)
+			ubertooth_stop(devs[i].ut);
+	fclose(out);
+	return r;
+}
+
+static void usage(FILE *file)
+{
+	fprintf(file, "ubertooth-btle-extcap - Wireshark extcap for Bluetooth LE advertising channels\n");
+	fprintf(file, "Usage:\n");
+	fprintf(file, "\t--extcap-interfaces list interfaces\n");
+	fprintf(file, "\t--extcap-dlts list link types of --extcap-interface\n");
+	fprintf(file, "\t--extcap-config list options of --extcap-interface\n");
+	fprintf(file, "\t--capture capture from --extcap-interface to --fifo\n");
+	fprintf(file, "\t--extcap-interface <ubertoothN|" EXTCAP_IFACE_ALL ">\n");
+	fprintf(file, "\t--fifo <path> write packets to <path>\n");
+	fprintf(file, "\t--channel <37-39> advertising channel (default 37)\n");
+	fprintf(file, "\t--format <pcapng|pcap> (default pcapng)\n");
+}
+
+int main(int argc, char *argv[])
+{
+	enum { OPT_INTERFACES = 256, OPT_DLTS, OPT_CONFIG, OPT_CAPTURE,
+	       OPT_INTERFACE, OPT_FIFO, OPT_CHANNEL, OPT_FORMAT, OPT_VERSION };
+	static const struct option long_opts[] = {
+		{ "extcap-interfaces", no_argument,       NULL, OPT_INTERFACES },
+		{ "extcap-dlts",       no_argument,       NULL, OPT_DLTS },
+		{ "extcap-config",     no_argument,       NULL, OPT_CONFIG },
+		{ "capture",           no_argument,       NULL, OPT_CAPTURE },
+		{ "extcap-interface",  required_argument, NULL, OPT_INTERFACE },
+		{ "fifo",              required_argument, NULL, OPT_FIFO },
+		{ "channel",           required_argument, NULL, OPT_CHANNEL },
+		{ "format",            required_argument, NULL, OPT_FORMAT },
+		{ "extcap-version",    optional_argument, NULL, OPT_VERSION },
+		{ "help",              no_argument,       NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int opt, do_interfaces = 0, do_dlts = 0, do_config = 0, do_capture = 0;
+	int adv_channel = 37, format = FORMAT_PCAPNG;
+	const char *interface = NULL, *fifo = NULL;
+
+	while ((opt = getopt_long(argc, argv, "h", long_opts, NULL)) != EOF) {
+		switch (opt) {
+		case OPT_INTERFACES:
+			do_interfaces = 1;
+			break;
+		case OPT_DLTS:
+			do_dlts = 1;
+			break;
+		case OPT_CONFIG:
+			do_config = 1;
+			break;
+		case OPT_CAPTURE:
+			do_capture = 1;
+			break;
+		case OPT_INTERFACE:
+			interface = optarg;
+			break;
+		case OPT_FIFO:
+			fifo = optarg;
+			break;
+		case OPT_CHANNEL:
+			adv_channel = atoi(optarg);
+			if (adv_channel < 37 || adv_channel > 39) {
+				fprintf(stderr, "Advertising channel must be 37, 38 or 39\n");
+				return 1;
+			}
+			break;
+		case OPT_FORMAT:
+			format = strcmp(optarg, "pcap") == 0 ? FORMAT_PCAP : FORMAT_PCAPNG;
+			break;
+		case OPT_VERSION:
+			break;
+		case 'h':
+			usage(stdout);
+			return 0;
+		default:
+			usage(stderr);
+			return 1;
+		}
+	}
+
+	if (do_interfaces) {
+		list_interfaces();
+		return 0;
+	}
+
+	/* everything else needs an interface */
+	if (interface == NULL) {
+		usage(stderr);
+		return 1;
+	}
+
+	if (do_dlts) {
+		list_dlts();
+		return 0;
+	}
+
+	if (do_config) {
+		config(interface);
+		return 0;
+	}
+
+	if (do_capture) {
+		if (fifo == NULL) {
+			fprintf(stderr, "Must specify fifo!\n");
+			return 1;
+		}
+		signal(SIGINT, stop_handler);
+		signal(SIGTERM, stop_handler);
+		signal(SIGPIPE, SIG_IGN);
+		return capture(interface, fifo, adv_channel, format);
+	}
+
+	usage(stderr);
+	return 1;
+}
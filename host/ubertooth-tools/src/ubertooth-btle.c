@@ -21,12 +21,15 @@
 
 #include "ubertooth.h"
 #include "ubertooth_callback.h"
+#include "ubertooth_bluetooth.h"
+#include "ubertooth_adv.h"
 #include <ctype.h>
 #include <err.h>
 #include <getopt.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <time.h>
 
 int convert_mac_address(char *s, uint8_t *o) {
 	int i;
@@ -72,6 +75,9 @@ static void usage(void)
 	printf("\t-a[address] get/set access address (example: -a8e89bed6)\n");
 	printf("\t-s<address> faux slave mode, using MAC addr (example: -s22:44:66:88:aa:cc)\n");
 	printf("\t-t<address> set connection following target (example: -t22:44:66:88:aa:cc)\n");
+	printf("\t-F<address> in promiscuous mode only follow this access address, up to %d times (example: -F8e89bed6)\n", BT_AC_MAX_TARGETS);
+	printf("\t-m<n> in follow mode follow up to n connections at once, tagging packets with conn=<slot> (1-%d, default 1)\n", LE_FOLLOW_MAX);
+	printf("\t-D[seconds] in follow mode count repeated advertisements on the device, printing statistics every n seconds (default 10)\n");
 	printf("\n");
 	printf("    Interference (use with -f or -p):\n");
 	printf("\t-i interfere with one connection and return to idle\n");
@@ -87,6 +93,7 @@ static void usage(void)
 	printf("\t-A<index> advertising channel index (default 37)\n");
 	printf("\t-v[01] verify CRC mode, get status or enable/disable\n");
 	printf("\t-x<n> allow n access address offenses (default 32)\n");
+	printf("\t-T<filename> record firmware trace events, as Chrome trace JSON if the name ends in .json\n");
 
 	printf("\nIf an input file is not specified, an Ubertooth device is used for live capture.\n");
 	printf("In get/set mode no capture occurs.\n");
@@ -109,7 +116,13 @@ int main(int argc, char *argv[])
 
 	int r;
 	u32 access_address;
+	u32 filter_aas[BT_AC_MAX_TARGETS];
+	int num_filter_aas = 0;
 	uint8_t mac_address[6] = { 0, };
+	adv_stats_t* adv_stats = NULL;
+	int adv_stats_period = 10;
+	int follow_max = 1;
+	time_t adv_stats_next = 0;
 
 	do_follow = do_promisc = 0;
 	do_get_aa = do_set_aa = 0;
@@ -117,7 +130,7 @@ int main(int argc, char *argv[])
 	do_adv_index = 37;
 	do_slave_mode = do_target = 0;
 
-	while ((opt=getopt(argc,argv,"a::r:hfpU:v::A:s:t:x:c:q:jJiI")) != EOF) {
+	while ((opt=getopt(argc,argv,"a::r:hfm:pU:v::A:s:t:x:c:q:jJiIF:D::T:")) != EOF) {
 		switch(opt) {
 		case 'a':
 			if (optarg == NULL) {
@@ -130,6 +143,14 @@ int main(int argc, char *argv[])
 		case 'f':
 			do_follow = 1;
 			break;
+		case 'm':
+			follow_max = atoi(optarg);
+			if (follow_max < 1 || follow_max > LE_FOLLOW_MAX) {
+				printf("Error: can follow 1-%d connections at once\n",
+				       LE_FOLLOW_MAX);
+				return 1;
+			}
+			break;
 		case 'p':
 			do_promisc = 1;
 			break;
@@ -196,6 +217,28 @@ int main(int argc, char *argv[])
 				return 1;
 			}
 			break;
+		case 'F':
+			if (num_filter_aas == BT_AC_MAX_TARGETS) {
+				printf("Error: at most %d access addresses can be filtered on\n",
+				       BT_AC_MAX_TARGETS);
+				return 1;
+			}
+			sscanf(optarg, "%08x", &filter_aas[num_filter_aas++]);
+			break;
+		case 'T':
+			ut->trace = trace_writer_open_file(optarg);
+			if (ut->trace == NULL)
+				err(1, "%s", optarg);
+			break;
+		case 'D':
+			if (optarg)
+				adv_stats_period = atoi(optarg);
+			if (adv_stats_period <= 0) {
+				printf("Error: statistics period must be positive\n");
+				return 1;
+			}
+			adv_stats = adv_stats_init();
+			break;
 		case 'x':
 			cb_opts.allowed_access_address_errors = (unsigned) atoi(optarg);
 			if (cb_opts.allowed_access_address_errors > 32) {
@@ -240,6 +283,10 @@ int main(int argc, char *argv[])
 
 	if (do_follow || do_promisc) {
 		usb_pkt_rx rx;
+		usb_pkt_rx records[LE_PACKED_MAX];
+		u8 events[TRACE_READ_MAX * TRACE_EVENT_LEN];
+		u32 lost;
+		int i, n, polls = 0;
 
 		r = cmd_set_jam_mode(ut->devh, jam_mode);
 		if (jam_mode != JAM_NONE && r != 0) {
@@ -247,6 +294,10 @@ int main(int argc, char *argv[])
 			return 1;
 		}
 		cmd_set_modulation(ut->devh, MOD_BT_LOW_ENERGY);
+		cmd_set_le_packed(ut->devh, 1);
+		cmd_set_time_sync(ut->devh, 1);
+		if (ut->trace)
+			cmd_set_trace(ut->devh, TRACE_ENABLE);
 
 		if (do_follow) {
 			u16 channel;
@@ -257,8 +308,18 @@ int main(int argc, char *argv[])
 			else
 				channel = 2480;
 			cmd_set_channel(ut->devh, channel);
+			if (adv_stats) {
+				cmd_set_adv_dedup(ut->devh, 1);
+				adv_stats_next = time(NULL) + adv_stats_period;
+			}
+			if (follow_max > 1 && cmd_le_follow_multi(ut->devh, follow_max) != 0) {
+				printf("Following several connections not supported\n");
+				return 1;
+			}
 			cmd_btle_sniffing(ut->devh, 2);
 		} else {
+			if (num_filter_aas)
+				cmd_set_aa_filter(ut->devh, filter_aas, num_filter_aas, 0);
 			cmd_btle_promisc(ut->devh);
 		}
 
@@ -269,8 +330,29 @@ int main(int argc, char *argv[])
 				break;
 			}
 			if (r == sizeof(usb_pkt_rx)) {
-				fifo_push(ut->fifo, &rx);
-				cb_btle(ut, &cb_opts);
+				n = ubertooth_unpack_le(&rx, records, LE_PACKED_MAX);
+				for (i = 0; i < n; i++) {
+					if (ubertooth_filter_summary(ut, &records[i])
+					    || ubertooth_time_sync(ut, &records[i]))
+						continue;
+					if (adv_stats)
+						adv_stats_add_packet(adv_stats, ut, &records[i]);
+					fifo_push(ut->fifo, &records[i]);
+					cb_btle(ut, &cb_opts);
+				}
+			}
+			/* drain the trace ring about every 10 ms */
+			if (ut->trace && ++polls % 20 == 0) {
+				do {
+					n = cmd_get_trace(ut->devh, events, &lost);
+					if (n < 0)
+						break;
+					trace_writer_add(ut->trace, events, n, lost);
+				} while (n == TRACE_READ_MAX);
+			}
+			if (adv_stats && do_follow && time(NULL) >= adv_stats_next) {
+				adv_stats_print(adv_stats, stdout);
+				adv_stats_next += adv_stats_period;
 			}
 			usleep(500);
 		}
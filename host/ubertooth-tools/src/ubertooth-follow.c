@@ -232,6 +232,9 @@ int main(int argc, char *argv[])
 	if (r < 0)
 		return 1;
 
+	// exact timestamps for the pcap files
+	cmd_set_time_sync(ut->devh, 1);
+
 	// init USB transfer
 	r = ubertooth_bulk_init(ut);
 	if (r < 0)
@@ -243,6 +246,7 @@ int main(int argc, char *argv[])
 
 	cmd_set_bdaddr(ut->devh, btbb_piconet_get_bdaddr(pn));
 	cmd_set_clock(ut->devh, 0);
+	ut->clock_tracking = cmd_clock_track(ut->devh, 1, max_ac_errors) == 0;
 	if(afh_enabled)
 		cmd_set_afh_map(ut->devh, afh_map);
 	btbb_piconet_set_clk_offset(pn, clock+delay);
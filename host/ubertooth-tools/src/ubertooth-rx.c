@@ -21,6 +21,7 @@
 
 #include "ubertooth.h"
 #include "ubertooth_callback.h"
+#include "ubertooth_bluetooth.h"
 #include <err.h>
 #include <getopt.h>
 #include <stdlib.h>
@@ -45,12 +46,16 @@ static void usage()
 	printf("Configuration:\n");
 	printf("\t-c <BT Channel> set a fixed bluetooth channel [Default: 39]\n");
 	printf("\t-e max_ac_errors (default: %d, range: 0-4)\n", max_ac_errors);
+	printf("\t-F filter by LAP on the Ubertooth (requires -l)\n");
+	printf("\t-L <LAP> filter by this LAP on the Ubertooth, may be given up to %d times\n", BT_AC_MAX_TARGETS);
 	printf("\t-t <SECONDS> sniff timeout - 0 means no timeout [Default: 0]\n");
 	printf("\n");
 	printf("Output options:\n");
 	printf("\t-r<filename> capture packets to PcapNG file\n");
 	printf("\t-q<filename> capture packets to PCAP file\n");
 	printf("\t-d<filename> dump packets to binary file\n");
+	printf("\t-Q[ms] print per-channel RSSI, noise floor and carrier sense counts to stderr every ms (default: 1000)\n");
+	printf("\t-T<filename> record firmware trace events, as Chrome trace JSON if the name ends in .json\n");
 	printf("\n");
 	printf("Miscellaneous:\n");
 	printf("\t-V print version information\n");
@@ -60,19 +65,22 @@ static void usage()
 int main(int argc, char* argv[])
 {
 	int opt, have_lap = 0, have_uap = 0;
-	int survey_mode = 0;
+	int survey_mode = 0, device_filter = 0;
 	int r;
 	int timeout = 0;
 	char* end;
 	int ubertooth_device = -1;
 	btbb_piconet* pn = NULL;
 	uint32_t lap = 0;
+	uint32_t filter_laps[BT_AC_MAX_TARGETS];
+	int num_filter_laps = 0;
 	uint8_t uap = 0;
 	uint16_t channel = 9999;
+	uint16_t telemetry_ms = 0;
 
 	ubertooth_t* ut = ubertooth_init();
 
-	while ((opt=getopt(argc,argv,"hVi:l:u:U:d:e:r:sq:t:zc:")) != EOF) {
+	while ((opt=getopt(argc,argv,"hVi:l:u:U:d:e:r:sq:t:zc:FL:Q::T:")) != EOF) {
 		switch(opt) {
 		case 'i':
 			infile = fopen(optarg, "r");
@@ -132,6 +140,26 @@ int main(int argc, char* argv[])
 		case 'z':
 			++survey_mode;
 			break;
+		case 'F':
+			device_filter = 1;
+			break;
+		case 'L':
+			if (num_filter_laps == BT_AC_MAX_TARGETS) {
+				fprintf(stderr, "At most %d LAPs can be filtered on\n",
+				        BT_AC_MAX_TARGETS);
+				return 1;
+			}
+			filter_laps[num_filter_laps++] = strtol(optarg, &end, 16);
+			break;
+		case 'Q':
+			telemetry_ms = optarg ? atoi(optarg) : 1000;
+			ut->print_channel_quality = telemetry_ms != 0;
+			break;
+		case 'T':
+			ut->trace = trace_writer_open_file(optarg);
+			if (ut->trace == NULL)
+				err(1, "%s", optarg);
+			break;
 		case 'c':
 			channel = atoi(optarg);
 			channel = channel + 2402;
@@ -151,6 +179,14 @@ int main(int argc, char* argv[])
 		return 1;
 	}
 
+	if(device_filter && !have_lap) {
+		fprintf(stderr, "Filtering on the Ubertooth requires a LAP\n");
+		return 1;
+	}
+
+	if (device_filter && num_filter_laps < BT_AC_MAX_TARGETS)
+		filter_laps[num_filter_laps++] = lap;
+
 	if (infile == NULL) {
 		r = ubertooth_connect(ut, ubertooth_device);
 		if (r < 0) {
@@ -177,8 +213,10 @@ int main(int argc, char* argv[])
 			btbb_init_piconet(pn, lap);
 			if (have_uap) {
 				btbb_piconet_set_uap(pn, uap);
-				if (infile == NULL)
+				if (infile == NULL) {
 					cmd_set_bdaddr(ut->devh, btbb_piconet_get_bdaddr(pn));
+					ut->clock_tracking = cmd_clock_track(ut->devh, 1, max_ac_errors) == 0;
+				}
 			}
 			if (ut->h_pcapng_bredr) {
 				btbb_pcapng_record_bdaddr(ut->h_pcapng_bredr,
@@ -195,12 +233,35 @@ int main(int argc, char* argv[])
 	if (infile == NULL) {
 		cmd_set_channel(ut->devh, channel);
 
+		/* The access code only depends on the LAP, so this works
+		 * before the UAP is known. */
+		if (num_filter_laps) {
+			r = cmd_set_lap_filter(ut->devh, filter_laps,
+			                       num_filter_laps, max_ac_errors);
+			if (r < 0)
+				return r;
+		}
+
+		/* trace events arrive in bulk slots the firmware has no
+		 * packet for */
+		if (ut->trace) {
+			r = cmd_set_trace(ut->devh, TRACE_ENABLE | TRACE_STREAM);
+			if (r < 0)
+				return r;
+		}
+
 		/* Clean up on exit. */
 		register_cleanup_handler(ut, 0);
 
 		if (timeout)
 			ubertooth_set_timeout(ut, timeout);
 
+		// exact timestamps for the pcap files
+		cmd_set_time_sync(ut->devh, 1);
+
+		if (telemetry_ms)
+			cmd_set_rssi_telemetry(ut->devh, telemetry_ms);
+
 		// init USB transfer
 		r = ubertooth_bulk_init(ut);
 		if (r < 0)
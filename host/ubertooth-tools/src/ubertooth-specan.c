@@ -25,42 +25,139 @@
 
 uint8_t debug;
 
+typedef struct {
+	uint16_t low_freq;
+	uint16_t high_freq;
+	uint8_t output_mode;
+
+	/* sweep assembly state for SPECAN_SWEEP */
+	uint32_t sweep_clk100ns;
+	uint16_t sweep_filled;
+	int8_t* sweep_rssi;
+
+	/* running statistics for SPECAN_STATS */
+	specan_stats_t* stats;
+	unsigned decimation;
+} specan_args;
+
+static void put_le16(uint8_t* buf, uint16_t val)
+{
+	buf[0] = val & 0xff;
+	buf[1] = (val >> 8) & 0xff;
+}
+
+static void put_le32(uint8_t* buf, uint32_t val)
+{
+	put_le16(buf, val & 0xffff);
+	put_le16(buf + 2, val >> 16);
+}
+
+static int write_sweep(specan_args* sa)
+{
+	uint8_t hdr[SPECAN_SWEEP_HEADER_LEN];
+	uint16_t num_bins = sa->high_freq - sa->low_freq + 1;
+	size_t r;
+
+	put_le32(hdr, SPECAN_SWEEP_MAGIC);
+	put_le32(hdr + 4, sa->sweep_clk100ns);
+	put_le16(hdr + 8, sa->low_freq);
+	put_le16(hdr + 10, sa->high_freq);
+	put_le16(hdr + 12, 1);
+	put_le16(hdr + 14, num_bins);
+
+	r = fwrite(hdr, 1, sizeof(hdr), dumpfile);
+	if (r == sizeof(hdr))
+		r = fwrite(sa->sweep_rssi, 1, num_bins, dumpfile);
+	else
+		r = 0;
+	if (r != num_bins) {
+		fprintf(stderr, "Error writing to file (%zu)\n", r);
+		return -1;
+	}
+	fflush(dumpfile);
+	return 0;
+}
+
+/* Collect samples into a sweep and emit it once every bin has been seen.
+ * A sweep with missing bins (dropped packets) is silently discarded. */
+static int add_sweep_sample(specan_args* sa, uint32_t clk100ns,
+                            uint16_t frequency, int8_t rssi)
+{
+	if (frequency < sa->low_freq || frequency > sa->high_freq)
+		return 0;
+
+	if (frequency == sa->low_freq) {
+		sa->sweep_clk100ns = clk100ns;
+		sa->sweep_filled = 0;
+	}
+
+	/* samples arrive in order, anything else means we lost some */
+	if (frequency - sa->low_freq != sa->sweep_filled) {
+		sa->sweep_filled = 0;
+		return 0;
+	}
+
+	sa->sweep_rssi[sa->sweep_filled++] = rssi;
+
+	if (frequency == sa->high_freq) {
+		sa->sweep_filled = 0;
+		return write_sweep(sa);
+	}
+	return 0;
+}
+
 void cb_specan(ubertooth_t* ut __attribute__((unused)), void* args)
 {
-	uint16_t high_freq = (((uint8_t*)args)[0]) |
-	                     (((uint8_t*)args)[1] << 8);
-	uint8_t output_mode = ((uint8_t*)args)[2];
+	specan_args* sa = (specan_args*)args;
+	uint16_t high_freq = sa->high_freq;
+	uint8_t output_mode = sa->output_mode;
 
 	usb_pkt_rx rx = fifo_pop(ut->fifo);
-	int r, j;
-	uint16_t frequency;
-	int8_t rssi;
+	int r, j, n;
+	uint16_t frequencies[SPECAN_MAX_SAMPLES];
+	int8_t rssi[SPECAN_MAX_SAMPLES];
+	uint8_t triple[3];
+
+	if (output_mode == SPECAN_STATS) {
+		uint32_t windows = sa->stats->windows;
+		specan_stats_add_packet(sa->stats, &rx);
+		if (sa->stats->windows != windows)
+			specan_stats_print(sa->stats, sa->decimation, stdout);
+		return;
+	}
+
+	n = specan_unpack(&rx, frequencies, rssi, SPECAN_MAX_SAMPLES);
 
 	/* process each received block */
-	for (j = 0; j < DMA_SIZE-2; j += 3) {
-		frequency = (rx.data[j] << 8) | rx.data[j + 1];
-		rssi = (int8_t)rx.data[j + 2];
+	for (j = 0; j < n; j++) {
 		switch(output_mode) {
 			case SPECAN_FILE:
-				r = fwrite(&rx.data[j], 1, 3, dumpfile);
+				triple[0] = frequencies[j] >> 8;
+				triple[1] = frequencies[j] & 0xff;
+				triple[2] = (uint8_t)rssi[j];
+				r = fwrite(triple, 1, 3, dumpfile);
 				if(r != 3) {
 					fprintf(stderr, "Error writing to file (%d)\n", r);
 					return;
 				}
 				break;
+			case SPECAN_SWEEP:
+				if (add_sweep_sample(sa, rx.clk100ns, frequencies[j], rssi[j]) < 0)
+					return;
+				break;
 			case SPECAN_STDOUT:
 				printf("%f, %d, %d\n", ((double)rx.clk100ns)/10000000,
-				       frequency, rssi);
+				       frequencies[j], rssi[j]);
 				break;
 			case SPECAN_GNUPLOT_NORMAL:
-				printf("%d %d\n", frequency, rssi);
-				if(frequency == high_freq)
+				printf("%d %d\n", frequencies[j], rssi[j]);
+				if(frequencies[j] == high_freq)
 					printf("\n");
 				break;
 			case SPECAN_GNUPLOT_3D:
 				printf("%f %d %d\n", ((double)rx.clk100ns)/10000000,
-				       frequency, rssi);
-				if(frequency == high_freq)
+				       frequencies[j], rssi[j]);
+				if(frequencies[j] == high_freq)
 					printf("\n");
 				break;
 			default:
@@ -87,6 +184,12 @@ static void usage(FILE *file)
 	fprintf(file, "\t-g output suitable for feedgnuplot\n");
 	fprintf(file, "\t-G output suitable for 3D feedgnuplot\n");
 	fprintf(file, "\t-d <filename> output to file\n");
+	fprintf(file, "\t-s <filename> output binary sweep frames to file ('-' for stdout)\n");
+	fprintf(file, "\t-S <sweeps> print statistics summary every <sweeps> sweeps\n");
+	fprintf(file, "\t-D <bins> combine <bins> adjacent frequencies in summaries (default 1)\n");
+	fprintf(file, "\t-a <0-1> averaging weight of a new sample (default 0.1)\n");
+	fprintf(file, "\t-t <rssi> occupancy threshold, raw RSSI (default -30)\n");
+	fprintf(file, "\t-f fast sweep using cached calibration (at most 128 frequencies)\n");
 	fprintf(file, "\t-l lower frequency (default 2402)\n");
 	fprintf(file, "\t-u upper frequency (default 2480)\n");
 	fprintf(file, "\t-U<0-7> set ubertooth device to use\n");
@@ -97,14 +200,21 @@ int main(int argc, char *argv[])
 	int opt, r = 0, output_mode = SPECAN_STDOUT;
 	int lower= 2402, upper= 2480;
 	int ubertooth_device = -1;
+	unsigned stats_sweeps = 0, decimation = 1;
+	int fast = 0;
+	float alpha = 0.1;
+	int threshold = -30;
 
 	ubertooth_t* ut = NULL;
 
-	while ((opt=getopt(argc,argv,"vhgGd:l::u::U:")) != EOF) {
+	while ((opt=getopt(argc,argv,"vhfgGd:s:S:D:a:t:l::u::U:")) != EOF) {
 		switch(opt) {
 		case 'v':
 			debug++;
 			break;
+		case 'f':
+			fast = 1;
+			break;
 		case 'g':
 			output_mode = SPECAN_GNUPLOT_NORMAL;
 			break;
@@ -112,7 +222,8 @@ int main(int argc, char *argv[])
 			output_mode = SPECAN_GNUPLOT_3D;
 			break;
 		case 'd':
-			output_mode = SPECAN_FILE;
+		case 's':
+			output_mode = (opt == 's') ? SPECAN_SWEEP : SPECAN_FILE;
 			if(*optarg == '-') {
 				dumpfile = stdout;
 			} else {
@@ -123,6 +234,19 @@ int main(int argc, char *argv[])
 				}
 			}
 			break;
+		case 'S':
+			output_mode = SPECAN_STATS;
+			stats_sweeps = atoi(optarg);
+			break;
+		case 'D':
+			decimation = atoi(optarg);
+			break;
+		case 'a':
+			alpha = atof(optarg);
+			break;
+		case 't':
+			threshold = atoi(optarg);
+			break;
 		case 'l':
 			if (optarg)
 				lower= atoi(optarg);
@@ -147,6 +271,11 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (lower > upper) {
+		fprintf(stderr, "Lower frequency must not exceed upper frequency\n");
+		return 1;
+	}
+
 	ut = ubertooth_start(ubertooth_device);
 
 	if (ut == NULL) {
@@ -161,11 +290,27 @@ int main(int argc, char *argv[])
 	/* Clean up on exit. */
 	register_cleanup_handler(ut, 0);
 
-	uint8_t specan_args[] = {
-		(uint8_t)(upper & 0xff),
-		(uint8_t)(upper >> 8),
-		output_mode
+	specan_args sa = {
+		.low_freq = lower,
+		.high_freq = upper,
+		.output_mode = output_mode,
+		.decimation = decimation,
 	};
+	if (output_mode == SPECAN_SWEEP) {
+		sa.sweep_rssi = malloc(upper - lower + 1);
+		if (sa.sweep_rssi == NULL) {
+			perror("malloc");
+			return 1;
+		}
+	}
+	if (output_mode == SPECAN_STATS) {
+		sa.stats = specan_stats_init(lower, upper, alpha, threshold,
+		                             stats_sweeps);
+		if (sa.stats == NULL) {
+			fprintf(stderr, "Unable to set up statistics\n");
+			return 1;
+		}
+	}
 
 	// init USB transfer
 	r = ubertooth_bulk_init(ut);
@@ -176,19 +321,40 @@ int main(int argc, char *argv[])
 	if (r < 0)
 		return r;
 
+	// ask for RSSI-only packets, older firmware only sends triples
+	if (cmd_set_specan_format(ut->devh, SPECAN_FORMAT_COMPACT) < 0 && debug)
+		fprintf(stderr, "Compact specan packets not supported by firmware\n");
+
 	// tell ubertooth to start specan and send packets
-	r = cmd_specan(ut->devh, lower, upper);
+	if (fast)
+		r = cmd_specan_fast(ut->devh, lower, upper);
+	else
+		r = cmd_specan(ut->devh, lower, upper);
 	if (r < 0)
 		return r;
 
 	// receive and process each packet
 	while(!ut->stop_ubertooth) {
-		ubertooth_bulk_receive(ut, cb_specan, specan_args);
+		ubertooth_bulk_receive(ut, cb_specan, &sa);
 	}
 
 	ubertooth_bulk_thread_stop();
 
+	if (fast) {
+		specan_rate rate;
+		if (cmd_get_specan_rate(ut->devh, &rate) == 0 && rate.sweep_time > 0)
+			fprintf(stderr, "%u sweeps of %u frequencies, last sweep %.3f ms "
+			        "(%.1f sweeps/s), RSSI settle %.1f us\n",
+			        rate.sweeps, rate.bins, rate.sweep_time / 10000.0,
+			        10000000.0 / rate.sweep_time, rate.settle_time / 10.0);
+	}
+
 	ubertooth_stop(ut);
+	free(sa.sweep_rssi);
+	if (sa.stats) {
+		specan_stats_print(sa.stats, sa.decimation, stdout);
+		specan_stats_free(sa.stats);
+	}
 	fprintf(stderr, "Ubertooth stopped\n");
 	return r;
 }
@@ -64,6 +64,8 @@ static void usage(FILE *output)
 	fprintf(output, "\t-b get hardware board id number\n");
 	fprintf(output, "\t-p get microcontroller Part ID\n");
 	fprintf(output, "\t-s get microcontroller serial number\n");
+	fprintf(output, "\t-Q[0-1] get USB queue statistics, 1 also resets them\n");
+	fprintf(output, "\t-P[seconds] get firmware performance counters, polling every n seconds if given\n");
 }
 
 #define MAX_VERSION_STRING_LEN 255
@@ -79,7 +81,7 @@ int main(int argc, char *argv[])
 	int do_range_test, do_repeater, do_firmware, do_board_id;
 	int do_range_result, do_all_leds, do_identify;
 	int do_set_squelch, do_get_squelch, squelch_level;
-	int do_something, do_compile_info;
+	int do_something, do_compile_info, do_queue_stats, do_perf;
 	int ubertooth_device = -1;
 	char version_string[MAX_VERSION_STRING_LEN];
 
@@ -91,9 +93,9 @@ int main(int argc, char *argv[])
 	do_range_test= do_repeater= do_firmware= do_board_id= -1;
 	do_range_result= do_all_leds= do_identify= -1;
 	do_set_squelch= -1, do_get_squelch= -1; squelch_level= 0;
-	do_something= 0; do_compile_info= -1;
+	do_something= 0; do_compile_info= -1; do_queue_stats= -1; do_perf= -1;
 
-	while ((opt=getopt(argc,argv,"U:hnmefiIprsStvbl::a::C::c::d::q::z::9V")) != EOF) {
+	while ((opt=getopt(argc,argv,"U:hnmefiIprsStvbl::a::C::c::d::q::z::Q::P::9V")) != EOF) {
 		switch(opt) {
 		case 'U':
 			ubertooth_device = atoi(optarg);
@@ -183,6 +185,18 @@ int main(int argc, char *argv[])
 				do_get_squelch = 1;
 			}
 			break;
+		case 'Q':
+			if (optarg)
+				do_queue_stats= atoi(optarg);
+			else
+				do_queue_stats= 0;
+			break;
+		case 'P':
+			if (optarg)
+				do_perf= atoi(optarg);
+			else
+				do_perf= 0;
+			break;
 		case '9':
 			do_something= 1;
 			break;
@@ -291,6 +305,41 @@ int main(int argc, char *argv[])
 		// FIXME: Why do we do this to non-zero results?
 		r = (r >= 0) ? 0 : r;
 	}
+	if(do_queue_stats >= 0) {
+		usb_queue_stats qs;
+		r = cmd_get_queue_stats(ut->devh, &qs, do_queue_stats);
+		if (r == 0) {
+			fprintf(stdout, "USB queue size      : %u packets\n", qs.size);
+			fprintf(stdout, "USB queue depth     : %u packets\n", qs.depth);
+			fprintf(stdout, "USB queue high-water: %u packets\n", qs.high_water);
+			fprintf(stdout, "USB queue overflows : %u\n", qs.overflows);
+		}
+	}
+	while(do_perf >= 0) {
+		perf_counters pc;
+		r = cmd_get_perf_counters(ut->devh, &pc, 0);
+		if (r < 0)
+			break;
+		fprintf(stdout, "DMA transfers       : %u\n", pc.dma_transfers);
+		fprintf(stdout, "DMA overflows       : %u\n", pc.dma_overflows);
+		fprintf(stdout, "DMA errors          : %u\n", pc.dma_errors);
+		fprintf(stdout, "USB alloc failures  : %u\n", pc.usb_alloc_failures);
+		fprintf(stdout, "USB high-water      : %u packets\n", pc.usb_high_water);
+		fprintf(stdout, "USB bulk services   : %u\n", pc.usb_bulk_services);
+		fprintf(stdout, "Hops                : %u\n", pc.hops);
+		fprintf(stdout, "Retune cycles       : %u total, %u max, %u avg\n",
+		        pc.retune_cycles, pc.retune_cycles_max,
+		        pc.hops ? pc.retune_cycles / pc.hops : 0);
+		fprintf(stdout, "Retune latency      : %u us last, %u us max\n",
+		        pc.retune_latency / 10, pc.retune_latency_max / 10);
+		fprintf(stdout, "LE CRC failures     : %u\n", pc.le_crc_failures);
+		fprintf(stdout, "LE promisc states   : %u\n", pc.le_promisc_states);
+		if (do_perf == 0)
+			break;
+		fprintf(stdout, "\n");
+		fflush(stdout);
+		sleep(do_perf);
+	}
 
 	/* final actions */
 	if(do_flash == 0) {